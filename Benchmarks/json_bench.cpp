@@ -0,0 +1,356 @@
+// Times each stage (lex, parse, expression parse, evaluate, deparse) on synthetic documents
+// The corpora come from a fixed seed, so runs on different builds benchmark exactly the same bytes
+// and the JSON report can be compared between releases
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "alloc_stats.hpp"
+#include "evaluator.hpp"
+#include "expr_parser.hpp"
+#include "json.hpp"
+#include "simd_scan.hpp"
+#include "writer.hpp"
+
+namespace {
+  // xorshift64, the standard distributions aren't guaranteed to give the same numbers everywhere
+  class Random {
+  private:
+    uint64_t state;
+
+  public:
+    explicit Random(const uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      return state;
+    }
+
+    // [0, bound)
+    uint64_t below(const uint64_t bound) { return next() % bound; }
+    // [0, 1)
+    double unit() { return static_cast<double>(next() >> 11) * 0x1.0p-53; }
+  };
+
+  void append_number(std::string &out, const double number) {
+    char text[32];
+    out.append(text, json::format_number(text, number));
+  }
+
+  constexpr std::string_view words[] = {"lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+                                        "elit", "sed", "do", "eiusmod", "tempor", "incididunt", "labore"};
+
+  void append_words(std::string &out, Random &random, const size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      if (i > 0)
+        out += ' ';
+      out += words[random.below(std::size(words))];
+    }
+  }
+
+  struct Corpus {
+    std::string name;
+    std::string text;
+    std::string expression;
+    // NDJSON, every stage runs record by record
+    bool lines = false;
+  };
+
+  // Objects and arrays 32 to 64 levels down, many of them so the size adds up
+  Corpus deep_nesting(const size_t size) {
+    Random random(1);
+    std::string text = R"({"items": [)";
+    while (text.size() < size) {
+      if (text.back() != '[')
+        text += ", ";
+      const auto depth = 32 + random.below(33);
+      for (uint64_t i = 0; i < depth; i++)
+        text += i % 2 ? "[" : R"({"n": )";
+      text += std::to_string(random.below(1000));
+      for (uint64_t i = depth; i-- > 0;)
+        text += i % 2 ? "]" : "}";
+    }
+    text += "]}";
+    return {"deep_nesting", std::move(text), "size(items)"};
+  }
+
+  // 256 members per object, numbers, strings and booleans
+  Corpus wide_objects(const size_t size) {
+    Random random(2);
+    std::string text = R"({"rows": [)";
+    char key[16];
+    while (text.size() < size) {
+      if (text.back() != '[')
+        text += ", ";
+      text += '{';
+      for (int field = 0; field < 256; field++) {
+        std::snprintf(key, sizeof(key), "field%03d", field);
+        text.append(field == 0 ? "\"" : ", \"").append(key).append("\": ");
+        switch (field % 4) {
+          case 0:
+            text += std::to_string(random.below(1000000));
+            break;
+          case 1:
+            append_number(text, random.unit() * 1000);
+            break;
+          case 2:
+            text += '"';
+            append_words(text, random, 2);
+            text += '"';
+            break;
+          default:
+            text += random.below(2) ? "true" : "false";
+        }
+      }
+      text += '}';
+    }
+    text += "]}";
+    return {"wide_objects", std::move(text), "max(rows[0].field016, rows[1].field017)"};
+  }
+
+  // One flat array, half integers and half doubles
+  Corpus numeric_arrays(const size_t size) {
+    Random random(3);
+    std::string text = R"({"values": [)";
+    while (text.size() < size) {
+      if (text.back() != '[')
+        text += ", ";
+      if (random.below(2))
+        text += std::to_string(static_cast<int64_t>(random.below(2000000)) - 1000000);
+      else
+        append_number(text, (random.unit() - 0.5) * 1e6);
+    }
+    text += "]}";
+    return {"numeric_arrays", std::move(text), "max(values)"};
+  }
+
+  // Long text bodies with the odd escape in them
+  Corpus string_heavy(const size_t size) {
+    Random random(4);
+    std::string text = R"({"docs": [)";
+    for (int id = 0; text.size() < size; id++) {
+      if (text.back() != '[')
+        text += ", ";
+      text += R"({"id": )" + std::to_string(id) + R"(, "title": ")";
+      append_words(text, random, 4);
+      text += R"(", "body": ")";
+      for (uint64_t sentence = 0, sentences = 5 + random.below(40); sentence < sentences; sentence++) {
+        append_words(text, random, 8 + random.below(12));
+        switch (random.below(8)) {
+          case 0:
+            text += R"(\n)";
+            break;
+          case 1:
+            text += R"( \"quoted\")";
+            break;
+          case 2:
+            text += R"( caf\u00e9)";
+            break;
+          default:
+            text += ". ";
+        }
+      }
+      text += "\"}";
+    }
+    text += "]}";
+    return {"string_heavy", std::move(text), "size(docs[3].body)"};
+  }
+
+  // Small records, one per line
+  Corpus ndjson(const size_t size) {
+    Random random(5);
+    std::string text;
+    for (int id = 0; text.size() < size; id++) {
+      text += R"({"id": )" + std::to_string(id) + R"(, "user": {"name": ")";
+      append_words(text, random, 2);
+      text += R"(", "tags": [)";
+      for (uint64_t tag = 0, tags = random.below(5); tag < tags; tag++)
+        text.append(tag == 0 ? "\"" : ", \"").append(words[random.below(std::size(words))]).append("\"");
+      text += R"(]}, "score": )";
+      append_number(text, random.unit() * 100);
+      text += "}\n";
+    }
+    return {"ndjson", std::move(text), "max(score, id)", true};
+  }
+
+  struct Result {
+    std::string phase;
+    size_t iterations = 0;
+    double ns_per_op = 0;
+    // Bytes gone through per op, 0 when it doesn't make sense for the phase
+    size_t bytes = 0;
+    double allocations_per_op = 0;
+    double alloc_bytes_per_op = 0;
+  };
+
+  // One warm up run, then as many as fit in min_time (at least 3)
+  Result measure(const std::string &phase, const size_t bytes, const double min_time, const std::function<void()> &f) {
+    using clock = std::chrono::steady_clock;
+    f();
+
+    Result result{phase};
+    result.bytes = bytes;
+    const auto allocations = json::alloc_stats();
+    const auto start = clock::now();
+    double elapsed = 0;
+    do {
+      f();
+      result.iterations++;
+      elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while (elapsed < min_time || result.iterations < 3);
+    const auto allocated = json::alloc_stats() - allocations;
+
+    const auto iterations = static_cast<double>(result.iterations);
+    result.ns_per_op = elapsed * 1e9 / iterations;
+    result.allocations_per_op = static_cast<double>(allocated.allocations) / iterations;
+    result.alloc_bytes_per_op = static_cast<double>(allocated.bytes) / iterations;
+    return result;
+  }
+
+  // Keeps the compiler from dropping work whose result isn't otherwise used
+  volatile size_t sink = 0;
+
+  std::vector<Result> run(const Corpus &corpus, const double min_time) {
+    std::vector<std::string_view> records;
+    if (corpus.lines) {
+      std::string_view rest = corpus.text;
+      while (!rest.empty()) {
+        const auto end = std::min(rest.find('\n'), rest.size());
+        records.push_back(rest.substr(0, end));
+        rest.remove_prefix(std::min(end + 1, rest.size()));
+      }
+    } else {
+      records.push_back(corpus.text);
+    }
+
+    std::vector<json::JSONValue> values;
+    for (const auto record: records) {
+      auto [value, error] = json::parse(record);
+      if (!error.empty())
+        throw std::runtime_error(corpus.name + ": " + error);
+      values.push_back(std::move(value));
+    }
+    auto expr = ExprParser().parse(corpus.expression);
+
+    std::vector<Result> results;
+    results.push_back(measure("lex", corpus.text.size(), min_time, [&] {
+      for (const auto record: records)
+        sink = sink + std::get<0>(json::lex(record)).size();
+    }));
+    results.push_back(measure("parse", corpus.text.size(), min_time, [&] {
+      for (const auto record: records)
+        sink = sink + std::get<1>(json::parse(record)).size();
+    }));
+    results.push_back(measure("expression_parse", corpus.expression.size(), min_time, [&] {
+      ExprParser parser;
+      sink = sink + (parser.parse(corpus.expression) != nullptr);
+    }));
+    results.push_back(measure("evaluate", 0, min_time, [&] {
+      for (const auto &value: values)
+        sink = sink + Evaluator(value).evaluate(expr).value.index();
+    }));
+    size_t output_size = 0;
+    for (const auto &value: values)
+      output_size += json::deparse(value).size();
+    results.push_back(measure("deparse", output_size, min_time, [&] {
+      for (const auto &value: values)
+        sink = sink + json::deparse(value).size();
+    }));
+    return results;
+  }
+
+  std::string quoted(const std::string &s) { return json::deparse(json::JSONValue(s)); }
+
+  void report(std::ostream &out, const size_t size, const std::vector<std::pair<Corpus, std::vector<Result>>> &runs) {
+    char number[64];
+    out << "{\n  \"size\": " << size << ",\n  \"simd\": " << quoted(json::simd_level_name(json::active_simd_level()))
+        << ",\n  \"corpora\": [";
+    for (size_t i = 0; i < runs.size(); i++) {
+      const auto &[corpus, results] = runs[i];
+      out << (i == 0 ? "\n" : ",\n") << "    {\"name\": " << quoted(corpus.name)
+          << ", \"bytes\": " << corpus.text.size() << ", \"expression\": " << quoted(corpus.expression)
+          << ", \"phases\": [";
+      for (size_t j = 0; j < results.size(); j++) {
+        const auto &result = results[j];
+        out << (j == 0 ? "\n" : ",\n") << "      {\"phase\": " << quoted(result.phase)
+            << ", \"iterations\": " << result.iterations;
+        std::snprintf(number, sizeof(number), "%.1f", result.ns_per_op);
+        out << ", \"ns_per_op\": " << number;
+        if (result.bytes > 0) {
+          std::snprintf(number, sizeof(number), "%.2f", static_cast<double>(result.bytes) * 1e3 / result.ns_per_op);
+          out << ", \"mb_per_s\": " << number;
+        } else {
+          out << ", \"mb_per_s\": null";
+        }
+        std::snprintf(number, sizeof(number), "%.1f", result.allocations_per_op);
+        out << ", \"allocations_per_op\": " << number;
+        std::snprintf(number, sizeof(number), "%.1f", result.alloc_bytes_per_op);
+        out << ", \"alloc_bytes_per_op\": " << number << "}";
+      }
+      out << "\n    ]}";
+    }
+    out << "\n  ]\n}\n";
+  }
+} // anonymous namespace
+
+int main(int argc, char *argv[]) {
+  size_t size = 8 << 20;
+  double min_time = 0.5;
+  std::string filter;
+  std::string output;
+  for (int i = 1; i < argc; i++) {
+    const std::string_view arg = argv[i];
+    if (arg == "--size" && i + 1 < argc) {
+      size = static_cast<size_t>(std::strtod(argv[++i], nullptr) * (1 << 20));
+    } else if (arg == "--min-time" && i + 1 < argc) {
+      min_time = std::strtod(argv[++i], nullptr);
+    } else if (arg == "--filter" && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (arg == "--out" && i + 1 < argc) {
+      output = argv[++i];
+    } else {
+      std::cerr << "Usage: " << argv[0] << " [--size <MB per corpus>] [--min-time <seconds per phase>]"
+                << " [--filter <corpus name>] [--out <json_file>]" << std::endl;
+      return 1;
+    }
+  }
+
+  std::vector<std::pair<Corpus, std::vector<Result>>> runs;
+  json::set_alloc_counting(true);
+  try {
+    for (const auto generate: {deep_nesting, wide_objects, numeric_arrays, string_heavy, ndjson}) {
+      auto corpus = generate(size);
+      if (!filter.empty() && corpus.name.find(filter) == std::string::npos)
+        continue;
+      std::cerr << corpus.name << " (" << corpus.text.size() << " bytes)" << std::endl;
+      auto results = run(corpus, min_time);
+      runs.emplace_back(std::move(corpus), std::move(results));
+    }
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  json::set_alloc_counting(false);
+
+  if (output.empty()) {
+    report(std::cout, size, runs);
+    return 0;
+  }
+  std::ofstream file(output);
+  report(file, size, runs);
+  if (!file) {
+    std::cerr << "Failed to write " << output << std::endl;
+    return 1;
+  }
+  return 0;
+}
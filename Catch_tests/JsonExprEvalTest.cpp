@@ -1,9 +1,41 @@
 // test_json_eval.cpp
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch_test_macros.hpp>
+#include "aggregate.hpp"
+#include "alloc_stats.hpp"
+#include "document.hpp"
 #include "evaluator.hpp"
+#include "expr_batch.hpp"
+#include "expr_cache.hpp"
 #include "expr_parser.hpp"
 #include "json.hpp"
+#include "line_evaluator.hpp"
+#include "mapped_file.hpp"
+#include "ondemand.hpp"
+#include "parallel_parse.hpp"
+#include "path_matcher.hpp"
+#include "program.hpp"
+#include "query_server.hpp"
+#include "run_stats.hpp"
+#include "sax.hpp"
+#include "simd_scan.hpp"
+#include "tape.hpp"
+#include "thread_pool.hpp"
+#include "writer.hpp"
+
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <thread>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
 
 using json::JSONValue;
 
@@ -23,20 +55,20 @@ TEST_CASE("Basic JSON path expressions", "[json_eval]") {
 
     SECTION("Simple array access") {
         auto result = evaluate_expression(test_json, "a.b[1]");
-        REQUIRE(std::get<double>(result.value) == 2.0);
+        REQUIRE(std::get<std::int64_t>(result.value) == 2);
     }
 
     SECTION("Nested object access") {
         auto result = evaluate_expression(test_json, "a.b[2].c");
-        REQUIRE(std::get<std::string>(result.value) == "test");
+        REQUIRE(std::get<json::String>(result.value) == "test");
     }
 
     SECTION("Full array access") {
         auto result = evaluate_expression(test_json, "a.b");
-        auto& arr = std::get<std::vector<JSONValue>>(result.value);
+        auto& arr = std::get<json::Array>(result.value);
         REQUIRE(arr.size() == 4);
-        REQUIRE(std::get<double>(arr[0].value) == 1.0);
-        REQUIRE(std::get<double>(arr[1].value) == 2.0);
+        REQUIRE(std::get<std::int64_t>(arr[0].value) == 1);
+        REQUIRE(std::get<std::int64_t>(arr[1].value) == 2);
     }
 }
 
@@ -45,7 +77,7 @@ TEST_CASE("Dynamic subscript expressions", "[json_eval]") {
 
     SECTION("Expression in subscript") {
         auto result = evaluate_expression(test_json, "a.b[a.b[1]].c");
-        REQUIRE(std::get<std::string>(result.value) == "test");
+        REQUIRE(std::get<json::String>(result.value) == "test");
     }
 }
 
@@ -54,12 +86,12 @@ TEST_CASE("Intrinsic functions", "[json_eval]") {
 
     SECTION("max function with array elements") {
         auto result = evaluate_expression(test_json, "max(a.b[0], a.b[1])");
-        REQUIRE(std::get<double>(result.value) == 2.0);
+        REQUIRE(std::get<std::int64_t>(result.value) == 2);
     }
 
     SECTION("min function with nested array") {
         auto result = evaluate_expression(test_json, "min(a.b[3])");
-        REQUIRE(std::get<double>(result.value) == 11.0);
+        REQUIRE(std::get<std::int64_t>(result.value) == 11);
     }
 
     SECTION("size function with object") {
@@ -83,7 +115,1696 @@ TEST_CASE("Number literals in expressions", "[json_eval]") {
 
     SECTION("max function with literals") {
         auto result = evaluate_expression(test_json, "max(a.b[0], 10, a.b[1], 15)");
-        REQUIRE(std::get<double>(result.value) == 15.0);
+        REQUIRE(std::get<std::int64_t>(result.value) == 15);
+    }
+}
+
+TEST_CASE("Path results borrow from the document", "[json_eval]") {
+    const std::string test_json = R"({"a": { "b": [ 1, 2, { "c": "test" }, [11, 12] ]}})";
+    auto [json_ast, json_error] = json::parse(test_json);
+    REQUIRE(json_error.empty());
+
+    ExprParser parser;
+    Evaluator evaluator(json_ast);
+
+    SECTION("Path resolves to the node inside the root") {
+        auto expr = parser.parse("a.b[3]");
+        auto result = evaluator.evaluateRef(expr);
+        REQUIRE(result.isBorrowed());
+        const auto& a = std::get<json::Object>(json_ast.value).at("a");
+        const auto& b = std::get<json::Object>(a.value).at("b");
+        REQUIRE(&result.get() == &std::get<json::Array>(b.value)[3]);
+    }
+
+    SECTION("Function results are owned") {
+        auto expr = parser.parse("max(a.b[3])");
+        auto result = evaluator.evaluateRef(expr);
+        REQUIRE_FALSE(result.isBorrowed());
+        REQUIRE(std::get<std::int64_t>(result->value) == 12);
+    }
+}
+
+TEST_CASE("Single pass parser matches the token parser", "[json_eval]") {
+    // Goes through json::lex + the token based json::parse overload
+    auto parse_tokens = [](std::string_view source) -> std::string {
+        auto [tokens, lex_error] = json::lex(source);
+        if (!lex_error.empty())
+            return lex_error;
+        auto [value, _, parse_error] = json::parse(tokens);
+        return parse_error.empty() ? json::deparse(value) : parse_error;
+    };
+    auto parse_direct = [](std::string_view source) -> std::string {
+        auto [value, error] = json::parse(source);
+        return error.empty() ? json::deparse(value) : error;
+    };
+
+    SECTION("Same values") {
+        const std::string test_json = R"( {"a": { "b": [ 1, -2.5e1, { "c": "te\"st" }, [], {}, true, false, null ]}} )";
+        REQUIRE(parse_direct(test_json) == parse_tokens(test_json));
+    }
+
+    SECTION("Same error messages") {
+        for (const std::string source: {"[1 :]", R"({"a" 1})", R"({"a": 1 :})", "{: 1}", "[1, ]", R"(["abc)", "[1, @]"}) {
+            REQUIRE(parse_direct(source) == parse_tokens(source));
+        }
+    }
+
+    SECTION("Errors the token parser didn't catch") {
+        REQUIRE_FALSE(std::get<1>(json::parse("[1, 2")).empty());
+        REQUIRE_FALSE(std::get<1>(json::parse(R"({"a": 1)")).empty());
+        REQUIRE_FALSE(std::get<1>(json::parse("")).empty());
+        REQUIRE_FALSE(std::get<1>(json::parse("[1] 2")).empty());
+    }
+}
+
+TEST_CASE("Structural scanner", "[json_eval]") {
+    SECTION("Token starts skip string contents and escaped quotes") {
+        const std::string source = R"({"a\"b": [1, true]})";
+        REQUIRE(json::structural_index(source) == std::vector<json::Offset>{0, 1, 7, 9, 10, 11, 13, 17, 18});
+    }
+
+    SECTION("Every backend agrees across block boundaries") {
+        // Strings, escapes and scalars straddling the 64 byte blocks
+        std::string source = "[";
+        for (int i = 0; i < 40; i++) {
+            source += R"({"key)" + std::to_string(i) + R"(": "va\\l\"ue ,[]{}", "n": -12.5e3,)";
+            source += std::string(i % 7, ' ') + "\t" + (i % 2 ? "true" : "null") + "},\n";
+        }
+        source += "\"" + std::string(64, '\\') + "\"]";
+
+        const auto original = json::active_simd_level();
+        json::set_simd_level(json::SimdLevel::Scalar);
+        const auto expected = json::structural_index(source);
+        for (auto level: {json::SimdLevel::SSE42, json::SimdLevel::AVX2}) {
+            json::set_simd_level(level);
+            REQUIRE(json::structural_index(source) == expected);
+        }
+        json::set_simd_level(original);
+
+        auto [tokens, error] = json::lex(source);
+        REQUIRE(error.empty());
+        REQUIRE(tokens.size() == expected.size());
+        for (size_t i = 0; i < tokens.size(); i++) {
+            REQUIRE(tokens[i].location == expected[i]);
+        }
+    }
+}
+
+TEST_CASE("Documents allocate from their own arena", "[json_eval]") {
+    const std::string test_json = R"({"a": { "b": [ 1, 2, { "c": "a string long enough to skip SSO" }, [11, 12] ]}})";
+    auto [document, error] = json::Document::parse(test_json);
+    REQUIRE(error.empty());
+
+    ExprParser parser;
+    Evaluator evaluator(document.root());
+
+    SECTION("Nodes come from the arena, not the default resource") {
+        auto expr = parser.parse("a.b[2].c");
+        const auto& str = std::get<json::String>(evaluator.evaluateRef(expr)->value);
+        REQUIRE(str.get_allocator().resource() != std::pmr::get_default_resource());
+        REQUIRE(str == "a string long enough to skip SSO");
+    }
+
+    SECTION("Copies outlive the document") {
+        auto expr = parser.parse("a.b");
+        JSONValue copy = evaluator.evaluate(expr);
+        document = json::Document{};
+        const auto& arr = std::get<json::Array>(copy.value);
+        REQUIRE(arr.get_allocator().resource() == std::pmr::get_default_resource());
+        REQUIRE(std::get<json::String>(std::get<json::Object>(arr[2].value).at("c").value).size() == 32);
+    }
+
+    SECTION("Errors leave an empty document") {
+        auto [bad, bad_error] = json::Document::parse("[1, 2");
+        REQUIRE_FALSE(bad_error.empty());
+        REQUIRE(std::holds_alternative<std::monostate>(bad.root().value));
+    }
+}
+
+TEST_CASE("Flat objects with interned keys", "[json_eval]") {
+    SECTION("Repeated keys are stored once per document") {
+        auto [document, error] = json::Document::parse(R"([{"name": 1, "id": 2}, {"id": 3, "name": 4}])");
+        REQUIRE(error.empty());
+        const auto& arr = std::get<json::Array>(document.root().value);
+        const auto& first = std::get<json::Object>(arr[0].value);
+        const auto& second = std::get<json::Object>(arr[1].value);
+        REQUIRE(first.find("name")->key.data() == second.find("name")->key.data());
+        REQUIRE_FALSE(first.owns_keys());
+    }
+
+    SECTION("Objects outside a Document own their keys") {
+        auto [document, error] = json::Document::parse(R"({"name": 1, "": 2, "a long key that isn't short": 3})");
+        REQUIRE(error.empty());
+        json::Object copy = std::get<json::Object>(document.root().value);
+        document = json::Document{};
+        REQUIRE(copy.owns_keys());
+        REQUIRE(json::deparse(JSONValue(copy)) == R"({"":2, "a long key that isn't short":3, "name":1})");
+
+        // Copies share the keys, adding one only changes the object it's added to
+        json::Object shared = copy;
+        REQUIRE(shared.find("name")->key.data() == copy.find("name")->key.data());
+        shared.insert_or_assign("added", JSONValue(4.0));
+        copy = json::Object{};
+        REQUIRE(json::deparse(JSONValue(shared)) ==
+                R"({"":2, "a long key that isn't short":3, "added":4, "name":1})");
+
+        const std::string source = R"([{"b": {"c": 1}}, {"b": 2}])";
+        auto [parsed, parse_error] = json::parse(source);
+        REQUIRE(parse_error.empty());
+        auto [tape, tape_error] = json::Tape::parse(source);
+        REQUIRE(tape_error.empty());
+        auto materialized = tape.root().materialize();
+        tape = json::Tape{};
+        for (const auto *value: {&parsed, &materialized}) {
+            const auto &outer = std::get<json::Object>(std::get<json::Array>(value->value)[0].value);
+            REQUIRE(outer.owns_keys());
+            REQUIRE(std::get<json::Object>(outer.at("b").value).owns_keys());
+            REQUIRE(json::deparse(*value) == R"([{"b":{"c":1}}, {"b":2}])");
+        }
+    }
+
+    SECTION("Members are sorted and the last duplicate wins") {
+        auto [value, error] = json::parse(R"({"b": 1, "a": 2, "b": 3})");
+        REQUIRE(error.empty());
+        REQUIRE(json::deparse(value) == R"({"a":2, "b":3})");
+    }
+
+    SECTION("Wide objects") {
+        std::string source = "{";
+        for (int i = 0; i < 1000; i++) {
+            source += (i ? ", \"k" : "\"k") + std::to_string(999 - i) + "\": " + std::to_string(i);
+        }
+        source += "}";
+
+        const std::string expression_json = R"({"a": )" + source + "}";
+        REQUIRE(std::get<std::int64_t>(evaluate_expression(expression_json, "a.k0").value) == 999);
+        REQUIRE(std::get<std::int64_t>(evaluate_expression(expression_json, "a.k999").value) == 0);
+        REQUIRE(std::get<double>(evaluate_expression(expression_json, "size(a)").value) == 1000.0);
+        REQUIRE_THROWS(evaluate_expression(expression_json, "a.k1000"));
+    }
+
+    SECTION("Objects built by hand") {
+        json::Object object;
+        object.insert_or_assign("z", JSONValue(1.0));
+        object.insert_or_assign("y", JSONValue(2.0));
+        object.insert_or_assign("z", JSONValue(3.0));
+        REQUIRE(object.size() == 2);
+        REQUIRE(json::deparse(JSONValue(object)) == R"({"y":2, "z":3})");
+    }
+}
+
+TEST_CASE("Tape documents", "[json_eval]") {
+    const std::string test_json =
+        R"({"a": { "b": [ 1, 2, { "c": "test" }, [11, 12] ], "big": {"x": [1, 2, 3], "y": {}}, "s": "hey"}})";
+    auto [tape, error] = json::Tape::parse(test_json);
+    REQUIRE(error.empty());
+
+    auto [document, document_error] = json::Document::parse(test_json);
+    REQUIRE(document_error.empty());
+
+    // Runs the expression on both kinds of document, the errors have to match as well
+    auto evaluate_both = [&](const std::string& expression) -> std::pair<std::string, std::string> {
+        ExprParser parser;
+        auto expr = parser.parse(expression);
+        auto run = [&expr](const Evaluator& evaluator) -> std::string {
+            try {
+                return json::deparse(evaluator.evaluate(expr));
+            } catch (const std::runtime_error& e) {
+                return e.what();
+            }
+        };
+        return {run(Evaluator(tape)), run(Evaluator(document.root()))};
+    };
+
+    SECTION("Same results as the DOM") {
+        for (const std::string expression: {"a.b[1]", "a.b[2].c", "a.b[3]", "a.big", "a.b[a.b[1]]", "max(a.b[3])",
+                                            "min(a.b[3], 4)", "size(a)", "size(a.big.y)", "size(a.s)", "a.nonexistent",
+                                            "a.b[999]", "a.b.c", "a[0]", "a.b[a.s]", "max(a.b)", "size(a.b[0])"}) {
+            auto [from_tape, from_dom] = evaluate_both(expression);
+            REQUIRE(from_tape == from_dom);
+        }
+    }
+
+    SECTION("Paths resolve to cursors into the tape") {
+        ExprParser parser;
+        auto expr = parser.parse("a.b[2]");
+        Evaluator evaluator(tape);
+        auto result = evaluator.evaluateRef(expr);
+        REQUIRE(result.isBorrowed());
+        REQUIRE(result.cursor() != nullptr);
+        REQUIRE(result.cursor()->is_object());
+        REQUIRE(result.cursor()->find("c")->as_string() == "test");
+    }
+
+    SECTION("Siblings are skipped without walking them") {
+        const auto a = *tape.root().find("a");
+        const auto b = *a.find("b");
+        const auto big = *a.find("big");
+        REQUIRE(b.next().position() == big.position() - 1); // the key sits in between
+        REQUIRE(b.size() == 4);
+        REQUIRE(json::deparse(big) == R"({"x":[1, 2, 3], "y":{}})");
+    }
+
+    SECTION("Duplicate keys resolve to the last one") {
+        auto [duplicates, duplicates_error] = json::Tape::parse(R"({"b": 1, "a": 2, "b": {"b": 4, "b": 5}})");
+        REQUIRE(duplicates_error.empty());
+        const auto root = duplicates.root();
+        REQUIRE(root.size() == 2);
+        REQUIRE(root.find("b")->find("b")->as_number() == 5.0);
+        REQUIRE(json::deparse(root) == R"({"a":2, "b":{"b":5}})");
+    }
+
+    SECTION("Keys are stored once") {
+        auto [repeated, repeated_error] = json::Tape::parse(R"([{"name": 1}, {"name": 2}, {"name": 3}])");
+        REQUIRE(repeated_error.empty());
+        auto [single, single_error] = json::Tape::parse(R"([{"name": 1}, {"x": 2}, {"y": 3}])");
+        REQUIRE(single_error.empty());
+        REQUIRE(repeated.size_in_bytes() < single.size_in_bytes());
+    }
+
+    SECTION("Same error messages as the DOM parser") {
+        for (const std::string source: {"[1 :]", R"({"a" 1})", "[1, 2", "", "[1] 2", R"(["abc)"}) {
+            REQUIRE(std::get<1>(json::Tape::parse(source)) == std::get<1>(json::parse(source)));
+        }
+    }
+}
+
+TEST_CASE("On demand evaluation", "[json_eval]") {
+    const std::string test_json =
+        R"({"a": { "b": [ 1, 2, { "c": "te\"st" }, [11, 12] ], "s\u0041": "x", "e": [3]}, "z": [{"y": "]}"}]})";
+
+    auto run = [](const std::string& source, const std::string& expression) -> std::string {
+        auto [document, error] = json::OnDemandDocument::parse(source);
+        if (!error.empty())
+            return error;
+        ExprParser parser;
+        auto expr = parser.parse(expression);
+        try {
+            return json::deparse(Evaluator(document).evaluate(expr));
+        } catch (const std::runtime_error& e) {
+            return e.what();
+        }
+    };
+    auto run_dom = [](const std::string& source, const std::string& expression) -> std::string {
+        try {
+            return json::deparse(evaluate_expression(source, expression));
+        } catch (const std::runtime_error& e) {
+            return e.what();
+        }
+    };
+
+    SECTION("Same results as the DOM") {
+        for (const std::string expression: {"a.b[1]", "a.b[2].c", "a.b[3]", "a", "z[0]", "a.b[a.b[1]]", "max(a.b[3])",
+                                            "size(a)", "a.nonexistent", "a.b[999]", "a.b.c", "a[0]", "z[0].x", "z[0].y"}) {
+            REQUIRE(run(test_json, expression) == run_dom(test_json, expression));
+        }
+    }
+
+    SECTION("Later duplicates win") {
+        REQUIRE(run(R"({"a": 1, "b": 2, "a": [3]})", "a[0]") == "3");
+    }
+
+    SECTION("Unvisited parts are never parsed") {
+        const std::string broken = R"({"a": [1, 2, {"b": tru}], "c": {"d": 4}})";
+        REQUIRE(run(broken, "c.d") == "4");
+        REQUIRE(run(broken, "a[1]") == "2");
+        REQUIRE(run(broken, "a[2]") == std::get<1>(json::parse(broken)));
+    }
+
+    SECTION("Broken structure on the path is reported") {
+        for (const std::string source: {R"({"a" 1})", R"({"a": [1, 2)", R"({"a": 1 "b": 2})", R"({"a": [1, ]})"}) {
+            REQUIRE(run(source, "a") == std::get<1>(json::parse(source)));
+        }
+    }
+
+    SECTION("Several expressions share the document") {
+        auto [document, error] = json::OnDemandDocument::parse(test_json);
+        REQUIRE(error.empty());
+        Evaluator evaluator(document);
+        ExprParser parser;
+        for (int i = 0; i < 3; i++) {
+            REQUIRE(std::get<std::int64_t>(evaluator.evaluate(parser.parse("a.b[3][1]")).value) == 12);
+            REQUIRE(std::get<json::String>(evaluator.evaluate(parser.parse("z[0].y")).value) == "]}");
+        }
+    }
+}
+
+// Writes every event down so event streams can be compared
+struct EventRecorder : json::SaxHandler {
+    std::string events;
+
+    void on_null() override { events += "null "; }
+    void on_bool(bool b) override { events += b ? "true " : "false "; }
+    void on_number(double n) override { events += std::to_string(n) + " "; }
+    void on_string(std::string_view str) override { events += "\"" + std::string(str) + "\" "; }
+    void on_key(std::string_view key) override { events += "key:" + std::string(key) + " "; }
+    void on_start_object() override { events += "{ "; }
+    void on_end_object() override { events += "} "; }
+    void on_start_array() override { events += "[ "; }
+    void on_end_array() override { events += "] "; }
+};
+
+TEST_CASE("SAX events", "[json_eval]") {
+    const std::string test_json = R"({"a": { "b": [ 1, -2.5e1, { "c": "te\"st" }, [], {}, true, false, null ]}})";
+
+    auto stream_events = [](const std::string& source, size_t chunk_size) -> std::string {
+        std::istringstream input(source);
+        EventRecorder recorder;
+        auto error = json::parse_sax(input, recorder, chunk_size);
+        return error.empty() ? recorder.events : error;
+    };
+
+    SECTION("Events in document order") {
+        EventRecorder recorder;
+        REQUIRE(json::parse_sax(R"({"a": [1, "x", null]})", recorder).empty());
+        REQUIRE(recorder.events == "{ key:a [ 1.000000 \"x\" null ] } ");
+    }
+
+    SECTION("Streaming gives the same events whatever the chunk size") {
+        EventRecorder recorder;
+        REQUIRE(json::parse_sax(test_json, recorder).empty());
+        for (const size_t chunk_size: {1, 2, 3, 7, 64, 4096}) {
+            REQUIRE(stream_events(test_json, chunk_size) == recorder.events);
+        }
+    }
+
+    SECTION("Streaming errors match json::parse") {
+        for (const std::string source:
+             {"[1 :]", R"({"a" 1})", R"({"a": 1 :})", "{: 1}", "[1, ]", R"(["abc)", "[1, @]", "[1, 2", "", "[1] 2",
+              "[\n  1,\n  2\n  3]", R"({"a": tru})", R"(["\q"])"}) {
+            for (const size_t chunk_size: {1, 3, 4096}) {
+                REQUIRE(stream_events(source, chunk_size) == std::get<1>(json::parse(source)));
+            }
+        }
+    }
+    SECTION("Strings much longer than a chunk") {
+        // Escapes land on every chunk boundary somewhere. Decoding from the start after each refill would take
+        // minutes for this with 16 byte chunks
+        std::string text;
+        for (int i = 0; i < 200000; i++)
+            text += i % 7 == 0 ? R"(\"\u00e9\\)" : "abcdefghijk";
+        const std::string source = R"(["x", ")" + text + R"(", 1])";
+        EventRecorder recorder;
+        REQUIRE(json::parse_sax(source, recorder).empty());
+        REQUIRE(stream_events(source, 16) == recorder.events);
+        // Unterminated
+        const auto cut = source.substr(0, source.size() - 6);
+        REQUIRE(stream_events(cut, 16) == std::get<1>(json::parse(cut)));
+    }
+}
+
+TEST_CASE("Streaming path matching", "[json_eval]") {
+    const std::string test_json =
+        R"({"a": { "b": [ 1, 2, { "c": "test" }, [11, 12] ], "d": {"b": 3}}, "z": 5, "a": {"b": [7, {"x": [1]}]}})";
+
+    auto stream = [](const std::string& source, const std::string& expression) -> std::string {
+        ExprParser parser;
+        auto expr = parser.parse(expression);
+        try {
+            PathMatcher matcher(dynamic_cast<const PathExpr&>(*expr));
+            std::istringstream input(source);
+            if (auto error = json::parse_sax(input, matcher, 5); !error.empty())
+                return error;
+            return json::deparse(std::move(matcher).result());
+        } catch (const std::runtime_error& e) {
+            return e.what();
+        }
+    };
+    auto evaluate = [](const std::string& source, const std::string& expression) -> std::string {
+        try {
+            return json::deparse(evaluate_expression(source, expression));
+        } catch (const std::runtime_error& e) {
+            return e.what();
+        }
+    };
+
+    SECTION("Same results as the Evaluator") {
+        for (const std::string expression: {"a", "a.b", "a.b[0]", "a.b[1].x", "a.b[1].x[0]", "z", "a.d", "a.b[2]",
+                                            "a.c", "z.b", "a.b.c", "a[0]", "a.b[0][1]", "nope"}) {
+            REQUIRE(stream(test_json, expression) == evaluate(test_json, expression));
+        }
+    }
+
+    SECTION("Earlier duplicates don't leak into the result") {
+        const std::string source = R"({"a": {"b": 1}, "a": {"c": 2}})";
+        REQUIRE(stream(source, "a.b") == evaluate(source, "a.b"));
+        REQUIRE(stream(source, "a.c") == "2");
+    }
+
+    SECTION("Index expressions have to be literals") {
+        REQUIRE(stream(test_json, "a.b[z]") == "Streaming paths only support literal array indices");
+    }
+}
+
+TEST_CASE("Memory mapped input", "[json_eval]") {
+    const std::string path = "json_eval_mapped_test.json";
+    auto write_file = [&path](const std::string& contents) {
+        std::ofstream file(path, std::ios::binary);
+        file << contents;
+    };
+
+    SECTION("Parses straight from the mapping") {
+        write_file(R"({"a": {"b": [1, 2, 3]}})");
+        auto [file, error] = json::MappedFile::open(path);
+        REQUIRE(error.empty());
+        auto [document, json_error] = json::Document::parse(file.view());
+        REQUIRE(json_error.empty());
+
+        ExprParser parser;
+        REQUIRE(std::get<std::int64_t>(Evaluator(document.root()).evaluate(parser.parse("max(a.b)")).value) == 3);
+    }
+
+    SECTION("Empty files map to an empty view") {
+        write_file("");
+        auto [file, error] = json::MappedFile::open(path);
+        REQUIRE(error.empty());
+        REQUIRE(file.view().empty());
+    }
+
+    SECTION("Missing files") {
+        auto [file, error] = json::MappedFile::open("does/not/exist.json");
+        REQUIRE(error == "Failed to open file: does/not/exist.json");
+    }
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("NDJSON evaluation", "[json_eval]") {
+    ExprParser parser;
+    json::ThreadPool pool(4);
+
+    auto run = [&pool](const Expr& expr, const std::string_view source, const size_t chunk_size) {
+        std::string output;
+        std::vector<std::pair<size_t, std::string>> errors;
+        const LineEvaluator evaluator(expr, pool, chunk_size);
+        const auto failed = evaluator.run(
+            source, [&output](const std::string_view chunk) { output += chunk; },
+            [&errors](const size_t line, const std::string& message) { errors.emplace_back(line, message); });
+        REQUIRE(failed == errors.size());
+        return std::make_tuple(output, errors);
+    };
+
+    SECTION("Output keeps the input order") {
+        std::string source;
+        std::string expected;
+        for (int i = 0; i < 1000; i++) {
+            source += R"({"a": {"b": [)" + std::to_string(i) + R"(, 1]}})" + "\n";
+            expected += std::to_string(i) + "\n";
+        }
+        const auto expr = parser.parse("a.b[0]");
+        // Tiny chunks so the records get spread over every worker
+        auto [output, errors] = run(*expr, source, 64);
+        REQUIRE(errors.empty());
+        REQUIRE(output == expected);
+    }
+
+    SECTION("Blank lines and CRLF") {
+        const auto expr = parser.parse("a");
+        auto [output, errors] = run(*expr, "{\"a\": 1}\r\n\n  \n{\"a\": 2}", 1 << 20);
+        REQUIRE(errors.empty());
+        REQUIRE(output == "1\n2\n");
+    }
+
+    SECTION("Failed records") {
+        const auto expr = parser.parse("a.b");
+        auto [output, errors] = run(*expr, "{\"a\": {\"b\": 1}}\n{\"a\": \n\n{\"a\": 2}\n{\"a\": {\"b\": 3}}\n", 16);
+        REQUIRE(output == "1\n\n\n3\n");
+        REQUIRE(errors.size() == 2);
+        REQUIRE(errors[0].first == 2);
+        REQUIRE(errors[0].second.starts_with("JSON parse error: "));
+        REQUIRE(errors[1].first == 4);
+        REQUIRE(errors[1].second.starts_with("Expression evaluation error: "));
+    }
+}
+
+TEST_CASE("Batch evaluation", "[json_eval]") {
+    const std::string test_json = R"({"a": {"b": [1, 2, {"c": "test"}, [11, 12]], "n": 5}, "x": [3, 4]})";
+    const std::vector<std::string> expressions = {
+        "a.b[0]", "a.b[2].c", "a.b[3]", "size(a.b)", "max(a.b[3], a.n)", "a.b[a.b[0]]",
+        "x[a.b[1]]", "a.missing.c", "a.b[9]", "a.n.c", "a.missing", "5"};
+
+    ExprParser parser;
+    std::vector<std::unique_ptr<Expr>> exprs;
+    for (const auto& expression : expressions)
+        exprs.push_back(parser.parse(expression));
+    const ExprBatch batch(std::move(exprs));
+
+    SECTION("Shared prefixes are merged") {
+        // Only paths with literal indexes go in the trie, a.b[a.b[0]] gets walked on its own but its index is merged
+        REQUIRE(batch.slots() == 12);
+        REQUIRE(batch.trie().children.size() == 1);
+        const auto& a = *batch.trie().children[0].node;
+        REQUIRE(a.children.size() == 3);
+        REQUIRE(a.children[0].node->children.size() == 5);
+    }
+
+    // Every expression has to come out the way it would on its own
+    auto check = [&](const Evaluator& evaluator) {
+        const auto results = evaluator.evaluateAll(batch);
+        REQUIRE(results.size() == expressions.size());
+        for (size_t i = 0; i < expressions.size(); i++) {
+            INFO(expressions[i]);
+            const auto& [result, error] = results[i];
+            try {
+                const auto expected = evaluator.evaluateRef(parser.parse(expressions[i])).deparse();
+                REQUIRE(result.has_value());
+                REQUIRE(result->deparse() == expected);
+            } catch (const std::runtime_error& e) {
+                REQUIRE_FALSE(result.has_value());
+                REQUIRE(error == e.what());
+            }
+        }
+        REQUIRE(std::get<1>(results[7]) == "Key not found: missing");
+        REQUIRE(std::get<1>(results[8]) == "Array index out of bounds");
+        REQUIRE(std::get<1>(results[9]) == "Invalid path: expected object");
+    };
+
+    SECTION("DOM") {
+        auto [document, json_error] = json::Document::parse(test_json);
+        REQUIRE(json_error.empty());
+        check(Evaluator(document.root()));
+    }
+
+    SECTION("Tape") {
+        auto [tape, json_error] = json::Tape::parse(test_json);
+        REQUIRE(json_error.empty());
+        check(Evaluator(tape));
+    }
+
+    SECTION("On demand") {
+        auto [document, json_error] = json::OnDemandDocument::parse(test_json);
+        REQUIRE(json_error.empty());
+        check(Evaluator(document));
+    }
+}
+
+TEST_CASE("Compiled programs", "[json_eval]") {
+    const std::string test_json = R"({"a": {"b": [1, 2, {"c": "test"}, [11, 12]], "n": 5}, "x": [3, 4]})";
+    const std::vector<std::string> expressions = {
+        "a.b[0]", "a.b[2].c", "size(a.b)", "max(a.b[3], a.n, 3)", "min(a.b[3])", "a.b[a.b[0]]", "x[size(x) ]",
+        "x[min(a.b[0], 1)]", "5", "a.missing", "a.b[9]", "a.n.c", "a.b[a.n]", "x[a]", "max()", "size(x, x)",
+        "foo(a.b)", "foo(a.missing)", "max(a.b)", "size(a.b[2].c)", "min(x[size(a.b[3])], x[size(a.b[3])])",
+        "a.b[max(a.b[0], a.b[0])]", "max(a.b[3], a.b[3], size(a.b[3]))", "x[size(a.missing)]",
+        "max(foo(a.b), foo(a.b))"};
+
+    ExprParser parser;
+    // Has to give back exactly what (or fail exactly how) the expression does
+    auto check = [&](const Evaluator& evaluator) {
+        for (const auto& expression : expressions) {
+            INFO(expression);
+            const auto expr = parser.parse(expression);
+            const auto program = Program::compile(*expr);
+            std::string expected;
+            try {
+                expected = evaluator.evaluateRef(expr).deparse();
+            } catch (const std::runtime_error& e) {
+                REQUIRE_THROWS_WITH(evaluator.evaluateRef(program), e.what());
+                continue;
+            }
+            REQUIRE(evaluator.evaluateRef(program).deparse() == expected);
+            REQUIRE(json::deparse(evaluator.evaluate(program)) == expected);
+        }
+    };
+
+    SECTION("Instructions") {
+        const auto program = Program::compile(*parser.parse("max(a.b[1], x[a.n])"));
+        using Op = Program::Op;
+        std::vector<Op> ops;
+        for (const auto& instruction : program.instructions())
+            ops.push_back(instruction.op);
+        REQUIRE(ops == std::vector<Op>{Op::Root, Op::Member, Op::Member, Op::Element, Op::EndPath, Op::Root,
+                                       Op::Member, Op::Root, Op::Member, Op::Member, Op::EndPath, Op::Index,
+                                       Op::EndPath, Op::Max});
+        REQUIRE(program.node_depth() == 2);
+        REQUIRE(program.value_depth() == 2);
+        REQUIRE(program.register_count() == 0);
+    }
+
+    SECTION("Repeated subexpressions are computed once") {
+        const auto program = Program::compile(*parser.parse("min(x[size(a.b)], x[size(a.b)], size(a.b))"));
+        using Op = Program::Op;
+        std::vector<Op> ops;
+        for (const auto& instruction : program.instructions())
+            ops.push_back(instruction.op);
+        REQUIRE(ops == std::vector<Op>{Op::Root, Op::Member, Op::Root, Op::Member, Op::Member, Op::EndPath,
+                                       Op::Size, Op::Store, Op::Index, Op::EndPath, Op::Store, Op::Load,
+                                       Op::Load, Op::Min});
+        REQUIRE(program.register_count() == 2);
+    }
+
+    SECTION("DOM") {
+        auto [document, json_error] = json::Document::parse(test_json);
+        REQUIRE(json_error.empty());
+        check(Evaluator(document.root()));
+    }
+
+    SECTION("Tape") {
+        auto [tape, json_error] = json::Tape::parse(test_json);
+        REQUIRE(json_error.empty());
+        check(Evaluator(tape));
+    }
+
+    SECTION("On demand") {
+        auto [document, json_error] = json::OnDemandDocument::parse(test_json);
+        REQUIRE(json_error.empty());
+        check(Evaluator(document));
+    }
+}
+
+TEST_CASE("Expression cache", "[json_eval]") {
+    auto [document, json_error] = json::Document::parse(R"({"a": {"b": [1, 2, 3]}})");
+    REQUIRE(json_error.empty());
+    const Evaluator evaluator(document.root());
+
+    SECTION("Repeated expressions are only parsed once") {
+        ExprCache cache(4);
+        const auto first = cache.get("max(a.b)");
+        const auto second = cache.get("max(a.b)");
+        REQUIRE(first == second);
+        REQUIRE(std::get<std::int64_t>(evaluator.evaluate(second->program).value) == 3);
+        REQUIRE(std::get<std::int64_t>(evaluator.evaluate(second->expr).value) == 3);
+
+        const auto stats = cache.stats();
+        REQUIRE(stats.hits == 1);
+        REQUIRE(stats.misses == 1);
+        REQUIRE(stats.evictions == 0);
+        REQUIRE(stats.size == 1);
+    }
+
+    SECTION("Least recently used goes first") {
+        ExprCache cache(2);
+        const auto a = cache.get("a.b[0]");
+        (void)cache.get("a.b[1]");
+        (void)cache.get("a.b[0]");
+        (void)cache.get("a.b[2]"); // evicts a.b[1]
+        REQUIRE(cache.stats().evictions == 1);
+        REQUIRE(cache.stats().size == 2);
+        REQUIRE(cache.get("a.b[0]") == a);
+        REQUIRE(cache.stats().hits == 2);
+        (void)cache.get("a.b[1]");
+        REQUIRE(cache.stats().misses == 4);
+        // Still usable after being evicted
+        cache.clear();
+        REQUIRE(cache.stats().size == 0);
+        REQUIRE(std::get<std::int64_t>(evaluator.evaluate(a->program).value) == 1);
+    }
+
+    SECTION("Parse errors aren't cached") {
+        ExprCache cache;
+        REQUIRE_THROWS(cache.get("a.b["));
+        REQUIRE_THROWS(cache.get("a.b["));
+        REQUIRE(cache.stats().misses == 2);
+        REQUIRE(cache.stats().size == 0);
+    }
+
+    SECTION("Shared between threads") {
+        ExprCache cache(8);
+        json::ThreadPool pool(4);
+        std::vector<std::future<std::int64_t>> results;
+        for (int i = 0; i < 200; i++) {
+            results.push_back(pool.submit([&cache, &evaluator, i] {
+                const auto entry = cache.get("a.b[" + std::to_string(i % 3) + "]");
+                return std::get<std::int64_t>(evaluator.evaluate(entry->program).value);
+            }));
+        }
+        for (int i = 0; i < 200; i++)
+            REQUIRE(results[i].get() == i % 3 + 1);
+        const auto stats = cache.stats();
+        REQUIRE(stats.hits + stats.misses == 200);
+        REQUIRE(stats.size == 3);
+    }
+}
+
+TEST_CASE("Query server", "[json_eval]") {
+    const std::string path = "json_eval_server_test.json";
+    auto write_file = [&path](const std::string& contents) {
+        std::ofstream file(path, std::ios::binary);
+        file << contents;
+    };
+    write_file(R"({"a": {"b": [1, 2, 3]}})");
+
+    QueryServer server;
+    REQUIRE(server.load("doc", path).empty());
+
+    SECTION("Queries") {
+        REQUIRE(server.handle("query doc max(a.b)") == "ok 3");
+        REQUIRE(server.handle("query doc a.b") == "ok [1, 2, 3]");
+        REQUIRE(server.handle("query  doc   size(a.b)") == "ok 3");
+        REQUIRE(server.handle("query doc a.c") == "error Key not found: c");
+        REQUIRE(server.handle("query other a") == "error No document named other");
+        REQUIRE(server.handle("query doc") == "error Usage: query <name> <expression>");
+        REQUIRE(server.handle("frobnicate") == "error Unknown command: frobnicate");
+    }
+
+    SECTION("Reloading and unloading") {
+        write_file(R"({"a": {"b": [4, 5]}})");
+        REQUIRE(server.handle("query doc max(a.b)") == "ok 3");
+        REQUIRE(server.handle("reload doc") == "ok");
+        REQUIRE(server.handle("query doc max(a.b)") == "ok 5");
+
+        // A broken file leaves the loaded version alone, the error fits on one line
+        write_file("{\"a\": [1, }");
+        const auto response = server.handle("reload doc");
+        REQUIRE(response->starts_with("error JSON parse error: "));
+        REQUIRE(response->find('\n') == std::string::npos);
+        REQUIRE(server.handle("query doc max(a.b)") == "ok 5");
+
+        REQUIRE(server.handle("unload doc") == "ok");
+        REQUIRE(server.handle("reload doc") == "error No document named doc");
+    }
+
+    SECTION("Line protocol and stats") {
+        std::istringstream in("query doc a.b[0]\r\n\nload copy " + path + "\nquery copy a.b[2]\nstats\nquit\nquery doc a\n");
+        std::ostringstream out;
+        server.serve(in, out);
+
+        std::istringstream responses(out.str());
+        std::vector<std::string> lines;
+        for (std::string line; std::getline(responses, line);)
+            lines.push_back(line);
+        REQUIRE(lines.size() == 4);
+        REQUIRE(lines[0] == "ok 1");
+        REQUIRE(lines[1] == "ok");
+        REQUIRE(lines[2] == "ok 3");
+        REQUIRE(lines[3].starts_with(R"(ok {"queries": 2, "p50_us": )"));
+        REQUIRE(server.latency().queries == 2);
+        REQUIRE(server.latency().p50 <= server.latency().max);
+    }
+
+#ifndef _WIN32
+    SECTION("Unix socket, one connection after another") {
+        const std::string socket_path = "json_eval_server_test.sock";
+        std::string served;
+        std::thread serving([&] { served = server.serve_socket(socket_path); });
+
+        // Sends the line, returns the response line (empty if the server hung up)
+        auto request = [&socket_path](const std::string &line) {
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            std::copy(socket_path.begin(), socket_path.end(), address.sun_path);
+            const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            // The server might not be listening yet
+            for (int attempt = 0; ::connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0;
+                 attempt++) {
+                REQUIRE(attempt < 500);
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            REQUIRE(::send(fd, line.data(), line.size(), 0) == std::ssize(line));
+            std::string response;
+            char c;
+            while (::recv(fd, &c, 1, 0) == 1 && c != '\n')
+                response.push_back(c);
+            ::close(fd);
+            return response;
+        };
+
+        // Every connection's thread is done with by the time the next one's accepted
+        for (int i = 0; i < 100; i++)
+            REQUIRE(request("query doc a.b[1]\n") == "ok 2");
+        // Requests that never end get an error, the connection after it is served as usual
+        REQUIRE(request(std::string(QueryServer::max_line_length + 10, ' ')) == "error Line too long");
+        REQUIRE(request(std::string(QueryServer::max_line_length - 10, ' ') + "query doc a.b[1]\n") == "ok 2");
+        REQUIRE(request("shutdown\n").empty());
+        serving.join();
+        REQUIRE(served.empty());
+    }
+
+    SECTION("Only sockets get replaced") {
+        REQUIRE(server.serve_socket(path) == "Not a socket, refusing to replace it: " + path);
+        // Still there to load
+        REQUIRE(server.handle("reload doc") == "ok");
+    }
+#endif
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("Integer numbers", "[json_eval]") {
+    SECTION("Integers stay exact") {
+        const std::string source = R"({"id": 9007199254740993, "min": -9223372036854775808, "big": 18446744073709551616,
+                                       "f": 1.5, "e": 1e2, "z": -0, "n": -12})";
+        auto [dom, dom_error] = json::parse(source);
+        REQUIRE(dom_error.empty());
+        auto [tokens, lex_error] = json::lex(source);
+        REQUIRE(lex_error.empty());
+        auto [token_dom, index, token_error] = json::parse(tokens);
+        REQUIRE(token_error.empty());
+        auto [tape, tape_error] = json::Tape::parse(source);
+        REQUIRE(tape_error.empty());
+
+        for (const auto* value : {&dom, &token_dom}) {
+            const auto& object = std::get<json::Object>(value->value);
+            REQUIRE(std::get<std::int64_t>(object.at("id").value) == 9007199254740993);
+            REQUIRE(std::get<std::int64_t>(object.at("min").value) == std::numeric_limits<std::int64_t>::min());
+            REQUIRE(std::get<double>(object.at("big").value) == 18446744073709551616.0);
+            REQUIRE(std::get<double>(object.at("f").value) == 1.5);
+            REQUIRE(std::get<double>(object.at("e").value) == 100.0);
+            REQUIRE(std::signbit(std::get<double>(object.at("z").value)));
+            REQUIRE(std::get<std::int64_t>(object.at("n").value) == -12);
+        }
+
+        REQUIRE(tape.root().find("id")->is_integer());
+        REQUIRE(tape.root().find("id")->as_integer() == 9007199254740993);
+        REQUIRE(tape.root().find("f")->is_number());
+        REQUIRE_FALSE(tape.root().find("f")->is_integer());
+        REQUIRE(std::get<std::int64_t>(tape.root().find("n")->materialize().value) == -12);
+
+        REQUIRE(json::deparse(std::get<json::Object>(dom.value).at("id")) == "9007199254740993");
+    }
+
+    SECTION("Evaluating") {
+        const std::string source = R"({"a": [10, 20.5, 30], "i": 2, "d": 1.9, "neg": -1})";
+        auto [document, error] = json::Document::parse(source);
+        REQUIRE(error.empty());
+        const Evaluator evaluator(document.root());
+        ExprParser parser;
+
+        const auto literal = parser.parse("7");
+        REQUIRE(std::get<std::int64_t>(dynamic_cast<const LiteralExpr&>(*literal).value.value) == 7);
+        REQUIRE(std::get<std::int64_t>(evaluator.evaluate(parser.parse("a[i]")).value) == 30);
+        // Doubles are truncated like before
+        REQUIRE(std::get<double>(evaluator.evaluate(parser.parse("a[d]")).value) == 20.5);
+        REQUIRE_THROWS_WITH(evaluator.evaluate(parser.parse("a[neg]")), "Array index out of bounds");
+        REQUIRE(std::get<double>(evaluator.evaluate(parser.parse("max(a, i)")).value) == 30.0);
+        REQUIRE(std::get<double>(evaluator.evaluate(parser.parse("min(a, 99999999999999999999)")).value) == 10.0);
+    }
+
+    SECTION("SAX and streaming") {
+        const std::string source = R"({"a": [1, 2.5, 9223372036854775807]})";
+        struct NumberRecorder : json::SaxHandler {
+            std::string numbers;
+            void on_number(double n) override { numbers += "d" + std::to_string(n) + " "; }
+            void on_integer(std::int64_t n) override { numbers += "i" + std::to_string(n) + " "; }
+        } recorder;
+        REQUIRE(json::parse_sax(source, recorder).empty());
+        REQUIRE(recorder.numbers == "i1 d2.500000 i9223372036854775807 ");
+        // Handlers that only know about doubles still get every number
+        EventRecorder doubles;
+        REQUIRE(json::parse_sax(source, doubles).empty());
+        REQUIRE(doubles.events == "{ key:a [ 1.000000 2.500000 9223372036854775808.000000 ] } ");
+
+        ExprParser parser;
+        const auto expr = parser.parse("a[2]");
+        PathMatcher matcher(dynamic_cast<const PathExpr&>(*expr));
+        std::istringstream input(source);
+        REQUIRE(json::parse_sax(input, matcher, 4).empty());
+        REQUIRE(std::get<std::int64_t>(std::move(matcher).result().value) == std::numeric_limits<std::int64_t>::max());
+    }
+
+    SECTION("Broken numbers") {
+        auto [value, error] = json::parse(".e1");
+        REQUIRE_FALSE(error.empty());
+    }
+}
+
+TEST_CASE("Number formatting", "[json_eval]") {
+    auto format = [](const double n) { return json::deparse(JSONValue(n)); };
+
+    SECTION("Shortest text") {
+        REQUIRE(format(3.0) == "3");
+        REQUIRE(format(-2.5) == "-2.5");
+        REQUIRE(format(0.1) == "0.1");
+        REQUIRE(format(0.1 + 0.2) == "0.30000000000000004");
+        REQUIRE(format(1e6) == "1000000");
+        REQUIRE(format(1e21) == "1e+21");
+        REQUIRE(format(1e-7) == "1e-07");
+        REQUIRE(format(-0.0) == "-0");
+    }
+
+    SECTION("Round trips exactly") {
+        std::vector<double> numbers = {1.0 / 3.0, 2.0 / 3.0, 5e-324, 1.7976931348623157e308, 123456.789e-20,
+                                       0.4221165756, 9007199254740993.0, -1e-300};
+        uint64_t bits = 0x9E3779B97F4A7C15;
+        for (int i = 0; i < 1000; i++) {
+            bits ^= bits << 13;
+            bits ^= bits >> 7;
+            bits ^= bits << 17;
+            const auto n = std::bit_cast<double>(bits);
+            if (std::isfinite(n))
+                numbers.push_back(n);
+        }
+
+        for (const auto n : numbers) {
+            INFO(format(n));
+            auto [value, error] = json::parse(format(n));
+            REQUIRE(error.empty());
+            REQUIRE(value.as_number() == n);
+        }
+    }
+
+    SECTION("Nothing that isn't JSON") {
+        // Too big for a double is a parse error instead of an inf nobody could read back
+        for (const std::string source: std::vector<std::string>{R"({"x": 1e999})", "[-1e999]", "[1" + std::string(400, '0') + "]"}) {
+            INFO(source);
+            const auto error = std::get<1>(json::parse(source));
+            REQUIRE(error.find("Failed to parse") != std::string::npos);
+            REQUIRE(std::get<1>(json::Tape::parse(source)) == error);
+            json::SaxHandler handler;
+            REQUIRE(json::parse_sax(source, handler) == error);
+            std::istringstream input(source);
+            REQUIRE(json::parse_sax(input, handler, 4) == error);
+        }
+        REQUIRE(json::deparse(std::get<0>(json::parse("[1e-999, -1e-999]"))) == "[0, -0]");
+
+        REQUIRE(format(std::numeric_limits<double>::infinity()) == "null");
+        REQUIRE(format(-std::numeric_limits<double>::infinity()) == "null");
+        REQUIRE(format(std::numeric_limits<double>::quiet_NaN()) == "null");
+    }
+}
+
+TEST_CASE("Writer", "[json_eval]") {
+    const std::string source = R"({"a": [1, 2.5, {"b": null, "c": [true, false]}, [], {}], "s": "x\"y\\z\n\t"})";
+    auto [value, error] = json::parse(source);
+    REQUIRE(error.empty());
+    const std::string compact = R"({"a":[1, 2.5, {"b":null, "c":[true, false]}, [], {}], "s":"x\"y\\z\n\t"})";
+
+    SECTION("Compact keeps the deparse format and escapes strings") {
+        REQUIRE(json::deparse(value) == compact);
+        auto [again, again_error] = json::parse(json::deparse(value));
+        REQUIRE(again_error.empty());
+        REQUIRE(json::deparse(again) == compact);
+        REQUIRE(json::deparse(JSONValue(std::string("\x01\x1f"))) == R"("\u0001\u001f")");
+    }
+
+    SECTION("Pretty") {
+        std::string text;
+        json::Writer(text, json::Writer::Style::Pretty).write(value);
+        REQUIRE(text == "{\n"
+                        "  \"a\": [\n"
+                        "    1,\n"
+                        "    2.5,\n"
+                        "    {\n"
+                        "      \"b\": null,\n"
+                        "      \"c\": [\n"
+                        "        true,\n"
+                        "        false\n"
+                        "      ]\n"
+                        "    },\n"
+                        "    [],\n"
+                        "    {}\n"
+                        "  ],\n"
+                        "  \"s\": \"x\\\"y\\\\z\\n\\t\"\n"
+                        "}");
+    }
+
+    SECTION("Tapes are written without materializing") {
+        auto [tape, tape_error] = json::Tape::parse(source);
+        REQUIRE(tape_error.empty());
+        REQUIRE(json::deparse(tape.root()) == compact);
+
+        std::string pretty_tape, pretty_dom;
+        json::Writer(pretty_tape, json::Writer::Style::Pretty).write(tape.root());
+        json::Writer(pretty_dom, json::Writer::Style::Pretty).write(value);
+        REQUIRE(pretty_tape == pretty_dom);
+    }
+
+    SECTION("Tape members come out in key order like the DOM's") {
+        const std::string unsorted = R"({"b": 1, "x": {"a": {"z": 2, "y": 3}, "dup": 1, "c": [{"q": 1, "p": 2}], "dup": 2}})";
+        auto [dom, dom_error] = json::parse(unsorted);
+        REQUIRE(dom_error.empty());
+        auto [tape, tape_error] = json::Tape::parse(unsorted);
+        REQUIRE(tape_error.empty());
+
+        REQUIRE(json::deparse(tape.root()) == R"({"b":1, "x":{"a":{"y":3, "z":2}, "c":[{"p":2, "q":1}], "dup":2}})");
+        REQUIRE(json::deparse(tape.root()) == json::deparse(dom));
+        REQUIRE(json::deparse(tape.root()) == json::deparse(tape.root().materialize()));
+        std::string pretty_tape, pretty_dom;
+        json::Writer(pretty_tape, json::Writer::Style::Pretty).write(tape.root());
+        json::Writer(pretty_dom, json::Writer::Style::Pretty).write(dom);
+        REQUIRE(pretty_tape == pretty_dom);
+
+        ExprParser parser;
+        const auto expr = parser.parse("x");
+        REQUIRE(Evaluator(tape).evaluateRef(expr).deparse() == Evaluator(dom).evaluateRef(expr).deparse());
+    }
+
+    SECTION("Streams get the output a buffer at a time") {
+        std::ostringstream out;
+        {
+            // Smaller than the output so it has to flush along the way
+            json::Writer writer(out, json::Writer::Style::Compact, 8);
+            writer.write(value).raw('\n').write(value);
+        }
+        REQUIRE(out.str() == compact + "\n" + compact);
+    }
+
+    SECTION("File descriptors") {
+        std::FILE *file = std::tmpfile();
+        REQUIRE(file != nullptr);
+        {
+            json::Writer writer(fileno(file), json::Writer::Style::Compact, 16);
+            writer.write(value);
+            writer.flush();
+            REQUIRE(writer.error().empty());
+        }
+        std::rewind(file);
+        std::string read(compact.size() + 1, '\0');
+        read.resize(std::fread(read.data(), 1, read.size(), file));
+        std::fclose(file);
+        REQUIRE(read == compact);
+    }
+}
+
+TEST_CASE("String decoding", "[json_eval]") {
+    auto decode = [](const std::string &source) -> std::string {
+        auto [value, error] = json::parse(source);
+        return error.empty() ? std::string(std::get<json::String>(value.value)) : error;
+    };
+
+    SECTION("Unicode escapes become UTF-8") {
+        REQUIRE(decode(R"("caf\u00e9")") == "caf\xc3\xa9");
+        REQUIRE(decode(R"("\u0041\u20AC")") == "A\xe2\x82\xac");
+        REQUIRE(decode(R"("\ud83d\ude00!")") == "\xf0\x9f\x98\x80!");
+        REQUIRE(decode(R"("\u0000")") == std::string(1, '\0'));
+        // Written back escaped, and reads back the same
+        REQUIRE(json::deparse(std::get<0>(json::parse(R"("\u0001\u00e9")"))) == "\"\\u0001\xc3\xa9\"");
+    }
+
+    SECTION("Broken escapes and raw control characters are errors") {
+        for (const std::string source: {R"("\ud83d")", R"("\ud83dx")", R"("\ude00")", R"("\ud83d\u0041")",
+                                        R"("\u12g4")", R"("\u12")", "\"a\nb\"", "\"a\tb\""}) {
+            INFO(source);
+            auto [_, error] = json::parse(source);
+            REQUIRE_FALSE(error.empty());
+        }
+    }
+
+    SECTION("Every backend finds the same runs") {
+        // Escapes and control characters at every offset across the 16 and 32 byte lanes
+        std::string text;
+        for (int i = 0; i < 100; i++)
+            text += std::string(i % 37, 'x') + (i % 3 == 0 ? "\"" : i % 3 == 1 ? "\\" : "\x01") + "\xc3\xa9";
+
+        const auto original = json::active_simd_level();
+        json::set_simd_level(json::SimdLevel::Scalar);
+        std::vector<size_t> expected;
+        for (size_t i = 0; i < text.size(); i++)
+            expected.push_back(json::find_string_special(std::string_view(text).substr(i)));
+        for (auto level: {json::SimdLevel::SSE42, json::SimdLevel::AVX2}) {
+            json::set_simd_level(level);
+            for (size_t i = 0; i < text.size(); i++)
+                REQUIRE(json::find_string_special(std::string_view(text).substr(i)) == expected[i]);
+        }
+        json::set_simd_level(original);
+    }
+
+    SECTION("Long strings with escapes") {
+        std::string source = "{\"s\": \"";
+        std::string expected;
+        for (int i = 0; i < 200; i++) {
+            source += std::string(i, 'a') + R"(\n\u00e9\"\ud83d\ude00)";
+            expected += std::string(i, 'a') + "\n\xc3\xa9\"\xf0\x9f\x98\x80";
+        }
+        source += "\"}";
+
+        auto [value, error] = json::parse(source);
+        REQUIRE(error.empty());
+        REQUIRE(std::string_view(std::get<json::String>(std::get<json::Object>(value.value).at("s").value)) == expected);
+
+        // Same through the token lexer and a stream cut into small chunks
+        auto [tokens, lex_error] = json::lex(source);
+        REQUIRE(lex_error.empty());
+        REQUIRE(tokens[3].value == expected);
+        ExprParser parser;
+        const auto expr = parser.parse("s");
+        for (const size_t chunk_size: {1, 5, 4096}) {
+            std::istringstream input(source);
+            PathMatcher matcher(dynamic_cast<const PathExpr&>(*expr));
+            REQUIRE(json::parse_sax(input, matcher, chunk_size).empty());
+            REQUIRE(std::string_view(std::get<json::String>(std::move(matcher).result().value)) == expected);
+        }
+    }
+}
+
+TEST_CASE("Allocation counting", "[json_eval]") {
+    // The tests don't link alloc_hooks.cpp, the library on its own never touches operator new
+    REQUIRE_FALSE(json::alloc_counting_available());
+    const auto before = json::alloc_stats();
+    json::set_alloc_counting(true);
+    auto [value, error] = json::parse(R"({"a": [1, 2, 3], "b": "some string that won't fit inline"})");
+    REQUIRE(error.empty());
+    REQUIRE((json::alloc_stats() - before).allocations == 0);
+
+    // What the hooks report
+    json::record_allocation(24);
+    json::record_allocation(8);
+    json::record_deallocation();
+    json::set_alloc_counting(false);
+    const auto counted = json::alloc_stats() - before;
+    REQUIRE(counted.allocations == 2);
+    REQUIRE(counted.deallocations == 1);
+    REQUIRE(counted.bytes == 32);
+
+    // Nothing is counted while it's off
+    const auto off = json::alloc_stats();
+    json::record_allocation(24);
+    json::record_deallocation();
+    REQUIRE((json::alloc_stats() - off).allocations == 0);
+    REQUIRE((json::alloc_stats() - off).deallocations == 0);
+}
+
+TEST_CASE("Run statistics", "[json_eval]") {
+    const std::string source = R"({"a": {"b": [1, 2.5, "x", {"c": null}, [], {}]}, "d": true})";
+
+    SECTION("Token and node counts from the tree") {
+        auto [value, error] = json::parse(source);
+        REQUIRE(error.empty());
+        const auto dom = json::dom_stats(value);
+        REQUIRE(dom.tokens == std::get<0>(json::lex(source)).size());
+        REQUIRE(dom.nodes == 11);
+    }
+
+    SECTION("Documents know how much memory they took") {
+        auto [document, error] = json::Document::parse(source);
+        REQUIRE(error.empty());
+        REQUIRE(document.memory_used() >= source.size());
+        REQUIRE(json::Document().memory_used() == 0);
+    }
+
+    SECTION("Phases and counters as JSON") {
+        const auto counting = json::alloc_counting();
+        std::string report;
+        {
+            json::RunStats stats;
+            REQUIRE(json::alloc_counting());
+            {
+                const auto timing = stats.phase("parse");
+                auto [document, error] = json::Document::parse(source);
+                REQUIRE(error.empty());
+            }
+            { const auto timing = stats.phase("evaluate"); }
+            stats.set("bytes_read", 1);
+            stats.set("bytes_read", source.size());
+            stats.set("tokens", 5);
+
+            REQUIRE(stats.phases().size() == 2);
+            REQUIRE(stats.phases()[0].name == "parse");
+            // No hooks in the tests
+            REQUIRE(stats.phases()[0].allocations.allocations == 0);
+            REQUIRE(stats.counters().size() == 2);
+            report = stats.to_json();
+        }
+        REQUIRE(json::alloc_counting() == counting);
+
+        auto [value, error] = json::parse(report);
+        REQUIRE(error.empty());
+        const auto &object = std::get<json::Object>(value.value);
+        const auto &phases = std::get<json::Array>(object.at("phases").value);
+        REQUIRE(phases.size() == 2);
+        REQUIRE(std::get<json::String>(std::get<json::Object>(phases[1].value).at("name").value) == "evaluate");
+        const auto &counters = std::get<json::Object>(object.at("counters").value);
+        REQUIRE(std::get<std::int64_t>(counters.at("bytes_read").value) == std::ssize(source));
+        REQUIRE(object.at("total_seconds").as_number() >= 0);
+        // Without the hooks there's nothing to report
+        REQUIRE(std::holds_alternative<std::monostate>(object.at("allocations").value));
+        REQUIRE(std::holds_alternative<std::monostate>(object.at("alloc_bytes").value));
+        REQUIRE(std::holds_alternative<std::monostate>(std::get<json::Object>(phases[0].value).at("allocations").value));
+    }
+}
+
+TEST_CASE("Parallel parsing", "[json_eval]") {
+    json::ThreadPool pool(4);
+    // Small chunks so even short sources get split
+    auto parallel = [&pool](const std::string &source, const size_t chunk_size) -> std::string {
+        auto [value, error] = json::parse_parallel(
+            source, pool, [](size_t) { return json::ChunkArena{std::pmr::get_default_resource(), nullptr}; },
+            std::pmr::get_default_resource(), nullptr, chunk_size);
+        return error.empty() ? json::deparse(value) : error;
+    };
+    auto sequential = [](const std::string &source) -> std::string {
+        auto [value, error] = json::parse(source);
+        return error.empty() ? json::deparse(value) : error;
+    };
+
+    SECTION("Boundaries are never inside strings or nested values") {
+        const std::string source = R"( [1, "a,\"b,", [2, 3], {"c": [4, 5]}, "\\", 6] )";
+        const auto chunks = json::split_array(source, 0);
+        std::vector<std::string> pieces;
+        for (const auto &[first, last]: chunks)
+            pieces.push_back(source.substr(first, last - first));
+        REQUIRE(pieces == std::vector<std::string>{"1", R"( "a,\"b,")", " [2, 3]", R"( {"c": [4, 5]})", R"( "\\")", " 6"});
+        REQUIRE(source[chunks.back().second] == ']');
+
+        REQUIRE(json::split_array(R"({"a": [1, 2]})", 0).empty());
+        REQUIRE(json::split_array("[1, 2", 0).empty());
+    }
+
+    SECTION("Same values as the single threaded parse") {
+        std::string source = "[";
+        for (int i = 0; i < 500; i++) {
+            source += i == 0 ? "" : ",\n";
+            source += R"({"id": )" + std::to_string(i) + R"(, "s": "x,]}\"[{)" + std::to_string(i * 7) +
+                      R"(", "v": [)" + std::to_string(i) + R"(.5, {"n": null}], "b": true})";
+        }
+        source += "]\n";
+        for (const size_t chunk_size: {0, 1, 100, 1000, 1 << 20}) {
+            REQUIRE(parallel(source, chunk_size) == sequential(source));
+        }
+    }
+
+    SECTION("Same errors as the single threaded parse") {
+        for (const std::string source: {R"([1, 2, {"a": }, 3, 4])", "[1, 2, 3, ]", "[1, 2, 3", "[1, 2] x", "[1, 2}",
+                                        R"([1, {"a": 1]}, 2])", R"([1, "abc, 2])", "[1, 2 3, 4]", R"(["\q", 1, 2])"}) {
+            INFO(source);
+            REQUIRE(parallel(source, 1) == sequential(source));
+        }
+    }
+
+    SECTION("Documents") {
+        // Over the default chunk size a couple of times
+        std::string source = "[";
+        size_t count = 0;
+        for (; source.size() < (3 << 20); count++)
+            source += (count == 0 ? "" : ", ") + std::string(R"({"key": "value", "n": )") + std::to_string(count) + "}";
+        source += "]";
+
+        auto [document, error] = json::Document::parse(source, pool);
+        REQUIRE(error.empty());
+        auto [expected, expected_error] = json::Document::parse(source);
+        REQUIRE(json::deparse(document.root()) == json::deparse(expected.root()));
+        REQUIRE(document.memory_used() > 0);
+
+        const auto &elements = std::get<json::Array>(document.root().value);
+        REQUIRE(elements.size() == count);
+        REQUIRE(json::deparse(elements[100]) == R"({"key":"value", "n":100})");
+    }
+}
+
+TEST_CASE("Aggregation", "[json_eval]") {
+    // The plain loop the kernels have to agree with, bit for bit
+    auto plain = [](const std::vector<double> &values, const json::Aggregate op, double result) {
+        for (const double value: values)
+            result = json::combine(op, result, value);
+        return result;
+    };
+    auto same = [](const double a, const double b) {
+        return std::bit_cast<uint64_t>(a) == std::bit_cast<uint64_t>(b);
+    };
+
+    // NaNs, infinities and zeros of both signs sprinkled in
+    std::vector<double> values;
+    uint64_t state = 88172645463325252ull;
+    for (int i = 0; i < 3000; i++) {
+        state ^= state << 13, state ^= state >> 7, state ^= state << 17;
+        switch (state % 11) {
+            case 0:
+                values.push_back(std::numeric_limits<double>::quiet_NaN());
+                break;
+            case 1:
+                values.push_back(state % 2 ? 0.0 : -0.0);
+                break;
+            case 2:
+                values.push_back(state % 3 ? std::numeric_limits<double>::infinity()
+                                           : -std::numeric_limits<double>::infinity());
+                break;
+            default:
+                values.push_back(static_cast<double>(static_cast<int64_t>(state % 2001) - 1000) / 8);
+        }
+    }
+
+    SECTION("Kernels match the plain loop on every backend") {
+        const auto original = json::active_simd_level();
+        for (const auto level: {json::SimdLevel::Scalar, json::SimdLevel::SSE42, json::SimdLevel::AVX2}) {
+            json::set_simd_level(level);
+            for (const auto op: {json::Aggregate::Min, json::Aggregate::Max}) {
+                for (const double initial: {std::numeric_limits<double>::max(), std::numeric_limits<double>::lowest(),
+                                            0.0, -0.0, 3.5}) {
+                    // Every tail length, and windows where the extreme is a zero or all NaN
+                    for (size_t first = 0; first < 40; first++) {
+                        for (const size_t size: {size_t{0}, size_t{1}, size_t{3}, size_t{7}, size_t{9}, size_t{17},
+                                                 size_t{1000}}) {
+                            const std::vector<double> window(values.begin() + first, values.begin() + first + size);
+                            REQUIRE(same(json::aggregate(window, op, initial), plain(window, op, initial)));
+                        }
+                    }
+                }
+            }
+            const std::vector<double> zeros{0.0, -0.0, 0.0, 1.0, -0.0, 0.0, 0.0, 0.0, -0.0};
+            REQUIRE(same(json::aggregate(zeros, json::Aggregate::Min, 1.0), 0.0));
+            REQUIRE(same(json::aggregate(std::span(zeros).subspan(1), json::Aggregate::Max, -1.0), 1.0));
+            REQUIRE(same(json::aggregate(std::span(zeros).subspan(4), json::Aggregate::Max, -1.0), -0.0));
+        }
+        json::set_simd_level(original);
+    }
+
+    SECTION("Array elements, split across threads or not") {
+        json::Array elements;
+        for (size_t i = 0; i < values.size(); i++) {
+            if (i % 5 == 0)
+                elements.emplace_back(static_cast<int64_t>(i) - 1500);
+            else
+                elements.emplace_back(values[i]);
+        }
+        std::vector<double> numbers;
+        for (const auto &element: elements)
+            numbers.push_back(*element.as_number());
+
+        json::ThreadPool pool(4);
+        for (const auto op: {json::Aggregate::Min, json::Aggregate::Max}) {
+            const double expected = plain(numbers, op, 0.0);
+            REQUIRE(same(*json::aggregate(std::span<const json::JSONValue>(elements), op, 0.0), expected));
+            for (const size_t chunk_size: {1, 100, 1000, 5000}) {
+                REQUIRE(same(*json::aggregate(elements, op, 0.0, pool, chunk_size), expected));
+            }
+        }
+
+        // A non number anywhere, including the middle of a chunk that isn't the first
+        elements[2222] = json::JSONValue("2222");
+        REQUIRE_FALSE(json::aggregate(std::span<const json::JSONValue>(elements), json::Aggregate::Min, 0.0));
+        REQUIRE_FALSE(json::aggregate(elements, json::Aggregate::Min, 0.0, pool, 100));
+    }
+
+    SECTION("Tapes and expressions") {
+        std::string source = R"({"a": [)";
+        for (int i = 0; i < 2000; i++)
+            source += (i == 0 ? "" : ", ") + std::to_string((i * 7919) % 2003 - 1000) + (i % 3 ? ".25" : "");
+        source += R"(], "b": [1, 2, [3]], "c": [-0.0, 0.0])";
+        source += "}";
+
+        auto [tape, tape_error] = json::Tape::parse(source);
+        REQUIRE(tape_error.empty());
+        auto [document, error] = json::parse(source);
+        REQUIRE(error.empty());
+        ExprParser parser;
+        for (const std::string expression: {"min(a)", "max(a)", "min(a, 3, c)", "max(c)", "min(c, 0)"}) {
+            INFO(expression);
+            const auto expr = parser.parse(expression);
+            REQUIRE(json::deparse(Evaluator(document).evaluate(expr)) == json::deparse(Evaluator(tape).evaluate(expr)));
+        }
+        REQUIRE(json::deparse(Evaluator(document).evaluate(parser.parse("min(a)"))) == "-1000");
+        REQUIRE(json::deparse(Evaluator(document).evaluate(parser.parse("max(a)"))) == "1002.25");
+        REQUIRE(json::deparse(Evaluator(document).evaluate(parser.parse("max(c)"))) == "-0");
+        REQUIRE_THROWS_WITH(Evaluator(document).evaluate(parser.parse("max(a, b)")),
+                            "Array elements must be numbers for max operation");
+        REQUIRE_THROWS_WITH(Evaluator(tape).evaluate(parser.parse("max(a, b)")),
+                            "Array elements must be numbers for max operation");
+    }
+
+    SECTION("Integers stay exact") {
+        // Past 2^53 neighbouring integers are the same double
+        std::vector<std::int64_t> integers;
+        for (int i = 0; i < 3000; i++) {
+            state ^= state << 13, state ^= state >> 7, state ^= state << 17;
+            integers.push_back(static_cast<std::int64_t>(state));
+        }
+        integers[1234] = std::numeric_limits<std::int64_t>::max();
+        integers[2345] = std::numeric_limits<std::int64_t>::min();
+        const auto original = json::active_simd_level();
+        json::ThreadPool pool(4);
+        for (const auto level: {json::SimdLevel::Scalar, json::SimdLevel::SSE42, json::SimdLevel::AVX2}) {
+            json::set_simd_level(level);
+            for (const auto op: {json::Aggregate::Min, json::Aggregate::Max}) {
+                for (size_t first = 0; first < 12; first++) {
+                    for (const size_t size: {size_t{0}, size_t{1}, size_t{5}, size_t{9}, size_t{2000}}) {
+                        const std::span<const std::int64_t> window(integers.data() + first, size);
+                        std::int64_t expected = 7;
+                        for (const auto integer: window)
+                            expected = json::combine(op, expected, integer);
+                        REQUIRE(json::aggregate_integers(window, op, 7) == expected);
+                        REQUIRE(json::aggregate_integers(window, op, 7, pool, 100) == expected);
+                    }
+                }
+            }
+        }
+        json::set_simd_level(original);
+
+        std::string column = "[";
+        for (int i = 0; i < 20; i++)
+            column += (i == 0 ? "" : ", ") + std::to_string(9007199254740992 + (i * 7) % 20 - 10);
+        column += "]";
+        const std::string source = R"({"big": [9007199254740992, 9007199254740993, 5, -9007199254740993,)"
+                                   R"( -9007199254740992], "col": )" +
+                                   column + R"(, "mix": [9007199254740993, 0.5], "none": []})";
+        auto [document, error] = json::Document::parse(source);
+        REQUIRE(error.empty());
+        REQUIRE(std::holds_alternative<json::IntegerColumn>(
+                std::get<json::Object>(document.root().value).at("col").value));
+        auto [tape, tape_error] = json::Tape::parse(source);
+        REQUIRE(tape_error.empty());
+        auto [on_demand, on_demand_error] = json::OnDemandDocument::parse(source);
+        REQUIRE(on_demand_error.empty());
+
+        ExprParser parser;
+        const Evaluator evaluator(document.root());
+        for (const auto &[expression, expected]: std::vector<std::pair<std::string, std::string>>{
+                 {"max(big)", "9007199254740993"},
+                 {"min(big)", "-9007199254740993"},
+                 {"max(big[*])", "9007199254740993"},
+                 {"min(big[0], big[1])", "9007199254740992"},
+                 {"max(col)", "9007199254741001"},
+                 {"min(col[*], 9007199254740983)", "9007199254740982"},
+                 {"max(none, col, big, 3)", "9007199254741001"},
+                 {"max(9223372036854775807, big)", "9223372036854775807"},
+                 // Anything that isn't an integer and it's doubles again
+                 {"max(mix)", "9007199254740992"},
+                 {"min(big, mix)", "-9007199254740992"}}) {
+            INFO(expression);
+            const auto expr = parser.parse(expression);
+            REQUIRE(json::deparse(evaluator.evaluate(expr)) == expected);
+            REQUIRE(json::deparse(Evaluator(tape).evaluate(expr)) == expected);
+            REQUIRE(json::deparse(Evaluator(on_demand).evaluate(expr)) == expected);
+            REQUIRE(json::deparse(evaluator.evaluate(Program::compile(*expr))) == expected);
+        }
+        REQUIRE(std::holds_alternative<std::int64_t>(evaluator.evaluate(parser.parse("max(col)")).value));
+        REQUIRE(std::holds_alternative<double>(evaluator.evaluate(parser.parse("max(mix)")).value));
+        REQUIRE(std::holds_alternative<double>(evaluator.evaluate(parser.parse("max(none)")).value));
+    }
+}
+
+TEST_CASE("Columnar arrays", "[json_eval]") {
+    auto numbers = [](const int count, const std::string &suffix) {
+        std::string text = "[";
+        for (int i = 0; i < count; i++)
+            text += (i == 0 ? "" : ", ") + std::to_string(i * 37 % 101 - 50) + suffix;
+        return text + "]";
+    };
+    auto parsed = [](const std::string &source) {
+        auto [value, error] = json::parse(source);
+        REQUIRE(error.empty());
+        return value;
+    };
+
+    SECTION("Only homogeneous arrays that are long enough get packed") {
+        REQUIRE(std::holds_alternative<json::DoubleColumn>(parsed(numbers(16, ".5")).value));
+        REQUIRE(std::holds_alternative<json::IntegerColumn>(parsed(numbers(16, "")).value));
+        REQUIRE(std::holds_alternative<json::Array>(parsed(numbers(15, ".5")).value));
+        REQUIRE(std::holds_alternative<json::Array>(parsed("[]").value));
+        // Mixed kinds of number stay an Array so the integers stay integers
+        auto mixed = numbers(20, ".5");
+        mixed.replace(mixed.find("-50.5"), 5, "-50");
+        REQUIRE(std::holds_alternative<json::Array>(parsed(mixed).value));
+        const auto integers = numbers(20, "");
+        REQUIRE(std::holds_alternative<json::Array>(parsed(integers.substr(0, integers.size() - 1) + ", null]").value));
+
+        const auto nested = parsed(R"({"a": [)" + numbers(20, "") + ", " + numbers(3, "") + "]}");
+        const auto &outer = std::get<json::Array>(std::get<json::Object>(nested.value).at("a").value);
+        REQUIRE(std::holds_alternative<json::IntegerColumn>(outer[0].value));
+        REQUIRE(std::holds_alternative<json::Array>(outer[1].value));
+    }
+
+    SECTION("Written out and counted like the Array they stand for") {
+        for (const std::string source: {numbers(40, ".25"), numbers(40, ""), numbers(40, "e300")}) {
+            const auto column = parsed(source);
+            REQUIRE_FALSE(std::holds_alternative<json::Array>(column.value));
+            json::Array elements;
+            std::visit(
+                [&elements]<typename T>(const T &v) {
+                    if constexpr (std::is_same_v<T, json::DoubleColumn> || std::is_same_v<T, json::IntegerColumn>)
+                        for (const auto number: v)
+                            elements.emplace_back(number);
+                },
+                column.value);
+            const json::JSONValue array(elements);
+
+            REQUIRE(json::deparse(column) == json::deparse(array));
+            std::string pretty_column, pretty_array;
+            json::Writer(pretty_column, json::Writer::Style::Pretty).write(column);
+            json::Writer(pretty_array, json::Writer::Style::Pretty).write(array);
+            REQUIRE(pretty_column == pretty_array);
+            REQUIRE(json::dom_stats(column).nodes == json::dom_stats(array).nodes);
+            REQUIRE(json::dom_stats(column).tokens == json::dom_stats(array).tokens);
+        }
+    }
+
+    SECTION("Paths, size, min and max work on the column") {
+        const std::string source = R"({"d": )" + numbers(30, ".5") + R"(, "i": )" + numbers(30, "") + "}";
+        auto [document, error] = json::Document::parse(source);
+        REQUIRE(error.empty());
+        const auto &root = std::get<json::Object>(document.root().value);
+        REQUIRE(std::get<json::DoubleColumn>(root.at("d").value).get_allocator().resource() !=
+                std::pmr::get_default_resource());
+
+        auto [tape, tape_error] = json::Tape::parse(source);
+        REQUIRE(tape_error.empty());
+        auto [on_demand, on_demand_error] = json::OnDemandDocument::parse(source);
+        REQUIRE(on_demand_error.empty());
+
+        ExprParser parser;
+        const Evaluator evaluator(document.root());
+        auto result = evaluator.evaluateRef(parser.parse("i[3]"));
+        REQUIRE(std::get<std::int64_t>(result->value) == 3 * 37 % 101 - 50);
+        REQUIRE(std::get<double>(evaluator.evaluate(parser.parse("d[i[2]]")).value) == 30.5);
+
+        for (const std::string expression: {"d", "i[29]", "d[0]", "size(d)", "size(i)", "min(d)", "max(i)",
+                                            "min(d, i, 7)", "max(d[3], i)", "i[i[2]]"}) {
+            INFO(expression);
+            const auto expr = parser.parse(expression);
+            const auto expected = json::deparse(Evaluator(tape).evaluate(expr));
+            REQUIRE(json::deparse(evaluator.evaluate(expr)) == expected);
+            REQUIRE(json::deparse(Evaluator(on_demand).evaluate(expr)) == expected);
+            REQUIRE(json::deparse(evaluator.evaluate(Program::compile(*expr))) == expected);
+        }
+        REQUIRE(json::deparse(evaluator.evaluate(parser.parse("min(d)"))) == "-50.5");
+
+        for (const auto &[expression, message]: std::vector<std::pair<std::string, std::string>>{
+                 {"d[30]", "Array index out of bounds"},
+                 {"i[1].x", "Invalid path: expected object"},
+                 {"i[1][0]", "Invalid path: expected array"},
+                 {"d[d]", "Invalid array index type"}}) {
+            INFO(expression);
+            REQUIRE_THROWS_WITH(evaluator.evaluate(parser.parse(expression)), message);
+            REQUIRE_THROWS_WITH(Evaluator(tape).evaluate(parser.parse(expression)), message);
+        }
+
+        // Copies go back to the heap like everything else
+        const auto copy = evaluator.evaluate(parser.parse("d"));
+        REQUIRE(std::get<json::DoubleColumn>(copy.value).get_allocator().resource() == std::pmr::get_default_resource());
+        REQUIRE(std::holds_alternative<json::IntegerColumn>(tape.root().find("i")->materialize().value));
+    }
+
+    SECTION("Parallel parsing packs the same way") {
+        json::ThreadPool pool(4);
+        // A single integer keeps the whole array unpacked
+        std::string mixed = numbers(200, ".5");
+        mixed.replace(mixed.rfind("-12.5"), 5, "-12");
+        for (const std::string source: {numbers(200, ".5"), numbers(200, ""), mixed}) {
+            const auto expected = parsed(source);
+            // Small enough for no chunk to be packed, and big enough for most of them to be
+            for (const size_t chunk_size: {50, 300, 500}) {
+                auto [value, error] = json::parse_parallel(
+                    source, pool, [](size_t) { return json::ChunkArena{std::pmr::get_default_resource(), nullptr}; },
+                    std::pmr::get_default_resource(), nullptr, chunk_size);
+                REQUIRE(error.empty());
+                REQUIRE(value.value.index() == expected.value.index());
+                REQUIRE(json::deparse(value) == json::deparse(expected));
+            }
+        }
+    }
+}
+
+TEST_CASE("Wildcards and slices", "[json_eval]") {
+    std::string source = R"({"items": [{"price": 3, "tags": ["a", "b"]}, {"price": 10.5, "tags": []},
+                                       {"price": -2, "tags": ["c"]}],
+                             "prices": {"b": 2, "a": 1, "c": 3}, "grid": [[1, 2], [3, 4], [5, 6]], "n": 1, "col": [)";
+    for (int i = 0; i < 20; i++)
+        source += (i == 0 ? "" : ", ") + std::to_string(i);
+    source += "]}";
+
+    auto [root, error] = json::parse(source);
+    REQUIRE(error.empty());
+    REQUIRE(std::holds_alternative<json::IntegerColumn>(std::get<json::Object>(root.value).at("col").value));
+    auto [tape, tape_error] = json::Tape::parse(source);
+    REQUIRE(tape_error.empty());
+    auto [on_demand, on_demand_error] = json::OnDemandDocument::parse(source);
+    REQUIRE(on_demand_error.empty());
+
+    ExprParser parser;
+    const Evaluator evaluator(root);
+    auto deparsed = [](const std::string &text) {
+        auto [value, parse_error] = json::parse(text);
+        REQUIRE(parse_error.empty());
+        return json::deparse(value);
+    };
+
+    SECTION("Ranges come out as arrays of what they select, the same from every evaluator") {
+        const std::vector<std::pair<std::string, std::string>> cases = {
+            {"items[*].price", "[3, 10.5, -2]"},
+            {"items[1:].price", "[10.5, -2]"},
+            {"items[*].tags[*]", R"(["a", "b", "c"])"},
+            {"items[*].tags", R"([["a", "b"], [], ["c"]])"},
+            {"prices.*", "[1, 2, 3]"},
+            {"grid[*][n]", "[2, 4, 6]"},
+            {"grid[1:][*]", "[3, 4, 5, 6]"},
+            {"col[::5]", "[0, 5, 10, 15]"},
+            {"col[-3:]", "[17, 18, 19]"},
+            {"col[2:5]", "[2, 3, 4]"},
+            {"col[ 1 : -15 : 2 ]", "[1, 3]"},
+            {"col[5:2]", "[]"},
+            {"col[100:]", "[]"},
+            {"col[-100:2]", "[0, 1]"},
+            {"col[-9223372036854775808:2]", "[0, 1]"},
+            {"col[:-9223372036854775808]", "[]"},
+            {"grid[*][5:]", "[]"},
+            {"max(items[*].price)", "10.5"},
+            {"min(items[*].price, 7)", "-2"},
+            {"max(grid[*][*], col[:3])", "6"},
+            {"min(col[3:])", "3"},
+            {"size(items[*].tags[*])", "3"},
+            {"size(prices.*)", "3"},
+            {"col[size(items[*].tags)]", "3"},
+            {"col[max(grid[*][0])]", "5"},
+        };
+        for (const auto &[expression, expected]: cases) {
+            INFO(expression);
+            const auto expr = parser.parse(expression);
+            REQUIRE(json::deparse(evaluator.evaluate(expr)) == deparsed(expected));
+            REQUIRE(json::deparse(Evaluator(tape).evaluate(expr)) == deparsed(expected));
+            REQUIRE(json::deparse(Evaluator(on_demand).evaluate(expr)) == deparsed(expected));
+            REQUIRE(json::deparse(evaluator.evaluate(Program::compile(*expr))) == deparsed(expected));
+            // Results handed out by reference are settled into arrays too
+            REQUIRE(evaluator.evaluateRef(expr).range() == nullptr);
+        }
+
+        // Mixed into a batch with plain paths over the same prefix
+        std::vector<std::unique_ptr<Expr>> exprs;
+        exprs.push_back(parser.parse("items[0].price"));
+        exprs.push_back(parser.parse("items[*].price"));
+        exprs.push_back(parser.parse("max(items[*].price, items[1].price)"));
+        const ExprBatch batch(std::move(exprs));
+        const auto results = evaluator.evaluateAll(batch);
+        REQUIRE(std::get<0>(results[1])->deparse() == deparsed("[3, 10.5, -2]"));
+        REQUIRE(std::get<0>(results[2])->deparse() == "10.5");
+
+        // The same range twice is only resolved once
+        const auto program = Program::compile(*parser.parse("max(items[*].price, size(items[*].price))"));
+        REQUIRE(json::deparse(evaluator.evaluate(program)) == "10.5");
+
+        // size(b) is kept in a register, which is gone once the program is done running
+        auto [nested, nested_error] = json::parse(R"({"a": [[0], [[10, 11], [20, 21], [30, 31]]], "b": [1]})");
+        REQUIRE(nested_error.empty());
+        const auto reused = Program::compile(*parser.parse("a[size(b)][*][size(b)]"));
+        REQUIRE(json::deparse(Evaluator(nested).evaluate(reused)) == deparsed("[11, 21, 31]"));
+        REQUIRE(Evaluator(nested).evaluateRef(reused).deparse() == deparsed("[11, 21, 31]"));
+    }
+
+    SECTION("Errors show up when the range is used") {
+        for (const auto &[expression, message]: std::vector<std::pair<std::string, std::string>>{
+                 {"n[*]", "Invalid path: expected array"},
+                 {"n.*", "Invalid path: expected object"},
+                 {"items[*].x", "Key not found: x"},
+                 {"items[*].tags[1]", "Array index out of bounds"},
+                 {"max(items[*].tags)", "Array elements must be numbers for max operation"},
+                 {"min(prices.*, items[*].tags[*])", "Array elements must be numbers for min operation"},
+                 {"col[items[*].price]", "Invalid array index type"},
+                 // Too big for a slice bound, but it's no slice
+                 {"col[100000000000000000000000000000]", "Array index out of bounds"}}) {
+            INFO(expression);
+            const auto expr = parser.parse(expression);
+            REQUIRE_THROWS_WITH(evaluator.evaluate(expr), message);
+            REQUIRE_THROWS_WITH(Evaluator(tape).evaluate(expr), message);
+            REQUIRE_THROWS_WITH(Evaluator(on_demand).evaluate(expr), message);
+            REQUIRE_THROWS_WITH(evaluator.evaluate(Program::compile(*expr)), message);
+        }
+
+        REQUIRE_THROWS_WITH(parser.parse("col[100000000000000000000000000000:]"), "Invalid slice bound");
+        REQUIRE_THROWS_WITH(parser.parse("col[:100000000000000000000000000000]"), "Invalid slice bound");
+        REQUIRE_THROWS_WITH(parser.parse("col[::0]"), "Slice step must be positive");
+        REQUIRE_THROWS_WITH(parser.parse("col[::-1]"), "Slice step must be positive");
+        REQUIRE_THROWS_WITH(parser.parse("col[*x]"), "Expected ']'");
+        REQUIRE_THROWS_WITH(parser.parse("col[1:x]"), "Expected ']'");
+        const auto expr = parser.parse("items[*].price");
+        REQUIRE_THROWS_WITH(PathMatcher(dynamic_cast<const PathExpr &>(*expr)),
+                            "Streaming paths don't support wildcards or slices");
     }
 }
 
@@ -0,0 +1,334 @@
+#include "aggregate.hpp"
+
+#include <array>
+#include <future>
+#include <limits>
+#include <vector>
+#include "simd_scan.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JSON_SIMD_X86 1
+#endif
+
+namespace json {
+  namespace {
+    // What the kernels start from, anything beats it
+    template<Aggregate Op>
+    constexpr double identity() {
+      return Op == Aggregate::Min ? std::numeric_limits<double>::infinity()
+                                  : -std::numeric_limits<double>::infinity();
+    }
+
+    // The kernels return the smallest/largest non NaN value (identity when there's none), the sign of a zero
+    // result is whatever lane won and gets fixed up afterwards
+    template<Aggregate Op>
+    double extreme_scalar(const double *data, const size_t size) {
+      double result = identity<Op>();
+      for (size_t i = 0; i < size; i++)
+        result = combine(Op, result, data[i]);
+      return result;
+    }
+
+#ifdef JSON_SIMD_X86
+    // minpd/maxpd return the second operand when either is NaN, so the accumulator always goes second
+    __attribute__((target("sse4.2"))) inline __m128d step_sse(const Aggregate op, const __m128d v, const __m128d acc) {
+      return op == Aggregate::Min ? _mm_min_pd(v, acc) : _mm_max_pd(v, acc);
+    }
+
+    template<Aggregate Op>
+    __attribute__((target("sse4.2"))) double extreme_sse42(const double *data, const size_t size) {
+      __m128d acc0 = _mm_set1_pd(identity<Op>());
+      __m128d acc1 = acc0;
+      size_t i = 0;
+      for (; i + 4 <= size; i += 4) {
+        acc0 = step_sse(Op, _mm_loadu_pd(data + i), acc0);
+        acc1 = step_sse(Op, _mm_loadu_pd(data + i + 2), acc1);
+      }
+      // Neither accumulator can hold a NaN
+      alignas(16) double lanes[2];
+      _mm_store_pd(lanes, step_sse(Op, acc1, acc0));
+      return combine(Op, combine(Op, lanes[0], lanes[1]), extreme_scalar<Op>(data + i, size - i));
+    }
+
+    __attribute__((target("avx2"))) inline __m256d step_avx(const Aggregate op, const __m256d v, const __m256d acc) {
+      return op == Aggregate::Min ? _mm256_min_pd(v, acc) : _mm256_max_pd(v, acc);
+    }
+
+    template<Aggregate Op>
+    __attribute__((target("avx2"))) double extreme_avx2(const double *data, const size_t size) {
+      __m256d acc0 = _mm256_set1_pd(identity<Op>());
+      __m256d acc1 = acc0;
+      size_t i = 0;
+      for (; i + 8 <= size; i += 8) {
+        acc0 = step_avx(Op, _mm256_loadu_pd(data + i), acc0);
+        acc1 = step_avx(Op, _mm256_loadu_pd(data + i + 4), acc1);
+      }
+      alignas(32) double lanes[4];
+      _mm256_store_pd(lanes, step_avx(Op, acc1, acc0));
+      double result = extreme_scalar<Op>(data + i, size - i);
+      for (const double lane: lanes)
+        result = combine(Op, result, lane);
+      return result;
+    }
+#endif
+
+    template<Aggregate Op>
+    double extreme(const double *data, const size_t size) {
+#ifdef JSON_SIMD_X86
+      switch (active_simd_level()) {
+        case SimdLevel::AVX2:
+          return extreme_avx2<Op>(data, size);
+        case SimdLevel::SSE42:
+          return extreme_sse42<Op>(data, size);
+        case SimdLevel::Scalar:
+          break;
+      }
+#endif
+      return extreme_scalar<Op>(data, size);
+    }
+
+    // Integers compare exactly, no NaNs or zero signs to worry about
+    template<Aggregate Op>
+    std::int64_t extreme_scalar(const std::int64_t *data, const size_t size, std::int64_t result) {
+      for (size_t i = 0; i < size; i++)
+        result = combine(Op, result, data[i]);
+      return result;
+    }
+
+#ifdef JSON_SIMD_X86
+    // There's no 64 bit integer min/max before AVX-512, a compare and a blend does the same
+    template<Aggregate Op>
+    __attribute__((target("sse4.2"))) inline __m128i step_sse(const __m128i v, const __m128i acc) {
+      return Op == Aggregate::Min ? _mm_blendv_epi8(acc, v, _mm_cmpgt_epi64(acc, v))
+                                  : _mm_blendv_epi8(acc, v, _mm_cmpgt_epi64(v, acc));
+    }
+
+    template<Aggregate Op>
+    __attribute__((target("sse4.2"))) std::int64_t extreme_sse42(const std::int64_t *data, const size_t size,
+                                                                  const std::int64_t initial) {
+      __m128i acc0 = _mm_set1_epi64x(initial);
+      __m128i acc1 = acc0;
+      size_t i = 0;
+      for (; i + 4 <= size; i += 4) {
+        acc0 = step_sse<Op>(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i)), acc0);
+        acc1 = step_sse<Op>(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 2)), acc1);
+      }
+      alignas(16) std::int64_t lanes[2];
+      _mm_store_si128(reinterpret_cast<__m128i *>(lanes), step_sse<Op>(acc1, acc0));
+      return extreme_scalar<Op>(data + i, size - i, combine(Op, lanes[0], lanes[1]));
+    }
+
+    template<Aggregate Op>
+    __attribute__((target("avx2"))) inline __m256i step_avx(const __m256i v, const __m256i acc) {
+      return Op == Aggregate::Min ? _mm256_blendv_epi8(acc, v, _mm256_cmpgt_epi64(acc, v))
+                                  : _mm256_blendv_epi8(acc, v, _mm256_cmpgt_epi64(v, acc));
+    }
+
+    template<Aggregate Op>
+    __attribute__((target("avx2"))) std::int64_t extreme_avx2(const std::int64_t *data, const size_t size,
+                                                               const std::int64_t initial) {
+      __m256i acc0 = _mm256_set1_epi64x(initial);
+      __m256i acc1 = acc0;
+      size_t i = 0;
+      for (; i + 8 <= size; i += 8) {
+        acc0 = step_avx<Op>(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i)), acc0);
+        acc1 = step_avx<Op>(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + 4)), acc1);
+      }
+      alignas(32) std::int64_t lanes[4];
+      _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), step_avx<Op>(acc1, acc0));
+      std::int64_t result = extreme_scalar<Op>(data + i, size - i, initial);
+      for (const auto lane: lanes)
+        result = combine(Op, result, lane);
+      return result;
+    }
+#endif
+
+    template<Aggregate Op>
+    std::int64_t extreme(const std::int64_t *data, const size_t size, const std::int64_t initial) {
+#ifdef JSON_SIMD_X86
+      switch (active_simd_level()) {
+        case SimdLevel::AVX2:
+          return extreme_avx2<Op>(data, size, initial);
+        case SimdLevel::SSE42:
+          return extreme_sse42<Op>(data, size, initial);
+        case SimdLevel::Scalar:
+          break;
+      }
+#endif
+      return extreme_scalar<Op>(data, size, initial);
+    }
+
+    template<Aggregate Op>
+    double fold(const std::span<const double> values, const double initial) {
+      double result = extreme<Op>(values.data(), values.size());
+      // 0.0 and -0.0 compare equal, the plain loop keeps the first one it sees
+      if (result == 0)
+        result = *std::find(values.begin(), values.end(), 0.0);
+      // Ties go to initial since it came before all of them
+      return combine(Op, initial, result);
+    }
+
+    // What each chunk does on its own, these never split
+    double aggregate_sequential(const std::span<const double> values, const Aggregate op, const double initial) {
+      return op == Aggregate::Min ? fold<Aggregate::Min>(values, initial) : fold<Aggregate::Max>(values, initial);
+    }
+
+    double aggregate_sequential(const std::span<const std::int64_t> values, const Aggregate op, const double initial) {
+      Aggregator aggregator(op, initial);
+      for (const auto value: values)
+        aggregator.add(static_cast<double>(value));
+      return aggregator.result();
+    }
+
+    std::int64_t aggregate_sequential(const std::span<const std::int64_t> values, const Aggregate op,
+                                      const std::int64_t initial) {
+      return op == Aggregate::Min ? extreme<Aggregate::Min>(values.data(), values.size(), initial)
+                                  : extreme<Aggregate::Max>(values.data(), values.size(), initial);
+    }
+
+    std::optional<double> aggregate_sequential(const std::span<const JSONValue> elements, const Aggregate op,
+                                               const double initial) {
+      Aggregator aggregator(op, initial);
+      for (const auto &element: elements) {
+        const auto number = element.as_number();
+        if (!number)
+          return std::nullopt;
+        aggregator.add(*number);
+      }
+      return aggregator.result();
+    }
+
+    // Only started the first time something is big enough to split
+    ThreadPool &shared_pool() {
+      static ThreadPool pool;
+      return pool;
+    }
+
+    // Splits values into a chunk per thread, at least chunk_size long, and combines the chunk results in order
+    // so ties still go to the earliest chunk. Every chunk starts from initial too, that's harmless since
+    // combining with it again changes nothing
+    template<typename T, typename R>
+    std::optional<R> aggregate_parallel(const std::span<const T> values, const Aggregate op, const R initial,
+                                        ThreadPool &pool, size_t chunk_size) {
+      chunk_size = std::max<size_t>(chunk_size, 1);
+      if (pool.size() < 2 || values.size() < 2 * chunk_size)
+        return aggregate_sequential(values, op, initial);
+
+      const size_t chunks = std::min(pool.size(), values.size() / chunk_size);
+      std::vector<std::future<std::optional<R>>> parts;
+      parts.reserve(chunks);
+      for (size_t i = 0; i < chunks; i++) {
+        const size_t first = values.size() * i / chunks;
+        const auto part = values.subspan(first, values.size() * (i + 1) / chunks - first);
+        parts.push_back(pool.submit([part, op, initial]() -> std::optional<R> {
+          return aggregate_sequential(part, op, initial);
+        }));
+      }
+
+      // Everything is waited on since the tasks use values
+      std::optional<R> result = initial;
+      for (auto &part: parts) {
+        const auto folded = part.get();
+        if (!folded)
+          result = std::nullopt;
+        else if (result)
+          result = combine(op, *result, *folded);
+      }
+      return result;
+    }
+  } // anonymous namespace
+
+  double aggregate(const std::span<const double> values, const Aggregate op, const double initial) {
+    if (values.size() < 2 * parallel_aggregate_size)
+      return aggregate_sequential(values, op, initial);
+    return aggregate(values, op, initial, shared_pool(), parallel_aggregate_size);
+  }
+
+  double aggregate(const std::span<const std::int64_t> values, const Aggregate op, const double initial) {
+    if (values.size() < 2 * parallel_aggregate_size)
+      return aggregate_sequential(values, op, initial);
+    return aggregate(values, op, initial, shared_pool(), parallel_aggregate_size);
+  }
+
+  std::optional<double> aggregate(const std::span<const JSONValue> elements, const Aggregate op, const double initial) {
+    if (elements.size() < 2 * parallel_aggregate_size)
+      return aggregate_sequential(elements, op, initial);
+    return aggregate(elements, op, initial, shared_pool(), parallel_aggregate_size);
+  }
+
+  double aggregate(const std::span<const double> values, const Aggregate op, const double initial, ThreadPool &pool,
+                   const size_t chunk_size) {
+    return *aggregate_parallel(values, op, initial, pool, chunk_size);
+  }
+
+  double aggregate(const std::span<const std::int64_t> values, const Aggregate op, const double initial,
+                   ThreadPool &pool, const size_t chunk_size) {
+    return *aggregate_parallel(values, op, initial, pool, chunk_size);
+  }
+
+  std::optional<double> aggregate(const std::span<const JSONValue> elements, const Aggregate op, const double initial,
+                                  ThreadPool &pool, const size_t chunk_size) {
+    return aggregate_parallel(elements, op, initial, pool, chunk_size);
+  }
+
+  std::optional<double> aggregate(const TapeCursor array, const Aggregate op, const double initial) {
+    Aggregator aggregator(op, initial);
+    bool numbers = true;
+    // for_each_element can't stop early, the rest is skipped over once a non number shows up
+    array.for_each_element([&](const TapeCursor element) {
+      if (!numbers)
+        return;
+      if (element.is_number())
+        aggregator.add(element.as_number());
+      else
+        numbers = false;
+    });
+    if (!numbers)
+      return std::nullopt;
+    return aggregator.result();
+  }
+
+  std::int64_t aggregate_integers(const std::span<const std::int64_t> values, const Aggregate op,
+                                  const std::int64_t initial) {
+    if (values.size() < 2 * parallel_aggregate_size)
+      return aggregate_sequential(values, op, initial);
+    return aggregate_integers(values, op, initial, shared_pool(), parallel_aggregate_size);
+  }
+
+  std::int64_t aggregate_integers(const std::span<const std::int64_t> values, const Aggregate op,
+                                  const std::int64_t initial, ThreadPool &pool, const size_t chunk_size) {
+    return *aggregate_parallel(values, op, initial, pool, chunk_size);
+  }
+
+  std::optional<std::int64_t> aggregate_integers(const std::span<const JSONValue> elements, const Aggregate op,
+                                                 std::int64_t initial) {
+    for (const auto &element: elements) {
+      const auto *integer = std::get_if<std::int64_t>(&element.value);
+      if (integer == nullptr)
+        return std::nullopt;
+      initial = combine(op, initial, *integer);
+    }
+    return initial;
+  }
+
+  std::optional<std::int64_t> aggregate_integers(const TapeCursor array, const Aggregate op, std::int64_t initial) {
+    bool integers = true;
+    array.for_each_element([&](const TapeCursor element) {
+      if (!integers)
+        return;
+      if (element.is_integer())
+        initial = combine(op, initial, element.as_integer());
+      else
+        integers = false;
+    });
+    if (!integers)
+      return std::nullopt;
+    return initial;
+  }
+
+  void Aggregator::flush() {
+    folded = aggregate_sequential(std::span<const double>(block.data(), filled), op, folded);
+    filled = 0;
+  }
+} // namespace json
@@ -0,0 +1,78 @@
+// Replaces the global operator new and delete so json::alloc_stats() has something to count
+// Not part of json_cpp on purpose, only the executables that report allocations link it (see CMakeLists.txt).
+// Every form is replaced, array, nothrow and over aligned ones included, so whatever allocates gets counted
+// and everything ends up in malloc/free consistently
+#include <cstdlib>
+#include <new>
+#include "alloc_stats.hpp"
+
+namespace {
+  const bool installed = (json::set_alloc_counting_available(), true);
+
+  void *allocate(std::size_t size, const std::size_t alignment) {
+    json::record_allocation(size);
+    size = size == 0 ? 1 : size;
+    while (true) {
+      // aligned_alloc wants the size to be a multiple of the alignment
+      void *p = alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__
+                    ? std::malloc(size)
+                    : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+      if (p != nullptr)
+        return p;
+      const auto handler = std::get_new_handler();
+      if (handler == nullptr)
+        throw std::bad_alloc();
+      handler();
+    }
+  }
+
+  void *allocate_nothrow(const std::size_t size, const std::size_t alignment) noexcept {
+    try {
+      return allocate(size, alignment);
+    } catch (...) {
+      return nullptr;
+    }
+  }
+
+  void deallocate(void *p) noexcept {
+    if (p != nullptr)
+      json::record_deallocation();
+    std::free(p);
+  }
+
+  constexpr std::size_t default_alignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+} // anonymous namespace
+
+void *operator new(const std::size_t size) { return allocate(size, default_alignment); }
+void *operator new[](const std::size_t size) { return allocate(size, default_alignment); }
+void *operator new(const std::size_t size, const std::nothrow_t &) noexcept {
+  return allocate_nothrow(size, default_alignment);
+}
+void *operator new[](const std::size_t size, const std::nothrow_t &) noexcept {
+  return allocate_nothrow(size, default_alignment);
+}
+void *operator new(const std::size_t size, const std::align_val_t alignment) {
+  return allocate(size, static_cast<std::size_t>(alignment));
+}
+void *operator new[](const std::size_t size, const std::align_val_t alignment) {
+  return allocate(size, static_cast<std::size_t>(alignment));
+}
+void *operator new(const std::size_t size, const std::align_val_t alignment, const std::nothrow_t &) noexcept {
+  return allocate_nothrow(size, static_cast<std::size_t>(alignment));
+}
+void *operator new[](const std::size_t size, const std::align_val_t alignment, const std::nothrow_t &) noexcept {
+  return allocate_nothrow(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void *p) noexcept { deallocate(p); }
+void operator delete[](void *p) noexcept { deallocate(p); }
+void operator delete(void *p, std::size_t) noexcept { deallocate(p); }
+void operator delete[](void *p, std::size_t) noexcept { deallocate(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { deallocate(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { deallocate(p); }
+void operator delete(void *p, std::align_val_t) noexcept { deallocate(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { deallocate(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { deallocate(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { deallocate(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept { deallocate(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept { deallocate(p); }
@@ -0,0 +1,38 @@
+#include "alloc_stats.hpp"
+
+#include <atomic>
+
+namespace json {
+  namespace {
+    std::atomic<bool> counting{false};
+    std::atomic<bool> available{false};
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> deallocations{0};
+    std::atomic<uint64_t> bytes{0};
+  } // anonymous namespace
+
+  void set_alloc_counting(const bool enabled) { counting.store(enabled, std::memory_order_relaxed); }
+
+  bool alloc_counting() { return counting.load(std::memory_order_relaxed); }
+
+  AllocStats alloc_stats() {
+    return {allocations.load(std::memory_order_relaxed), deallocations.load(std::memory_order_relaxed),
+            bytes.load(std::memory_order_relaxed)};
+  }
+
+  bool alloc_counting_available() { return available.load(std::memory_order_relaxed); }
+
+  void record_allocation(const std::size_t size) {
+    if (counting.load(std::memory_order_relaxed)) {
+      allocations.fetch_add(1, std::memory_order_relaxed);
+      bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+  }
+
+  void record_deallocation() {
+    if (counting.load(std::memory_order_relaxed))
+      deallocations.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void set_alloc_counting_available() { available.store(true, std::memory_order_relaxed); }
+} // namespace json
@@ -0,0 +1,78 @@
+#include "document.hpp"
+
+#include <algorithm>
+#include "json_parser.hpp"
+#include "key_table.hpp"
+#include "parallel_parse.hpp"
+
+namespace json {
+  namespace {
+    const JSONValue null_value{};
+
+    // The tree tends to take a bit more memory than the text it came from,
+    // so starting the arena at the source size saves a few rounds of growing it
+    constexpr size_t minimum_arena_size = 4096;
+  } // anonymous namespace
+
+  Document::Document() : root_(&null_value) {}
+
+  std::tuple<Document, std::string> Document::parse(const std::string_view source) {
+    Document document;
+    document.arena = std::make_unique<Arena>(std::max(source.size(), minimum_arena_size));
+    auto *resource = &document.arena->resource;
+
+    // Keys are interned per document, in the arena like everything else
+    std::pmr::polymorphic_allocator<> allocator(resource);
+    auto *keys = allocator.new_object<KeyTable>(resource);
+
+    auto [value, error] = JSONParser(source, resource, keys).parse();
+    if (!error.empty()) {
+      return {Document{}, error};
+    }
+
+    // The root lives in the arena too and is deliberately never destructed
+    document.root_ = allocator.new_object<JSONValue>(std::move(value));
+    return {std::move(document), ""};
+  }
+
+  std::tuple<Document, std::string> Document::parse(const std::string_view source, ThreadPool &pool) {
+    Document document;
+    // Only the top level array ends up in here, unless the source wasn't split
+    document.arena = std::make_unique<Arena>(minimum_arena_size);
+    auto *resource = &document.arena->resource;
+    std::pmr::polymorphic_allocator<> allocator(resource);
+    auto *keys = allocator.new_object<KeyTable>(resource);
+
+    const auto chunk_arena = [&document](const size_t bytes) {
+      auto &chunk = document.chunk_arenas.emplace_back(std::make_unique<Arena>(std::max(bytes, minimum_arena_size)));
+      auto *chunk_keys = std::pmr::polymorphic_allocator<>(&chunk->resource).new_object<KeyTable>(&chunk->resource);
+      return ChunkArena{&chunk->resource, chunk_keys};
+    };
+    auto [value, error] = parse_parallel(source, pool, chunk_arena, resource, keys);
+    if (!error.empty()) {
+      return {Document{}, error};
+    }
+
+    document.root_ = allocator.new_object<JSONValue>(std::move(value));
+    return {std::move(document), ""};
+  }
+
+  const JSONValue &Document::root() const { return *root_; }
+
+  size_t Document::memory_used() const {
+    size_t used = arena ? arena->upstream.allocated : 0;
+    for (const auto &chunk: chunk_arenas)
+      used += chunk->upstream.allocated;
+    return used;
+  }
+
+  void *Document::CountingResource::do_allocate(const size_t bytes, const size_t alignment) {
+    void *p = std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    allocated += bytes;
+    return p;
+  }
+
+  void Document::CountingResource::do_deallocate(void *p, const size_t bytes, const size_t alignment) {
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+} // namespace json
@@ -1,158 +1,803 @@
 #include "evaluator.hpp"
 
-#include <functional>
+#include <algorithm>
+#include <cstdint>
 #include <limits>
+#include <optional>
 #include <stdexcept>
+#include "aggregate.hpp"
 #include "expr.hpp"
 
-Evaluator::Evaluator(const json::JSONValue &root) : root(root) {}
+Evaluator::Evaluator(const json::JSONValue &root) : root(&root) {}
 
-json::JSONValue Evaluator::evaluate(const std::unique_ptr<Expr> &expr) const { return expr->accept(*this); }
+Evaluator::Evaluator(const json::Tape &tape) : root(tape.root()) {}
 
-json::JSONValue Evaluator::visitLiteral(const LiteralExpr &expr) const { return expr.value; }
+Evaluator::Evaluator(const json::OnDemandDocument &document) : root(document.root()) {}
 
-json::JSONValue Evaluator::visitPath(const PathExpr &expr) const { return resolvePath(expr.segments); }
+namespace {
+  // Ranges only live while an expression is evaluated, what's handed out is the array of their values
+  EvalResult settle(EvalResult result) {
+    if (result.range() != nullptr)
+      return EvalResult::own(std::move(result).materialize());
+    return result;
+  }
+} // anonymous namespace
+
+json::JSONValue Evaluator::evaluate(const std::unique_ptr<Expr> &expr) const {
+  return expr->accept(*this).materialize();
+}
+
+EvalResult Evaluator::evaluateRef(const std::unique_ptr<Expr> &expr) const { return settle(expr->accept(*this)); }
 
-json::JSONValue Evaluator::visitFunction(const FunctionExpr &expr) const {
-  std::vector<json::JSONValue> args;
+// Literals live in the AST so they can be borrowed as well
+EvalResult Evaluator::visitLiteral(const LiteralExpr &expr) const { return EvalResult::borrow(expr.value); }
+
+EvalResult Evaluator::visitPath(const PathExpr &expr) const { return resolvePath(expr.segments); }
+
+EvalResult Evaluator::visitFunction(const FunctionExpr &expr) const {
+  std::vector<EvalResult> args;
   args.reserve(expr.arguments.size());
   for (const auto &arg: expr.arguments) {
     args.push_back(arg->accept(*this));
   }
 
   if (expr.name == "min") {
-    return evaluateMin(args);
+    return EvalResult::own(evaluateMin(args));
   }
 
   if (expr.name == "max") {
-    return evaluateMax(args);
+    return EvalResult::own(evaluateMax(args));
   }
 
   if (expr.name == "size") {
-    return evaluateSize(args);
+    return EvalResult::own(evaluateSize(args));
   }
   throw std::runtime_error("Unknown function: " + expr.name);
 }
 
+namespace {
+  // One step down the document for each kind of node walkPath can run on
+  // The checks and messages have to be the same for both so a query fails the same way on either
+  const json::JSONValue *memberOf(const json::JSONValue *node, const std::string &key) {
+    // Try to get the current value as an object
+    if (auto *obj = std::get_if<json::Object>(&node->value)) {
+      // Look up the key in the object
+      auto it = obj->find(std::string_view(key));
+      if (it == obj->end()) {
+        throw std::runtime_error("Key not found: " + key);
+      }
+      return &it->value;
+    }
+    // If current value is not an object, we can't access it with a key
+    throw std::runtime_error("Invalid path: expected object");
+  }
+
+  json::TapeCursor memberOf(const json::TapeCursor node, const std::string &key) {
+    if (!node.is_object()) {
+      throw std::runtime_error("Invalid path: expected object");
+    }
+    const auto member = node.find(key);
+    if (!member) {
+      throw std::runtime_error("Key not found: " + key);
+    }
+    return *member;
+  }
+
+  json::RawValue memberOf(const json::RawValue node, const std::string &key) {
+    if (!node.is_object()) {
+      throw std::runtime_error("Invalid path: expected object");
+    }
+    auto [member, error] = node.find(key);
+    if (!error.empty()) {
+      throw std::runtime_error(error);
+    }
+    if (!member) {
+      throw std::runtime_error("Key not found: " + key);
+    }
+    return *member;
+  }
+
+  // Negative indexes end up out of bounds instead of wrapping around
+  size_t toIndex(const std::int64_t index) { return index < 0 ? SIZE_MAX : static_cast<size_t>(index); }
+
+  size_t toIndex(const double index) {
+    if (!(index >= 0) || index >= 0x1p64)
+      return SIZE_MAX;
+    return static_cast<size_t>(index);
+  }
+
+  // Index expressions are evaluated against the document too, so they can come back as either kind
+  // Integers are used as is, doubles are truncated
+  std::optional<size_t> indexOf(const EvalResult &value) {
+    // A range is never a number
+    if (value.range() != nullptr)
+      return std::nullopt;
+    if (const auto *cursor = value.cursor()) {
+      if (cursor->is_integer())
+        return toIndex(cursor->as_integer());
+      if (cursor->is_number())
+        return toIndex(cursor->as_number());
+      return std::nullopt;
+    }
+    if (const auto *integer = std::get_if<std::int64_t>(&value->value))
+      return toIndex(*integer);
+    if (const auto *number = std::get_if<double>(&value->value))
+      return toIndex(*number);
+    return std::nullopt;
+  }
+
+  // Where a path is in a DOM. Elements of a column aren't JSONValues that could be pointed to, so a path that
+  // gets to one carries a copy of the number instead (nothing can go any further down from a number anyway)
+  struct DomNode {
+    const json::JSONValue *value = nullptr;
+    json::JSONValue element; // only when value is nullptr
+  };
+
+  DomNode memberOf(const DomNode &node, const std::string &key) {
+    if (node.value == nullptr) {
+      throw std::runtime_error("Invalid path: expected object");
+    }
+    return {memberOf(node.value, key), {}};
+  }
+
+  template<typename Column>
+  DomNode columnElement(const Column &column, const size_t idx) {
+    if (idx >= column.size()) {
+      throw std::runtime_error("Array index out of bounds");
+    }
+    return {nullptr, json::JSONValue(column[idx])};
+  }
+
+  DomNode elementOf(const DomNode &node, const EvalResult &indexValue) {
+    // Any of the array representations will do
+    if (node.value == nullptr || !node.value->is_array()) {
+      // If current value is not an array, we can't access it with an index
+      throw std::runtime_error("Invalid path: expected array");
+    }
+    const auto index = indexOf(indexValue);
+    if (!index) {
+      // Index expression didn't evaluate to a number
+      throw std::runtime_error("Invalid array index type");
+    }
+    auto idx = *index;
+    if (const auto *doubles = std::get_if<json::DoubleColumn>(&node.value->value)) {
+      return columnElement(*doubles, idx);
+    }
+    if (const auto *integers = std::get_if<json::IntegerColumn>(&node.value->value)) {
+      return columnElement(*integers, idx);
+    }
+    const auto &arr = std::get<json::Array>(node.value->value);
+    // Check for array bounds
+    if (idx >= arr.size()) {
+      throw std::runtime_error("Array index out of bounds");
+    }
+    return {&arr[idx], {}};
+  }
+
+  json::TapeCursor elementOf(const json::TapeCursor node, const EvalResult &indexValue) {
+    if (!node.is_array()) {
+      throw std::runtime_error("Invalid path: expected array");
+    }
+    const auto index = indexOf(indexValue);
+    if (!index) {
+      throw std::runtime_error("Invalid array index type");
+    }
+    const auto element = node.at(*index);
+    if (!element) {
+      throw std::runtime_error("Array index out of bounds");
+    }
+    return *element;
+  }
+
+  json::RawValue elementOf(const json::RawValue node, const EvalResult &indexValue) {
+    if (!node.is_array()) {
+      throw std::runtime_error("Invalid path: expected array");
+    }
+    const auto index = indexOf(indexValue);
+    if (!index) {
+      throw std::runtime_error("Invalid array index type");
+    }
+    auto [element, error] = node.at(*index);
+    if (!error.empty()) {
+      throw std::runtime_error(error);
+    }
+    if (!element) {
+      throw std::runtime_error("Array index out of bounds");
+    }
+    return *element;
+  }
+
+  // What a path ending at each kind of node evaluates to, see resolvePath
+  EvalResult resultOf(const DomNode &node) {
+    if (node.value == nullptr) {
+      return EvalResult::own(node.element);
+    }
+    return EvalResult::borrow(*node.value);
+  }
+
+  EvalResult resultOf(const json::TapeCursor node) { return EvalResult::borrow(node); }
+
+  EvalResult resultOf(const json::RawValue node) {
+    auto [value, error] = node.materialize();
+    if (!error.empty()) {
+      throw std::runtime_error(error);
+    }
+    return EvalResult::own(std::move(value));
+  }
+
+  // Where walking starts for each kind of root
+  DomNode nodeOf(const json::JSONValue *root) { return {root, {}}; }
+
+  json::TapeCursor nodeOf(const json::TapeCursor root) { return root; }
+
+  json::RawValue nodeOf(const json::RawValue root) { return root; }
+
+  // The indexes a slice picks out of an array with size elements
+  struct Slice {
+    size_t first;
+    size_t last; // one past
+    size_t step;
+  };
+
+  // Python style, negative bounds count from the end and everything is clamped to the array
+  Slice sliceOf(const RangeSegment &range, const size_t size) {
+    const auto bound = [size](const std::optional<std::int64_t> value, const size_t missing) -> size_t {
+      if (!value)
+        return missing;
+      if (*value < 0) {
+        // Negated unsigned so INT64_MIN doesn't overflow
+        const auto back = 0 - static_cast<std::uint64_t>(*value);
+        return back >= size ? 0 : size - back;
+      }
+      return std::min(static_cast<size_t>(*value), size);
+    };
+    return {bound(range.start, 0), bound(range.end, size), static_cast<size_t>(range.step)};
+  }
+
+  // Calls f with every node a range segment selects out of node, in order
+  template<typename F>
+  void forEachSelected(const DomNode &node, const RangeSegment &range, F &&f) {
+    if (range.kind == RangeSegment::Kind::Members) {
+      const auto *obj = node.value == nullptr ? nullptr : std::get_if<json::Object>(&node.value->value);
+      if (obj == nullptr) {
+        throw std::runtime_error("Invalid path: expected object");
+      }
+      for (const auto &member: *obj) {
+        f(DomNode{&member.value, {}});
+      }
+      return;
+    }
+
+    if (node.value == nullptr || !node.value->is_array()) {
+      throw std::runtime_error("Invalid path: expected array");
+    }
+    std::visit(
+        [&]<typename T>(const T &elements) {
+          if constexpr (std::is_same_v<T, json::Array> || std::is_same_v<T, json::DoubleColumn> ||
+                        std::is_same_v<T, json::IntegerColumn>) {
+            const auto [first, last, step] = sliceOf(range, elements.size());
+            for (size_t i = first; i < last; i += step) {
+              if constexpr (std::is_same_v<T, json::Array>)
+                f(DomNode{&elements[i], {}});
+              else
+                f(DomNode{nullptr, json::JSONValue(elements[i])});
+            }
+          }
+        },
+        node.value->value);
+  }
+
+  template<typename F>
+  void forEachSelected(const json::TapeCursor node, const RangeSegment &range, F &&f) {
+    if (range.kind == RangeSegment::Kind::Members) {
+      if (!node.is_object()) {
+        throw std::runtime_error("Invalid path: expected object");
+      }
+      // Key order, like they would come out of an Object
+      for (const auto &[_, value]: node.members_by_key()) {
+        f(value);
+      }
+      return;
+    }
+
+    if (!node.is_array()) {
+      throw std::runtime_error("Invalid path: expected array");
+    }
+    const auto [first, last, step] = sliceOf(range, node.size());
+    if (first >= last) {
+      return;
+    }
+    // Elements can only be stepped over one at a time, containers in O(1) each
+    auto element = *node.at(first);
+    for (size_t i = first; i < last; i += step) {
+      f(element);
+      if (i + step < last) {
+        for (size_t skipped = 0; skipped < step; skipped++)
+          element = element.next();
+      }
+    }
+  }
+
+  template<typename F>
+  void forEachSelected(const json::RawValue node, const RangeSegment &range, F &&f) {
+    if (range.kind == RangeSegment::Kind::Members) {
+      if (!node.is_object()) {
+        throw std::runtime_error("Invalid path: expected object");
+      }
+      auto [size, error] = node.size();
+      if (!error.empty()) {
+        throw std::runtime_error(error);
+      }
+      for (size_t i = 0; i < size; i++) {
+        f(*std::get<0>(node.member_at(i)));
+      }
+      return;
+    }
+
+    if (!node.is_array()) {
+      throw std::runtime_error("Invalid path: expected array");
+    }
+    // Elements are only indexed as far as they're needed, unless a bound counts from the end
+    size_t size = SIZE_MAX;
+    if (range.start.value_or(0) < 0 || range.end.value_or(0) < 0) {
+      auto [count, error] = node.size();
+      if (!error.empty()) {
+        throw std::runtime_error(error);
+      }
+      size = count;
+    }
+    const auto [first, last, step] = sliceOf(range, size);
+    for (size_t i = first; i < last; i += step) {
+      auto [element, error] = node.at(i);
+      if (!error.empty()) {
+        throw std::runtime_error(error);
+      }
+      if (!element) {
+        break;
+      }
+      f(*element);
+    }
+  }
+
+  // The rest of a path from its first range segment on. Index expressions are evaluated once up front, they
+  // only depend on the document root and not on which element they're applied to
+  using RangeStep = std::variant<const std::string *, EvalResult, RangeSegment>;
+
+  template<typename Node>
+  class NodeRange final : public ValueRange {
+  private:
+    Node start;
+    std::vector<RangeStep> steps;
+
+    void walk(Node node, size_t i, const std::function<void(const EvalResult &)> &f) const {
+      for (; i < steps.size(); i++) {
+        const auto &step = steps[i];
+        if (const auto *key = std::get_if<const std::string *>(&step)) {
+          node = memberOf(node, **key);
+        } else if (const auto *index = std::get_if<EvalResult>(&step)) {
+          node = elementOf(node, *index);
+        } else {
+          // Everything after this range is walked once per value it selects
+          forEachSelected(node, std::get<RangeSegment>(step), [&](const Node &selected) { walk(selected, i + 1, f); });
+          return;
+        }
+      }
+      f(resultOf(node));
+    }
+
+  public:
+    NodeRange(Node start, std::vector<RangeStep> steps) : start(std::move(start)), steps(std::move(steps)) {}
+
+    void forEach(const std::function<void(const EvalResult &)> &f) const override { walk(start, 0, f); }
+  };
+} // anonymous namespace
+
 // This is where the brain of the evaluating is done
 // Resolves a JSON path expression (e.g., "a.b[1]") to its corresponding value
 // segments: Vector of path components, alternating between string keys and array indices
 //          e.g., for "a.b[1]", segments contains ["a", "b", Expression(1)] or roughly similar
-json::JSONValue
-Evaluator::resolvePath(const std::vector<std::variant<std::string, std::unique_ptr<Expr>>> &segments) const {
-  // Initialize with a copy of the root JSON value
-  // This ensures we don't modify the original data
-  json::JSONValue current = root;
-
-  // Process each segment of the path sequentially
+// Node is a pointer into the DOM or a cursor into the tape, nothing gets copied while walking either
+template<typename Node>
+Node Evaluator::walkPath(Node current, const std::span<const PathSegment> segments) const {
+  // Process each segment of the path sequentially, we only ever move further down the tree
   for (const auto &segment: segments) {
     if (std::holds_alternative<std::string>(segment)) {
       // Handle object key access (e.g., the "a" in "a.b")
-      const auto &key = std::get<std::string>(segment);
-
-      // Try to get the current value as an object
-      if (auto *obj = std::get_if<std::map<std::string, json::JSONValue>>(&current.value)) {
-        // Look up the key in the object
-        auto it = obj->find(key);
-        if (it == obj->end()) {
-          throw std::runtime_error("Key not found: " + key);
-        }
-        // Create a new JSONValue from the found value
-        // This maintains proper variant wrapping
-        current = json::JSONValue(it->second);
-      } else {
-        // If current value is not an object, we can't access it with a key
-        throw std::runtime_error("Invalid path: expected object");
-      }
+      current = memberOf(current, std::get<std::string>(segment));
     } else {
       // Handle array index access (e.g., the "[1]" in "a.b[1]")
       const auto &indexExpr = std::get<std::unique_ptr<Expr>>(segment);
       // Evaluate the index expression (could be a literal or a complex expression)
-      auto indexValue = indexExpr->accept(*this);
-
-      // Try to get the current value as an array
-      if (auto *arr = std::get_if<std::vector<json::JSONValue>>(&current.value)) {
-        if (auto *index = std::get_if<double>(&indexValue.value)) {
-          auto idx = static_cast<size_t>(*index);
-          // Check for array bounds
-          if (idx >= arr->size()) {
-            throw std::runtime_error("Array index out of bounds");
+      current = elementOf(current, indexExpr->accept(*this));
+    }
+  }
+
+  // Return the final resolved value
+  return current;
+}
+
+EvalResult Evaluator::resolvePath(const std::vector<PathSegment> &segments) const {
+  const auto range = std::find_if(segments.begin(), segments.end(), [](const PathSegment &segment) {
+    return std::holds_alternative<RangeSegment>(segment);
+  });
+  if (range != segments.end()) {
+    return std::visit([&](const auto current) { return resolveRange(nodeOf(current), segments, range - segments.begin()); },
+                      root);
+  }
+
+  if (const auto *tape_root = std::get_if<json::TapeCursor>(&root)) {
+    return EvalResult::borrow(walkPath(*tape_root, segments));
+  }
+  if (const auto *raw_root = std::get_if<json::RawValue>(&root)) {
+    // This is the only part of the source that gets parsed
+    auto [value, error] = walkPath(*raw_root, segments).materialize();
+    if (!error.empty()) {
+      throw std::runtime_error(error);
+    }
+    return EvalResult::own(std::move(value));
+  }
+  return resultOf(walkPath(nodeOf(std::get<const json::JSONValue *>(root)), segments));
+}
+
+// The part before the first range is walked right away like any path, the rest only when the range is used
+template<typename Node>
+EvalResult Evaluator::resolveRange(Node current, const std::vector<PathSegment> &segments,
+                                   const size_t first_range) const {
+  current = walkPath(current, std::span(segments).first(first_range));
+  std::vector<RangeStep> steps;
+  steps.reserve(segments.size() - first_range);
+  for (size_t i = first_range; i < segments.size(); i++) {
+    if (const auto *key = std::get_if<std::string>(&segments[i])) {
+      steps.emplace_back(key);
+    } else if (const auto *index = std::get_if<std::unique_ptr<Expr>>(&segments[i])) {
+      steps.emplace_back((*index)->accept(*this));
+    } else {
+      steps.emplace_back(std::get<RangeSegment>(segments[i]));
+    }
+  }
+  return EvalResult::ofRange(std::make_shared<NodeRange<Node>>(std::move(current), std::move(steps)));
+}
+
+namespace {
+  // Fails every path under a prefix that didn't resolve
+  void failTrie(const ExprBatch::Node &node, const std::string &error,
+                std::vector<std::tuple<std::optional<EvalResult>, std::string>> &resolved) {
+    for (const auto slot: node.slots)
+      std::get<1>(resolved[slot]) = error;
+    for (const auto &child: node.children)
+      failTrie(*child.node, error, resolved);
+  }
+
+  // Evaluates the batch's paths out of what resolveTrie found instead of walking them again
+  class BatchEvaluator : public Evaluator {
+  private:
+    const ExprBatch &batch;
+    const std::vector<std::tuple<std::optional<EvalResult>, std::string>> &resolved;
+
+  public:
+    BatchEvaluator(const Evaluator &evaluator, const ExprBatch &batch,
+                   const std::vector<std::tuple<std::optional<EvalResult>, std::string>> &resolved) :
+        Evaluator(evaluator), batch(batch), resolved(resolved) {}
+
+    [[nodiscard]] EvalResult visitPath(const PathExpr &expr) const override {
+      const auto slot = batch.slot(expr);
+      if (!slot)
+        return Evaluator::visitPath(expr);
+      const auto &[value, error] = resolved[*slot];
+      if (!value)
+        throw std::runtime_error(error);
+      return *value;
+    }
+  };
+} // anonymous namespace
+
+// Walks the trie depth first, every node is one step down from its parent's value
+template<typename Node>
+void Evaluator::resolveTrie(Node current, const ExprBatch::Node &node,
+                            std::vector<std::tuple<std::optional<EvalResult>, std::string>> &resolved) const {
+  for (const auto slot: node.slots) {
+    auto &[value, error] = resolved[slot];
+    try {
+      value.emplace(resultOf(current));
+    } catch (const std::exception &e) {
+      error = e.what();
+    }
+  }
+  for (const auto &child: node.children) {
+    std::optional<Node> next;
+    try {
+      if (child.index == nullptr) {
+        next = memberOf(current, std::get<std::string>(child.segment));
+      } else {
+        next = elementOf(current, EvalResult::borrow(*child.index));
+      }
+    } catch (const std::exception &e) {
+      failTrie(*child.node, e.what(), resolved);
+      continue;
+    }
+    resolveTrie(*next, *child.node, resolved);
+  }
+}
+
+std::vector<std::tuple<std::optional<EvalResult>, std::string>> Evaluator::evaluateAll(const ExprBatch &batch) const {
+  std::vector<std::tuple<std::optional<EvalResult>, std::string>> resolved(batch.slots());
+  std::visit([&](const auto current) { resolveTrie(nodeOf(current), batch.trie(), resolved); }, root);
+
+  const BatchEvaluator evaluator(*this, batch, resolved);
+  std::vector<std::tuple<std::optional<EvalResult>, std::string>> results;
+  results.reserve(batch.expressions().size());
+  for (const auto &expr: batch.expressions()) {
+    try {
+      results.emplace_back(settle(expr->accept(evaluator)), "");
+    } catch (const std::exception &e) {
+      results.emplace_back(std::nullopt, e.what());
+    }
+  }
+  return results;
+}
+
+// The stack machine behind Program, one loop over the instructions
+// Paths are walked on a stack of nodes and only turn into results at EndPath, everything else is a value
+template<typename Node>
+EvalResult Evaluator::run(const Node root_node, const Program &program) const {
+  std::vector<Node> nodes;
+  nodes.reserve(program.node_depth());
+  std::vector<EvalResult> values;
+  values.reserve(program.value_depth());
+  std::vector<std::optional<EvalResult>> registers(program.register_count());
+
+  for (const auto &instruction: program.instructions()) {
+    switch (instruction.op) {
+      case Program::Op::Literal:
+        values.push_back(EvalResult::borrow(program.constant(instruction.operand)));
+        break;
+      case Program::Op::Root:
+        nodes.push_back(root_node);
+        break;
+      case Program::Op::Member:
+        nodes.back() = memberOf(nodes.back(), program.string(instruction.operand));
+        break;
+      case Program::Op::Element:
+        nodes.back() = elementOf(nodes.back(), EvalResult::borrow(program.constant(instruction.operand)));
+        break;
+      case Program::Op::Index: {
+        nodes.back() = elementOf(nodes.back(), values.back());
+        values.pop_back();
+        break;
+      }
+      case Program::Op::EndPath:
+        values.push_back(resultOf(nodes.back()));
+        nodes.pop_back();
+        break;
+      case Program::Op::Range: {
+        // The rest of the path from its first range on, computed indexes are the top count values
+        const auto indexes = std::span<EvalResult>(values).last(instruction.count);
+        auto next_index = indexes.begin();
+        std::vector<RangeStep> steps;
+        for (const auto &step: program.range_path(instruction.operand)) {
+          switch (step.kind) {
+            case Program::RangeStep::Kind::Member:
+              steps.emplace_back(&program.string(step.operand));
+              break;
+            case Program::RangeStep::Kind::Element:
+              steps.emplace_back(EvalResult::borrow(program.constant(step.operand)));
+              break;
+            case Program::RangeStep::Kind::Index:
+              steps.emplace_back(std::move(*next_index++));
+              break;
+            case Program::RangeStep::Kind::Range:
+              steps.emplace_back(step.range);
+              break;
           }
-          // Create a new JSONValue from the array element
-          // This maintains proper variant wrapping
-          current = json::JSONValue((*arr)[idx]);
-        } else {
-          // Index expression didn't evaluate to a number
-          throw std::runtime_error("Invalid array index type");
         }
-      } else {
-        // If current value is not an array, we can't access it with an index
-        throw std::runtime_error("Invalid path: expected array");
+        values.erase(values.end() - instruction.count, values.end());
+        values.push_back(EvalResult::ofRange(std::make_shared<NodeRange<Node>>(nodes.back(), std::move(steps))));
+        nodes.pop_back();
+        break;
+      }
+      case Program::Op::Store:
+      case Program::Op::Load: {
+        // A repeated subexpression is always used up by a function or an index before the run ends, so the
+        // stack can borrow what the register owns instead of copying it
+        auto &stored = registers[instruction.operand];
+        if (instruction.op == Program::Op::Store) {
+          stored = std::move(values.back());
+          values.pop_back();
+        }
+        values.push_back(stored->isBorrowed() || stored->range() != nullptr ? *stored
+                                                                             : EvalResult::borrow(stored->get()));
+        break;
+      }
+      default: {
+        // Functions, the arguments are the top count values
+        const auto args = std::span<const EvalResult>(values).last(instruction.count);
+        json::JSONValue result;
+        switch (instruction.op) {
+          case Program::Op::Min:
+            result = evaluateMin(args);
+            break;
+          case Program::Op::Max:
+            result = evaluateMax(args);
+            break;
+          case Program::Op::Size:
+            result = evaluateSize(args);
+            break;
+          default:
+            throw std::runtime_error("Unknown function: " + program.string(instruction.operand));
+        }
+        values.erase(values.end() - instruction.count, values.end());
+        values.push_back(EvalResult::own(std::move(result)));
+        break;
       }
     }
   }
+  // Ranges can hold indexes borrowed from the registers, they have to be walked before those go away
+  return settle(std::move(values.back()));
+}
 
-  // Return the final resolved value
-  return current;
+json::JSONValue Evaluator::evaluate(const Program &program) const { return evaluateRef(program).materialize(); }
+
+EvalResult Evaluator::evaluateRef(const Program &program) const {
+  return std::visit([&](const auto current) { return run(nodeOf(current), program); }, root);
 }
 
 namespace {
   // Helper function that handles both min and max operations
-  json::JSONValue helperMinMax(const std::vector<json::JSONValue> &args, const std::string &opName, double initialValue,
-                               const std::function<double(double, double)> &compareOp) {
+  // Arrays go through json::aggregate, which converts them to doubles a block at a time and vectorizes the
+  // comparisons (and splits really big ones across threads)
+  // Folds arg into result if everything in it is an integer, counting the values in count. Gives false on anything
+  // else (errors included, the double pass reports those) and result is meaningless then
+  bool foldIntegers(const EvalResult &arg, const json::Aggregate op, std::int64_t &result, size_t &count) {
+    std::optional<std::int64_t> folded;
+    if (const auto *range = arg.range()) {
+      bool integers = true;
+      range->forEach([&](const EvalResult &value) {
+        if (!integers)
+          return;
+        const auto *cursor = value.cursor();
+        const auto *integer = cursor == nullptr ? std::get_if<std::int64_t>(&value->value) : nullptr;
+        if (cursor != nullptr ? !cursor->is_integer() : integer == nullptr) {
+          integers = false;
+          return;
+        }
+        result = json::combine(op, result, cursor != nullptr ? cursor->as_integer() : *integer);
+        count++;
+      });
+      return integers;
+    }
+    if (const auto *cursor = arg.cursor()) {
+      if (cursor->is_integer()) {
+        folded = json::combine(op, result, cursor->as_integer());
+        count++;
+      } else if (cursor->is_array()) {
+        folded = json::aggregate_integers(*cursor, op, result);
+        count += cursor->size();
+      }
+    } else if (const auto *integer = std::get_if<std::int64_t>(&arg->value)) {
+      folded = json::combine(op, result, *integer);
+      count++;
+    } else if (const auto *arr = std::get_if<json::Array>(&arg->value)) {
+      folded = json::aggregate_integers(std::span<const json::JSONValue>(*arr), op, result);
+      count += arr->size();
+    } else if (const auto *integers = std::get_if<json::IntegerColumn>(&arg->value)) {
+      folded = json::aggregate_integers(std::span<const std::int64_t>(*integers), op, result);
+      count += integers->size();
+    }
+    if (!folded)
+      return false;
+    result = *folded;
+    return true;
+  }
+
+  json::JSONValue helperMinMax(const std::span<const EvalResult> args, const std::string &opName, double initialValue,
+                               const json::Aggregate op) {
     if (args.empty())
       throw std::runtime_error(opName + " requires at least one argument");
 
+    // Integers stay integers, past 2^53 a double would round them. This gives up at the first value that isn't
+    // one, then everything goes through the doubles below
+    std::int64_t integer = op == json::Aggregate::Min ? std::numeric_limits<std::int64_t>::max()
+                                                      : std::numeric_limits<std::int64_t>::min();
+    size_t count = 0;
+    if (std::ranges::all_of(args, [&](const EvalResult &arg) { return foldIntegers(arg, op, integer, count); }) &&
+        count > 0)
+      return json::JSONValue(integer);
+
     double result = initialValue;
     // can only do max on a double or an Array
     for (const auto &arg: args) {
-      if (auto *num = std::get_if<double>(&arg.value)) {
-        result = compareOp(result, *num);
-      } else if (auto *arr = std::get_if<std::vector<json::JSONValue>>(&arg.value)) {
-        if (arr->empty())
-          continue;
-
-        for (const auto &element: *arr) {
-          if (auto *arrNum = std::get_if<double>(&element.value)) {
-            result = compareOp(result, *arrNum);
-          } else {
+      std::optional<double> folded;
+      if (const auto *range = arg.range()) {
+        // Ranges are streamed, the values behave like the elements of the array they'd materialize to
+        json::Aggregator aggregator(op, result);
+        range->forEach([&](const EvalResult &value) {
+          const auto *cursor = value.cursor();
+          const auto number = cursor == nullptr    ? value->as_number()
+                              : cursor->is_number() ? std::optional(cursor->as_number())
+                                                    : std::nullopt;
+          if (!number)
             throw std::runtime_error("Array elements must be numbers for " + opName + " operation");
-          }
+          aggregator.add(*number);
+        });
+        folded = aggregator.result();
+      } else if (const auto *cursor = arg.cursor()) {
+        // Same rules on the tape, the array is walked in place
+        if (cursor->is_number()) {
+          folded = json::combine(op, result, cursor->as_number());
+        } else if (cursor->is_array()) {
+          folded = json::aggregate(*cursor, op, result);
+        } else {
+          throw std::runtime_error("Can't use " + opName + " on a non-double value");
         }
+      } else if (const auto num = arg->as_number()) {
+        folded = json::combine(op, result, *num);
+      } else if (auto *arr = std::get_if<json::Array>(&arg->value)) {
+        folded = json::aggregate(std::span<const json::JSONValue>(*arr), op, result);
+      } else if (auto *doubles = std::get_if<json::DoubleColumn>(&arg->value)) {
+        // Columns go straight to the kernels, nothing to convert or check
+        folded = json::aggregate(std::span<const double>(*doubles), op, result);
+      } else if (auto *integers = std::get_if<json::IntegerColumn>(&arg->value)) {
+        folded = json::aggregate(std::span<const std::int64_t>(*integers), op, result);
       } else {
         throw std::runtime_error("Can't use " + opName + " on a non-double value");
       }
+
+      if (!folded)
+        throw std::runtime_error("Array elements must be numbers for " + opName + " operation");
+      result = *folded;
     }
     return json::JSONValue(result);
   }
 } // anonymous namespace
 
-json::JSONValue Evaluator::evaluateMin(const std::vector<json::JSONValue> &args) {
-  return helperMinMax(args, "min", std::numeric_limits<double>::max(),
-                      [](double a, double b) { return std::min(a, b); });
+json::JSONValue Evaluator::evaluateMin(const std::span<const EvalResult> args) {
+  return helperMinMax(args, "min", std::numeric_limits<double>::max(), json::Aggregate::Min);
 }
 
-json::JSONValue Evaluator::evaluateMax(const std::vector<json::JSONValue> &args) {
-  return helperMinMax(args, "max", std::numeric_limits<double>::lowest(),
-                      [](double a, double b) { return std::max(a, b); });
+json::JSONValue Evaluator::evaluateMax(const std::span<const EvalResult> args) {
+  return helperMinMax(args, "max", std::numeric_limits<double>::lowest(), json::Aggregate::Max);
 }
 
-json::JSONValue Evaluator::evaluateSize(const std::vector<json::JSONValue> &args) {
+json::JSONValue Evaluator::evaluateSize(const std::span<const EvalResult> args) {
   if (args.size() != 1)
     throw std::runtime_error("size requires exactly one argument");
 
 
   // The following returns double because it's more convenient to line up with JSONValue
-  const auto &arg = args[0];
-  if (auto *arr = std::get_if<std::vector<json::JSONValue>>(&arg.value)) {
+  if (const auto *range = args[0].range()) {
+    size_t count = 0;
+    range->forEach([&count](const EvalResult &) { count++; });
+    return json::JSONValue(static_cast<double>(count));
+  }
+
+  if (const auto *cursor = args[0].cursor()) {
+    if (cursor->is_array() || cursor->is_object()) {
+      return json::JSONValue(static_cast<double>(cursor->size()));
+    }
+    if (cursor->is_string()) {
+      return json::JSONValue(static_cast<double>(cursor->as_string().size()));
+    }
+    throw std::runtime_error("size argument must be array, object, or string");
+  }
+
+  const auto &arg = args[0].get();
+  if (auto *arr = std::get_if<json::Array>(&arg.value)) {
     return json::JSONValue(static_cast<double>(arr->size()));
   }
 
-  if (auto *obj = std::get_if<std::map<std::string, json::JSONValue>>(&arg.value)) {
+  if (auto *obj = std::get_if<json::Object>(&arg.value)) {
     return json::JSONValue(static_cast<double>(obj->size()));
   }
 
-  if (auto *str = std::get_if<std::string>(&arg.value)) {
+  if (auto *doubles = std::get_if<json::DoubleColumn>(&arg.value)) {
+    return json::JSONValue(static_cast<double>(doubles->size()));
+  }
+
+  if (auto *integers = std::get_if<json::IntegerColumn>(&arg.value)) {
+    return json::JSONValue(static_cast<double>(integers->size()));
+  }
+
+  if (auto *str = std::get_if<json::String>(&arg.value)) {
     return json::JSONValue(static_cast<double>(str->size()));
   }
 
@@ -0,0 +1,66 @@
+#include "expr_batch.hpp"
+
+#include <algorithm>
+
+ExprBatch::ExprBatch(std::vector<std::unique_ptr<Expr>> expressions) : exprs(std::move(expressions)) {
+  for (const auto &expr: exprs)
+    collect(*expr);
+}
+
+void ExprBatch::collect(const Expr &expr) {
+  if (const auto *function = dynamic_cast<const FunctionExpr *>(&expr)) {
+    for (const auto &arg: function->arguments)
+      collect(*arg);
+    return;
+  }
+  const auto *path = dynamic_cast<const PathExpr *>(&expr);
+  if (path == nullptr)
+    return;
+
+  // Index expressions can hold paths of their own, those get merged as well
+  // Paths with ranges are left to the Evaluator, they don't end at a single node
+  bool literal = true;
+  for (const auto &segment: path->segments) {
+    if (std::holds_alternative<RangeSegment>(segment)) {
+      literal = false;
+    } else if (const auto *index = std::get_if<std::unique_ptr<Expr>>(&segment)) {
+      const auto *literal_index = dynamic_cast<const LiteralExpr *>(index->get());
+      if (literal_index == nullptr || !literal_index->value.as_number()) {
+        literal = false;
+        collect(**index);
+      }
+    }
+  }
+  if (!literal)
+    return;
+
+  Node *node = &root;
+  for (const auto &segment: path->segments) {
+    Child child;
+    if (const auto *key = std::get_if<std::string>(&segment)) {
+      child.segment = *key;
+    } else {
+      child.index = &static_cast<const LiteralExpr &>(*std::get<std::unique_ptr<Expr>>(segment)).value;
+      child.segment = *child.index->as_number();
+    }
+
+    auto it = std::find_if(node->children.begin(), node->children.end(),
+                           [&child](const Child &existing) { return existing.segment == child.segment; });
+    if (it == node->children.end()) {
+      child.node = std::make_unique<Node>();
+      node->children.push_back(std::move(child));
+      it = std::prev(node->children.end());
+    }
+    node = it->node.get();
+  }
+  const auto slot = path_slots.size();
+  path_slots.emplace(path, slot);
+  node->slots.push_back(slot);
+}
+
+std::optional<size_t> ExprBatch::slot(const PathExpr &path) const {
+  const auto it = path_slots.find(&path);
+  if (it == path_slots.end())
+    return std::nullopt;
+  return it->second;
+}
@@ -0,0 +1,52 @@
+#include "expr_cache.hpp"
+
+#include <algorithm>
+#include "expr_parser.hpp"
+
+ExprCache::ExprCache(const size_t capacity) : capacity(std::max<size_t>(capacity, 1)) {}
+
+std::shared_ptr<const ExprCache::Entry> ExprCache::get(const std::string_view expression) {
+  {
+    std::lock_guard lock(mutex);
+    if (const auto it = index.find(expression); it != index.end()) {
+      stats_.hits++;
+      items.splice(items.begin(), items, it->second);
+      return it->second->second;
+    }
+    stats_.misses++;
+  }
+
+  // Parse outside the lock so a slow expression doesn't hold up the hits
+  ExprParser parser;
+  auto expr = parser.parse(expression);
+  auto program = Program::compile(*expr);
+  auto entry = std::make_shared<const Entry>(Entry{std::move(expr), std::move(program)});
+
+  std::lock_guard lock(mutex);
+  // Someone else might have parsed the same one in the meantime, keep theirs
+  if (const auto it = index.find(expression); it != index.end()) {
+    items.splice(items.begin(), items, it->second);
+    return it->second->second;
+  }
+  items.emplace_front(std::string(expression), entry);
+  index.emplace(items.front().first, items.begin());
+  if (items.size() > capacity) {
+    index.erase(items.back().first);
+    items.pop_back();
+    stats_.evictions++;
+  }
+  return entry;
+}
+
+ExprCache::Stats ExprCache::stats() const {
+  std::lock_guard lock(mutex);
+  auto stats = stats_;
+  stats.size = items.size();
+  return stats;
+}
+
+void ExprCache::clear() {
+  std::lock_guard lock(mutex);
+  index.clear();
+  items.clear();
+}
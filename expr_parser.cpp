@@ -1,7 +1,9 @@
 #include "expr_parser.hpp"
 
 #include <cctype>
+#include <charconv>
 #include <stdexcept>
+#include "lex_func.hpp"
 
 bool ExprParser::isAtEnd() const { return current >= expr.length(); }
 
@@ -25,20 +27,26 @@ bool ExprParser::match(char expected) {
   return true;
 }
 
-std::string ExprParser::parseFunctionName() {
-  std::string name;
-  while (isalpha(peek())) {
-    name += advance();
+// Identifiers are taken straight out of the expression instead of being built up a character at a time
+std::string_view ExprParser::parseWord() {
+  const auto start = current;
+  while (isalnum(peek())) {
+    advance();
   }
-  return name;
+  return expr.substr(start, current - start);
 }
 
 std::unique_ptr<Expr> ExprParser::parseNumber() {
-  std::string num;
+  const auto start = current;
   while (isdigit(peek())) {
-    num += advance();
+    advance();
   }
-  return std::make_unique<LiteralExpr>(json::JSONValue(std::stod(num)));
+  // Digits only, so it's an integer unless it's too big for one
+  auto number = json::to_number(expr.substr(start, current - start));
+  if (!number) {
+    throw std::runtime_error("Number out of range");
+  }
+  return std::make_unique<LiteralExpr>(std::visit([](const auto n) { return json::JSONValue(n); }, *number));
 }
 
 std::vector<std::unique_ptr<Expr>> ExprParser::parseArguments() {
@@ -61,33 +69,102 @@ std::vector<std::unique_ptr<Expr>> ExprParser::parseArguments() {
   return args;
 }
 
+// Slice bounds, an optionally negative integer
+std::optional<std::int64_t> ExprParser::parseBound() {
+  const auto start = current;
+  match('-');
+  const auto digits = current;
+  while (isdigit(peek())) {
+    advance();
+  }
+  if (current == digits) {
+    current = start;
+    return std::nullopt;
+  }
+  std::int64_t bound = 0;
+  if (std::from_chars(expr.data() + start, expr.data() + current, bound).ec != std::errc()) {
+    throw std::runtime_error("Invalid slice bound");
+  }
+  return bound;
+}
+
+// [*] or [start:end:step], right after the '['. Anything else is an index, nothing is consumed then
+std::optional<RangeSegment> ExprParser::parseRange() {
+  const auto start = current;
+  if (match('*')) {
+    skipWhitespace();
+    if (!match(']')) {
+      throw std::runtime_error("Expected ']'");
+    }
+    return RangeSegment{};
+  }
+
+  // Only a slice when a ':' comes after the first bound, anything else (an index too big for a bound
+  // included) is left to parseExpr
+  match('-');
+  while (isdigit(peek())) {
+    advance();
+  }
+  skipWhitespace();
+  const bool slice = peek() == ':';
+  current = start;
+  if (!slice) {
+    return std::nullopt;
+  }
+
+  RangeSegment range;
+  range.start = parseBound();
+  skipWhitespace();
+  match(':');
+  skipWhitespace();
+  range.end = parseBound();
+  skipWhitespace();
+  if (match(':')) {
+    skipWhitespace();
+    if (const auto step = parseBound()) {
+      if (*step <= 0) {
+        throw std::runtime_error("Slice step must be positive");
+      }
+      range.step = *step;
+    }
+    skipWhitespace();
+  }
+  if (!match(']')) {
+    throw std::runtime_error("Expected ']'");
+  }
+  return range;
+}
+
 std::unique_ptr<Expr> ExprParser::parsePath() {
-  std::vector<std::variant<std::string, std::unique_ptr<Expr>>> segments;
+  std::vector<PathSegment> segments;
 
   // Parse first segment
-  std::string segment;
-  while (isalnum(peek())) {
-    segment += advance();
-  }
+  auto segment = parseWord();
   if (segment.empty()) {
     throw std::runtime_error("Expected path segment");
   }
-  segments.emplace_back(segment);
+  segments.emplace_back(std::string(segment));
 
   while (!isAtEnd()) {
     if (match('.')) {
-      // Parse dot notation
-      segment.clear();
-      while (isalnum(peek())) {
-        segment += advance();
+      // Every member
+      if (match('*')) {
+        segments.emplace_back(RangeSegment{RangeSegment::Kind::Members, std::nullopt, std::nullopt, 1});
+        continue;
       }
+      // Parse dot notation
+      segment = parseWord();
       if (segment.empty()) {
         throw std::runtime_error("Expected identifier after '.'");
       }
-      segments.emplace_back(segment);
+      segments.emplace_back(std::string(segment));
     } else if (match('[')) {
-      // Parse array index
       skipWhitespace();
+      if (auto range = parseRange()) {
+        segments.emplace_back(*range);
+        continue;
+      }
+      // Parse array index
       auto indexExpr = parseExpr(); // Use parseExpr directly
       skipWhitespace();
       if (!match(']')) {
@@ -107,14 +184,18 @@ std::unique_ptr<Expr> ExprParser::parseExpr() {
 
   // Parse function call
   if (isalpha(peek())) {
-    std::string name = parseFunctionName();
+    const auto start = current;
+    while (isalpha(peek())) {
+      advance();
+    }
     if (peek() == '(') {
+      const auto name = expr.substr(start, current - start);
       // The function below handles the '(' and ')'
       auto args = parseArguments();
-      return std::make_unique<FunctionExpr>(name, std::move(args));
+      return std::make_unique<FunctionExpr>(std::string(name), std::move(args));
     }
     // If not a function, treat as path
-    current -= name.length();
+    current = start;
     return parsePath();
   }
 
@@ -126,7 +207,7 @@ std::unique_ptr<Expr> ExprParser::parseExpr() {
   throw std::runtime_error("Unexpected character");
 }
 
-std::unique_ptr<Expr> ExprParser::parse(const std::string &expression) {
+std::unique_ptr<Expr> ExprParser::parse(const std::string_view expression) {
   expr = expression;
   current = 0;
   return parseExpr();
@@ -0,0 +1,81 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include "json.hpp"
+#include "tape.hpp"
+#include "thread_pool.hpp"
+
+namespace json {
+  enum class Aggregate { Min, Max };
+
+  // Arrays with at least this many elements get split across threads
+  inline constexpr size_t parallel_aggregate_size = 1 << 20;
+
+  // One step of min/max, std::min and std::max so the first argument wins ties and a NaN second argument
+  // is ignored
+  inline double combine(const Aggregate op, const double a, const double b) {
+    return op == Aggregate::Min ? std::min(a, b) : std::max(a, b);
+  }
+  inline std::int64_t combine(const Aggregate op, const std::int64_t a, const std::int64_t b) {
+    return op == Aggregate::Min ? std::min(a, b) : std::max(a, b);
+  }
+
+  // Folds the values into initial with combine. Vectorized on whatever active_simd_level() allows, the
+  // result is bit for bit what the plain loop gives (NaNs skipped, the first of 0.0 and -0.0 kept).
+  // Integers are converted to doubles first. Works on columns (see JSONValue) as they are
+  double aggregate(std::span<const double> values, Aggregate op, double initial);
+  double aggregate(std::span<const std::int64_t> values, Aggregate op, double initial);
+  // Same over array elements (integers are converted like as_number does), nullopt when one of them isn't
+  // a number
+  std::optional<double> aggregate(std::span<const JSONValue> elements, Aggregate op, double initial);
+
+  // The ones above split anything of at least 2 * parallel_aggregate_size values across a process wide pool,
+  // these take the pool and the smallest chunk to split into instead
+  double aggregate(std::span<const double> values, Aggregate op, double initial, ThreadPool &pool,
+                   size_t chunk_size);
+  double aggregate(std::span<const std::int64_t> values, Aggregate op, double initial, ThreadPool &pool,
+                   size_t chunk_size);
+  std::optional<double> aggregate(std::span<const JSONValue> elements, Aggregate op, double initial, ThreadPool &pool,
+                                  size_t chunk_size);
+  // Folds numbers in one at a time, for when they don't come as one array. They're buffered and go through the
+  // kernels a block at a time, so the result is still exactly what the plain loop gives
+  class Aggregator {
+  private:
+    Aggregate op;
+    double folded;
+    std::array<double, 512> block;
+    size_t filled = 0;
+
+    void flush();
+
+  public:
+    Aggregator(const Aggregate op, const double initial) : op(op), folded(initial) {}
+
+    void add(const double number) {
+      block[filled++] = number;
+      if (filled == block.size())
+        flush();
+    }
+
+    // Everything added so far folded into initial
+    [[nodiscard]] double result() {
+      flush();
+      return folded;
+    }
+  };
+
+  // Elements of an array on a tape, always single threaded since the elements can only be walked in order
+  std::optional<double> aggregate(TapeCursor array, Aggregate op, double initial);
+
+  // Exact versions for when everything is an integer, doubles can't tell integers past 2^53 apart. Same
+  // vectorizing and splitting as above, the ones on elements give nullopt when one of them isn't an integer
+  std::int64_t aggregate_integers(std::span<const std::int64_t> values, Aggregate op, std::int64_t initial);
+  std::int64_t aggregate_integers(std::span<const std::int64_t> values, Aggregate op, std::int64_t initial,
+                                  ThreadPool &pool, size_t chunk_size);
+  std::optional<std::int64_t> aggregate_integers(std::span<const JSONValue> elements, Aggregate op,
+                                                 std::int64_t initial);
+  std::optional<std::int64_t> aggregate_integers(TapeCursor array, Aggregate op, std::int64_t initial);
+} // namespace json
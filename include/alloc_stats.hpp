@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace json {
+  // Heap allocations made through operator new (so every std container, and arenas getting their blocks)
+  // Only executables that link alloc_hooks.cpp (json_eval and json_bench) replace operator new, everything else
+  // keeps the regular allocator and counts nothing. With the hooks in, counting is off by default. While it's on
+  // every allocation costs a couple of relaxed atomic adds, while it's off just the check. Counts are process
+  // wide, threads of a pool included
+  struct AllocStats {
+    uint64_t allocations = 0;
+    uint64_t deallocations = 0;
+    uint64_t bytes = 0; // requested sizes of the allocations
+
+    AllocStats operator-(const AllocStats &other) const {
+      return {allocations - other.allocations, deallocations - other.deallocations, bytes - other.bytes};
+    }
+  };
+
+  void set_alloc_counting(bool enabled);
+  [[nodiscard]] bool alloc_counting();
+  // Totals since the process started, only allocations made while counting was on are in them
+  [[nodiscard]] AllocStats alloc_stats();
+  // Whether the hooks are linked in, without them alloc_stats() stays at zero
+  [[nodiscard]] bool alloc_counting_available();
+
+  // What the hooks call, these only count while counting is on
+  void record_allocation(std::size_t bytes);
+  void record_deallocation();
+  // Called once by the hooks when the program starts
+  void set_alloc_counting_available();
+} // namespace json
@@ -0,0 +1,54 @@
+#pragma once
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+#include "json.hpp"
+
+namespace json {
+  class ThreadPool;
+
+  // Owns a parsed JSON tree together with the arena every node of it was allocated from
+  // Nodes are never destroyed one by one, dropping the Document releases the whole arena at once
+  // which is why the tree is only handed out as const (anything added later wouldn't come from the arena)
+  class Document {
+  private:
+    // Between the arena and the heap, keeps track of how much the arena took
+    class CountingResource : public std::pmr::memory_resource {
+    public:
+      size_t allocated = 0;
+
+    private:
+      void *do_allocate(size_t bytes, size_t alignment) override;
+      void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+      [[nodiscard]] bool do_is_equal(const memory_resource &other) const noexcept override { return this == &other; }
+    };
+
+    // Kept together so the counter always outlives the arena, moves included
+    struct Arena {
+      CountingResource upstream;
+      std::pmr::monotonic_buffer_resource resource;
+
+      explicit Arena(size_t initial_size) : resource(initial_size, &upstream) {}
+    };
+
+    std::unique_ptr<Arena> arena;
+    // One per chunk of a parallel parse, the elements stay where their chunk was parsed
+    std::vector<std::unique_ptr<Arena>> chunk_arenas;
+    const JSONValue *root_ = nullptr;
+
+  public:
+    Document();
+
+    // Parses the source into a fresh arena, the source itself isn't referenced afterwards
+    static std::tuple<Document, std::string> parse(std::string_view source);
+    // Same result, but a big top level array is parsed on the pool (see parse_parallel)
+    static std::tuple<Document, std::string> parse(std::string_view source, ThreadPool &pool);
+
+    [[nodiscard]] const JSONValue &root() const;
+    // Bytes the arena got from the heap. Nothing is given back before the Document goes, so this is also the peak
+    [[nodiscard]] size_t memory_used() const;
+  };
+} // namespace json
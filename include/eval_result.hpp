@@ -0,0 +1,96 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <variant>
+#include <vector>
+#include "json.hpp"
+#include "tape.hpp"
+#include "writer.hpp"
+
+class EvalResult;
+
+// What a path with [*], slice or .* segments evaluates to (see RangeSegment). Nothing gets collected, the
+// values are walked in the document every time forEach runs, so an aggregate over them never builds an array
+class ValueRange {
+public:
+  virtual ~ValueRange() = default;
+  // In document order (key order for .*), throws the same errors walking a single path would
+  virtual void forEach(const std::function<void(const EvalResult &)> &f) const = 0;
+};
+
+// Result of evaluating an expression
+// Paths resolve to a borrowed pointer into the document (or into the AST for literals), or to a cursor
+// when the document is a tape. Only values produced by functions (min, max, size) own their storage.
+// Paths with ranges in them resolve to a ValueRange, which the Evaluator turns into an array unless a function
+// consumes it
+class EvalResult {
+private:
+  std::variant<const json::JSONValue *, json::TapeCursor, json::JSONValue, std::shared_ptr<const ValueRange>> storage;
+
+  explicit EvalResult(const json::JSONValue *borrowed) : storage(borrowed) {}
+  explicit EvalResult(json::TapeCursor cursor) : storage(cursor) {}
+  explicit EvalResult(json::JSONValue &&owned) : storage(std::move(owned)) {}
+  explicit EvalResult(std::shared_ptr<const ValueRange> values) : storage(std::move(values)) {}
+
+public:
+  // The referenced value (or tape) must outlive the result (ie the document root or the AST)
+  static EvalResult borrow(const json::JSONValue &value) { return EvalResult(&value); }
+  static EvalResult borrow(json::TapeCursor cursor) { return EvalResult(cursor); }
+  static EvalResult own(json::JSONValue value) { return EvalResult(std::move(value)); }
+  // Borrows from the document like a path does
+  static EvalResult ofRange(std::shared_ptr<const ValueRange> values) { return EvalResult(std::move(values)); }
+
+  [[nodiscard]] bool isBorrowed() const { return !std::holds_alternative<json::JSONValue>(storage); }
+
+  // Cursor into the tape, nullptr when the result is a DOM value
+  [[nodiscard]] const json::TapeCursor *cursor() const { return std::get_if<json::TapeCursor>(&storage); }
+
+  // The values of a range, nullptr for a single value
+  [[nodiscard]] const ValueRange *range() const {
+    const auto *values = std::get_if<std::shared_ptr<const ValueRange>>(&storage);
+    return values == nullptr ? nullptr : values->get();
+  }
+
+  // Only valid when there is no cursor() or range(), those have to be materialized first
+  [[nodiscard]] const json::JSONValue &get() const {
+    if (const auto *borrowed = std::get_if<const json::JSONValue *>(&storage))
+      return **borrowed;
+    return std::get<json::JSONValue>(storage);
+  }
+
+  const json::JSONValue &operator*() const { return get(); }
+  const json::JSONValue *operator->() const { return &get(); }
+
+  // Produces an independent value, this is the only place a borrowed value gets copied
+  // A range becomes an array of its values
+  [[nodiscard]] json::JSONValue materialize() && {
+    if (const auto *borrowed = std::get_if<const json::JSONValue *>(&storage))
+      return **borrowed;
+    if (const auto *tape_cursor = cursor())
+      return tape_cursor->materialize();
+    if (const auto *values = range()) {
+      std::vector<json::JSONValue> elements;
+      values->forEach([&elements](const EvalResult &value) { elements.push_back(EvalResult(value).materialize()); });
+      return json::make_array(elements, std::pmr::get_default_resource());
+    }
+    return std::move(std::get<json::JSONValue>(storage));
+  }
+
+  [[nodiscard]] std::string deparse() const {
+    if (const auto *tape_cursor = cursor())
+      return json::deparse(*tape_cursor);
+    if (range() != nullptr)
+      return json::deparse(EvalResult(*this).materialize());
+    return json::deparse(get());
+  }
+
+  void write(json::Writer &writer) const {
+    if (const auto *tape_cursor = cursor())
+      writer.write(*tape_cursor);
+    else if (range() != nullptr)
+      writer.write(EvalResult(*this).materialize());
+    else
+      writer.write(get());
+  }
+};
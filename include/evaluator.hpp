@@ -1,22 +1,59 @@
 #pragma once
 
+#include <optional>
+#include <span>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "eval_result.hpp"
 #include "expr.hpp"
+#include "expr_batch.hpp"
 #include "expr_visitor.hpp"
 #include "json.hpp"
+#include "ondemand.hpp"
+#include "program.hpp"
+#include "tape.hpp"
 
 class Evaluator : public ExprVisitor {
 private:
-  const json::JSONValue &root;
-  [[nodiscard]] json::JSONValue
-  resolvePath(const std::vector<std::variant<std::string, std::unique_ptr<Expr>>> &segments) const;
-  static json::JSONValue evaluateMin(const std::vector<json::JSONValue> &args);
-  static json::JSONValue evaluateMax(const std::vector<json::JSONValue> &args);
-  static json::JSONValue evaluateSize(const std::vector<json::JSONValue> &args);
+  // The document is a regular DOM, a tape or unparsed source, paths are resolved the same way on all of them
+  std::variant<const json::JSONValue *, json::TapeCursor, json::RawValue> root;
+  template<typename Node>
+  [[nodiscard]] Node walkPath(Node current, std::span<const PathSegment> segments) const;
+  [[nodiscard]] EvalResult resolvePath(const std::vector<PathSegment> &segments) const;
+  template<typename Node>
+  [[nodiscard]] EvalResult resolveRange(Node current, const std::vector<PathSegment> &segments,
+                                        size_t first_range) const;
+  template<typename Node>
+  void resolveTrie(Node current, const ExprBatch::Node &node,
+                   std::vector<std::tuple<std::optional<EvalResult>, std::string>> &resolved) const;
+  template<typename Node>
+  [[nodiscard]] EvalResult run(Node root_node, const Program &program) const;
+  static json::JSONValue evaluateMin(std::span<const EvalResult> args);
+  static json::JSONValue evaluateMax(std::span<const EvalResult> args);
+  static json::JSONValue evaluateSize(std::span<const EvalResult> args);
 
 public:
   explicit Evaluator(const json::JSONValue &root);
+  // The tape has to outlive the evaluator and every result it hands out
+  explicit Evaluator(const json::Tape &tape);
+  // Parses only the values the expressions end up at, see OnDemandDocument
+  // Running several expressions through the same evaluator reuses what the earlier ones scanned
+  explicit Evaluator(const json::OnDemandDocument &document);
+  // Materializes the result into an independent value
   [[nodiscard]] json::JSONValue evaluate(const std::unique_ptr<Expr> &expr) const;
-  [[nodiscard]] json::JSONValue visitLiteral(const LiteralExpr &expr) const override;
-  [[nodiscard]] json::JSONValue visitPath(const PathExpr &expr) const override;
-  [[nodiscard]] json::JSONValue visitFunction(const FunctionExpr &expr) const override;
+  // Result may borrow from the root and the expression, both have to outlive it
+  [[nodiscard]] EvalResult evaluateRef(const std::unique_ptr<Expr> &expr) const;
+  // Same results and errors as evaluating the expression the program was compiled from
+  // Results may borrow from the root and the program
+  [[nodiscard]] json::JSONValue evaluate(const Program &program) const;
+  [[nodiscard]] EvalResult evaluateRef(const Program &program) const;
+  // Evaluates every expression in the batch in one go, each shared path prefix is only resolved once
+  // A failing expression doesn't stop the others, its error comes back in its place instead
+  // Results may borrow like evaluateRef, from the root and the batch
+  [[nodiscard]] std::vector<std::tuple<std::optional<EvalResult>, std::string>>
+  evaluateAll(const ExprBatch &batch) const;
+  [[nodiscard]] EvalResult visitLiteral(const LiteralExpr &expr) const override;
+  [[nodiscard]] EvalResult visitPath(const PathExpr &expr) const override;
+  [[nodiscard]] EvalResult visitFunction(const FunctionExpr &expr) const override;
 };
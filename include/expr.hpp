@@ -1,26 +1,48 @@
 #pragma once
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <variant>
+#include <vector>
+#include "eval_result.hpp"
 #include "json.hpp"
 class ExprVisitor;
 
 // Base Expr Class
 struct Expr {
   virtual ~Expr() = default;
-  [[nodiscard]] virtual json::JSONValue accept(const ExprVisitor &visitor) const = 0;
+  [[nodiscard]] virtual EvalResult accept(const ExprVisitor &visitor) const = 0;
 };
 
 // Literal value (numbers, strings, etc.)
 struct LiteralExpr : Expr {
   json::JSONValue value;
   explicit LiteralExpr(json::JSONValue v);
-  [[nodiscard]] json::JSONValue accept(const ExprVisitor &visitor) const override;
+  [[nodiscard]] EvalResult accept(const ExprVisitor &visitor) const override;
 };
 
+// Segments that pick out several values instead of one: [*] and [start:end:step] over the elements of an
+// array, .* over the members of an object (in key order, the order Object keeps them in). The rest of the
+// path is applied to each of them, see ValueRange
+struct RangeSegment {
+  enum class Kind { Elements, Members };
+  Kind kind = Kind::Elements;
+  // Python style, negative bounds count from the end and missing ones mean the whole array
+  std::optional<std::int64_t> start;
+  std::optional<std::int64_t> end;
+  std::int64_t step = 1; // always positive
+};
+
+// A key, an index expression, or a range
+using PathSegment = std::variant<std::string, std::unique_ptr<Expr>, RangeSegment>;
+
 // Path expression (a.b[1])
 // "a", "b", "Expr(1)"
 struct PathExpr : Expr {
-  std::vector<std::variant<std::string, std::unique_ptr<Expr>>> segments;
-  explicit PathExpr(std::vector<std::variant<std::string, std::unique_ptr<Expr>>> segs);
-  [[nodiscard]] json::JSONValue accept(const ExprVisitor &visitor) const override;
+  std::vector<PathSegment> segments;
+  explicit PathExpr(std::vector<PathSegment> segs);
+  [[nodiscard]] EvalResult accept(const ExprVisitor &visitor) const override;
 };
 
 // Function call expression - intrinsic functions (min, max, size)
@@ -28,5 +50,5 @@ struct FunctionExpr : Expr {
   std::string name;
   std::vector<std::unique_ptr<Expr>> arguments;
   explicit FunctionExpr(std::string n, std::vector<std::unique_ptr<Expr>> args);
-  [[nodiscard]] json::JSONValue accept(const ExprVisitor &visitor) const override;
+  [[nodiscard]] EvalResult accept(const ExprVisitor &visitor) const override;
 };
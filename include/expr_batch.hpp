@@ -0,0 +1,44 @@
+#pragma once
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+#include "expr.hpp"
+
+// A set of expressions evaluated together against the same document
+// The paths in them (nested ones included) are merged into a trie on the way in, so a prefix that several
+// paths share (a.b in a.b.c and a.b[0]) is resolved once per document instead of once per path
+class ExprBatch {
+public:
+  struct Node;
+  // Index segments are only merged when they are number literals, anything else depends on the document
+  struct Child {
+    std::variant<std::string, double> segment;
+    // The literal to index with, nullptr for keys
+    const json::JSONValue *index = nullptr;
+    std::unique_ptr<Node> node;
+  };
+  struct Node {
+    std::vector<Child> children;
+    // Slots of the paths that end here
+    std::vector<size_t> slots;
+  };
+
+private:
+  std::vector<std::unique_ptr<Expr>> exprs;
+  Node root;
+  std::unordered_map<const PathExpr *, size_t> path_slots;
+
+  void collect(const Expr &expr);
+
+public:
+  explicit ExprBatch(std::vector<std::unique_ptr<Expr>> expressions);
+
+  [[nodiscard]] const std::vector<std::unique_ptr<Expr>> &expressions() const { return exprs; }
+  [[nodiscard]] const Node &trie() const { return root; }
+  // Paths that are in the trie have a slot for their resolved value, the others are walked on their own
+  [[nodiscard]] std::optional<size_t> slot(const PathExpr &path) const;
+  [[nodiscard]] size_t slots() const { return path_slots.size(); }
+};
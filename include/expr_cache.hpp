@@ -0,0 +1,47 @@
+#pragma once
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "expr.hpp"
+#include "program.hpp"
+
+// Bounded cache of parsed and compiled expressions keyed by the expression text, least recently used
+// entries get evicted first. Safe to share between threads
+class ExprCache {
+public:
+  struct Entry {
+    std::unique_ptr<Expr> expr;
+    Program program;
+  };
+
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t size = 0;
+  };
+
+private:
+  using Item = std::pair<std::string, std::shared_ptr<const Entry>>;
+
+  size_t capacity;
+  mutable std::mutex mutex;
+  // Most recently used at the front, the index views point at the keys in here
+  std::list<Item> items;
+  std::unordered_map<std::string_view, std::list<Item>::iterator> index;
+  Stats stats_;
+
+public:
+  explicit ExprCache(size_t capacity = 1024);
+
+  // Parses and compiles the expression the first time it's seen, throws what ExprParser throws
+  // Failed expressions aren't cached. An evicted entry stays valid for as long as someone holds on to it
+  [[nodiscard]] std::shared_ptr<const Entry> get(std::string_view expression);
+
+  [[nodiscard]] Stats stats() const;
+  void clear();
+};
@@ -1,12 +1,16 @@
 #pragma once
+#include <cstdint>
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 #include "expr.hpp"
 
 class ExprParser {
 private:
-  std::string expr;
+  // Only valid during parse(), nothing is kept after that
+  std::string_view expr;
   size_t current = 0;
 
   [[nodiscard]] bool isAtEnd() const;
@@ -14,13 +18,15 @@ private:
   char advance();
   void skipWhitespace();
   bool match(char expected);
-  std::string parseFunctionName();
+  std::string_view parseWord();
   std::unique_ptr<Expr> parseNumber();
   std::vector<std::unique_ptr<Expr>> parseArguments();
+  std::optional<std::int64_t> parseBound();
+  std::optional<RangeSegment> parseRange();
   std::unique_ptr<Expr> parsePath();
   std::unique_ptr<Expr> parseExpr();
 
 public:
   ExprParser() = default;
-  std::unique_ptr<Expr> parse(const std::string &expression);
+  std::unique_ptr<Expr> parse(std::string_view expression);
 };
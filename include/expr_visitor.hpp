@@ -1,5 +1,6 @@
 #pragma once
 
+#include "eval_result.hpp"
 #include "json.hpp"
 
 // Forward declarations
@@ -10,7 +11,7 @@ struct FunctionExpr;
 class ExprVisitor {
 public:
   virtual ~ExprVisitor() = default;
-  [[nodiscard]] virtual json::JSONValue visitLiteral(const LiteralExpr &expr) const = 0;
-  [[nodiscard]] virtual json::JSONValue visitPath(const PathExpr &expr) const = 0;
-  [[nodiscard]] virtual json::JSONValue visitFunction(const FunctionExpr &expr) const = 0;
+  [[nodiscard]] virtual EvalResult visitLiteral(const LiteralExpr &expr) const = 0;
+  [[nodiscard]] virtual EvalResult visitPath(const PathExpr &expr) const = 0;
+  [[nodiscard]] virtual EvalResult visitFunction(const FunctionExpr &expr) const = 0;
 };
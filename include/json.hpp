@@ -1,27 +1,103 @@
 #pragma once
 
+#include <cstdint>
 #include <map>
 #include <memory>
+#include <memory_resource>
+#include <optional>
+#include <span>
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <variant>
 #include <vector>
 
 namespace json {
+  // Byte offsets into a source (and token indices), 64 bit so documents over 2 GB work
+  using Offset = std::int64_t;
+
   enum class JSONTokenType { String, Number, Syntax, Boolean, Null };
 
   struct JSONToken {
     std::string value;
     JSONTokenType type;
-    int location;
+    Offset location;
     std::string_view full_source;
   };
 
+  struct JSONValue;
+  struct ObjectMember;
+  class KeyTable;
+
+  // The containers are allocator aware so a Document can put the whole tree in one arena
+  // Copies always go back to the default resource (the heap), so a copy can outlive the Document it came from
+  using String = std::pmr::string;
+  using Array = std::pmr::vector<JSONValue>;
+  // Arrays that are all doubles or all integers are stored packed like this instead, see make_array
+  using DoubleColumn = std::pmr::vector<double>;
+  using IntegerColumn = std::pmr::vector<std::int64_t>;
+
+  // Shorter homogeneous arrays stay Arrays, there's not much to save on them
+  inline constexpr size_t min_column_size = 16;
+
+  // Object members stored flat and sorted by key, so lookups are a short scan or a binary search over
+  // contiguous memory instead of chasing tree nodes. Members only hold a string_view of their key.
+  //
+  // Objects parsed into a Document (or any other arena) have their keys interned in its KeyTable, so a key
+  // repeated across millions of objects is stored once. Everything else, copies included, keeps its keys in one
+  // block of its own that's freed with the object. Copies of such an object share the block, it's never changed
+  // once made, so like everything else they can outlive whatever they were copied from.
+  class Object {
+  public:
+    using allocator_type = std::pmr::polymorphic_allocator<ObjectMember>;
+    using const_iterator = const ObjectMember *;
+
+  private:
+    struct OwnedKeys;
+
+    std::pmr::vector<ObjectMember> members;
+    OwnedKeys *owned_keys = nullptr; // nullptr when the keys are in a KeyTable (or there are none)
+
+    // Copies the keys of every member into a new block, for when the current ones can't be relied on
+    void own_keys();
+    void release_keys();
+
+  public:
+    Object();
+    explicit Object(allocator_type allocator);
+    // Takes members in any order, with keys interned in keys. For nullptr the keys only have to stay valid for the
+    // call, the object copies them. Sorts the members and drops duplicate keys, the last one wins like it would
+    // for repeated assignment
+    Object(std::pmr::vector<ObjectMember> &&unsorted, const KeyTable *keys);
+    Object(const Object &other);
+    Object(Object &&other) noexcept;
+    Object &operator=(const Object &other);
+    Object &operator=(Object &&other);
+    ~Object();
+
+    [[nodiscard]] const_iterator find(std::string_view key) const;
+    [[nodiscard]] const JSONValue &at(std::string_view key) const;
+    [[nodiscard]] bool contains(std::string_view key) const;
+    void insert_or_assign(std::string_view key, JSONValue value);
+
+    [[nodiscard]] const_iterator begin() const;
+    [[nodiscard]] const_iterator end() const;
+    [[nodiscard]] size_t size() const;
+    [[nodiscard]] bool empty() const;
+    [[nodiscard]] allocator_type get_allocator() const;
+    // Whether the keys are in a block of the object's own rather than a KeyTable
+    [[nodiscard]] bool owns_keys() const { return owned_keys != nullptr; }
+  };
+
   struct JSONValue {
     using variant_type = std::variant<std::monostate, // represents null
-                                      std::string, double, bool,
-                                      std::vector<JSONValue>, // array value
-                                      std::map<std::string, JSONValue>>;
+                                      String, double,
+                                      std::int64_t, // integers that fit, kept exact
+                                      bool,
+                                      Array, // array value
+                                      Object,
+                                      DoubleColumn, IntegerColumn // arrays too, packed
+                                      >;
 
     variant_type value;
 
@@ -29,27 +105,61 @@ namespace json {
 
     // Explicit constructors for each type, can't just do std::forward unfortunately
     // get some compile time errors unfortunately
-    explicit JSONValue(const std::string &v) : value(v) {}
-    explicit JSONValue(std::string &&v) : value(std::move(v)) {}
-    explicit JSONValue(const char *v) : value(std::string(v)) {}
+    explicit JSONValue(std::string_view v) : value(String(v)) {}
+    explicit JSONValue(const std::string &v) : value(String(v)) {}
+    explicit JSONValue(const char *v) : value(String(v)) {}
+    explicit JSONValue(const String &v) : value(v) {}
+    explicit JSONValue(String &&v) : value(std::move(v)) {}
     explicit JSONValue(double v) : value(v) {}
+    explicit JSONValue(std::int64_t v) : value(v) {}
     explicit JSONValue(bool v) : value(v) {}
-    explicit JSONValue(const std::vector<JSONValue> &v) : value(v) {}
-    explicit JSONValue(std::vector<JSONValue> &&v) : value(std::move(v)) {}
-    explicit JSONValue(const std::map<std::string, JSONValue> &v) : value(v) {}
-    explicit JSONValue(std::map<std::string, JSONValue> &&v) : value(std::move(v)) {}
+    explicit JSONValue(const Array &v) : value(v) {}
+    explicit JSONValue(Array &&v) : value(std::move(v)) {}
+    explicit JSONValue(const Object &v) : value(v) {}
+    explicit JSONValue(Object &&v) : value(std::move(v)) {}
+    explicit JSONValue(const DoubleColumn &v) : value(v) {}
+    explicit JSONValue(DoubleColumn &&v) : value(std::move(v)) {}
+    explicit JSONValue(const IntegerColumn &v) : value(v) {}
+    explicit JSONValue(IntegerColumn &&v) : value(std::move(v)) {}
+
+    // Any of the three array representations
+    [[nodiscard]] bool is_array() const {
+      return std::holds_alternative<Array>(value) || std::holds_alternative<DoubleColumn>(value) ||
+             std::holds_alternative<IntegerColumn>(value);
+    }
+
+    // Either kind of number as a double, nullopt for anything else
+    [[nodiscard]] std::optional<double> as_number() const {
+      if (const auto *d = std::get_if<double>(&value))
+        return *d;
+      if (const auto *i = std::get_if<std::int64_t>(&value))
+        return static_cast<double>(*i);
+      return std::nullopt;
+    }
+  };
+
+  struct ObjectMember {
+    std::string_view key; // interned, see Object
+    JSONValue value;
   };
 
+  // The array elements end up in, moved out of elements and allocated from resource. A DoubleColumn when they're
+  // all doubles, an IntegerColumn when they're all integers (at least min_column_size of them either way),
+  // otherwise an Array. Mixed integers and doubles stay an Array so every number keeps its type
+  JSONValue make_array(std::span<JSONValue> elements, std::pmr::memory_resource *resource);
+
   std::tuple<std::vector<JSONToken>, std::string> lex(std::string_view);
-  std::tuple<JSONValue, int, std::string> parse(const std::vector<JSONToken> &, int index = 0);
+  std::tuple<JSONValue, Offset, std::string> parse(const std::vector<JSONToken> &, Offset index = 0);
 
-  // Does both the lexing and parsing. Highest level function
+  // Does both the lexing and parsing in a single pass (see JSONParser). Highest level function
   std::tuple<JSONValue, std::string> parse(std::string_view);
 
-  // this deparse method could potentially be done through std::visit
-  // worth considering
-  std::string deparse(const JSONValue &, std::string whitespace = "");
+  // Compact text of the value, see Writer (writer.hpp) for pretty printing or writing it out as it goes
+  std::string deparse(const JSONValue &);
 
-  std::string format_error_json(std::string_view base, std::string_view source, int error_index);
-  std::string format_parse_error(std::string_view base, const JSONToken& token);
+  // first_line and first_column are where source starts in the whole input, for when source is only a piece of it
+  std::string format_error_json(std::string_view base, std::string_view source, Offset error_index,
+                                Offset first_line = 1, Offset first_column = 0);
+  std::string format_parse_error(std::string_view base, const JSONToken& token, Offset first_line = 1,
+                                 Offset first_column = 0);
 } // namespace json
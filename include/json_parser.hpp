@@ -0,0 +1,330 @@
+#pragma once
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+#include "json.hpp"
+#include "key_table.hpp"
+#include "lex_func.hpp"
+#include "simd_scan.hpp"
+
+namespace json {
+  // Lexes the token at index so errors read the same as the token based parser
+  std::string error_at_token(std::string_view base, std::string_view source, Offset index,
+                             Offset first_line = 1, Offset first_column = 0);
+
+  // Position tracking, scalar decoding and error reporting shared by every parser that reads straight
+  // from the source. A JSONToken is only lexed when we need one for an error message
+  class ParserBase {
+  protected:
+    std::string_view source;
+    Offset index = 0;
+    StructuralScanner scanner;
+    // Strings that contain escapes are decoded here, reused across the whole parse
+    std::string string_buffer;
+
+    explicit ParserBase(std::string_view source);
+
+    // Moves to start, which has to be a token start
+    void reset(Offset start = 0);
+    [[nodiscard]] bool at_end() const;
+    void skip_whitespace();
+    // Views straight into the source when the string has no escapes, into string_buffer otherwise,
+    // so it's only valid until the next call
+    std::tuple<std::string_view, std::string> parse_string();
+    std::tuple<Number, std::string> parse_number();
+    bool match_keyword(std::string_view keyword);
+
+    // Error for the token at the current position
+    [[nodiscard]] std::string error_at_token(std::string_view base) const;
+    [[nodiscard]] std::string error_at_eof(std::string_view base) const;
+  };
+
+  // Recursive descent parser that reads straight from the source and reports every value to a Builder
+  // as it goes, there's no intermediate token vector. A Builder provides
+  //   null(), boolean(bool), number(double), integer(std::int64_t), string(std::string_view), key(std::string_view),
+  //   start_array(), end_array(size_t count), start_object(), end_object(size_t count)
+  // Views passed to the builder are only valid during the call
+  template<typename Builder>
+  class BasicParser : protected ParserBase {
+  private:
+    Builder &builder;
+
+    std::string parse_value();
+    std::string parse_array();
+    std::string parse_object();
+
+  public:
+    BasicParser(std::string_view source, Builder &builder) : ParserBase(source), builder(builder) {}
+
+    // Returns the error, empty if the whole source was one valid value
+    std::string parse();
+    // Parses the one value starting at start, whatever comes after it is never looked at
+    std::string parse_value_at(Offset start);
+    // Parses a run of array elements from start, separated by commas, that has to end right before the
+    // ',' or ']' at end. They're reported as one array. Used to parse a piece of a bigger array on its own
+    // (see parse_parallel), the errors don't have to match parse() since the caller falls back to it
+    std::string parse_elements(Offset start, Offset end);
+  };
+
+  // Builder that makes a JSONValue, bottom up on two stacks. A container is only created once all of its
+  // children are done, so arrays and objects get allocated exactly once at their final size
+  class DomBuilder {
+  private:
+    std::pmr::memory_resource *resource;
+    KeyTable *keys;
+    // Holds the keys until their object copies them, only used when keys is nullptr
+    std::pmr::monotonic_buffer_resource key_arena;
+    KeyTable key_cache{&key_arena};
+    std::vector<JSONValue> values;
+    std::vector<std::string_view> pending_keys;
+
+    std::string_view intern(std::string_view key);
+
+  public:
+    // Values are allocated from resource, object keys are interned in keys (for nullptr every object keeps its own)
+    explicit DomBuilder(std::pmr::memory_resource *resource = std::pmr::get_default_resource(),
+                        KeyTable *keys = nullptr);
+
+    void null() { values.emplace_back(); }
+    void boolean(const bool b) { values.emplace_back(b); }
+    void number(const double n) { values.emplace_back(n); }
+    void integer(const std::int64_t n) { values.emplace_back(n); }
+    void string(std::string_view str);
+    void key(const std::string_view key) { pending_keys.push_back(intern(key)); }
+    void start_array() {}
+    void end_array(size_t count);
+    void start_object() {}
+    void end_object(size_t count);
+
+    // Takes the last finished value
+    JSONValue result();
+  };
+
+  // Builds a JSONValue in one pass, see BasicParser
+  class JSONParser {
+  private:
+    std::string_view source;
+    // Every string, array and object of the result is allocated from here
+    std::pmr::memory_resource *resource;
+    // Object keys are interned here, for nullptr every object keeps its own
+    KeyTable *keys;
+
+  public:
+    // Object keys are interned in keys, which has to outlive the result (for nullptr they're owned by the objects)
+    explicit JSONParser(std::string_view source,
+                        std::pmr::memory_resource *resource = std::pmr::get_default_resource(),
+                        KeyTable *keys = nullptr);
+    std::tuple<JSONValue, std::string> parse();
+    // Only builds the value starting at index, error locations are still relative to the whole source
+    std::tuple<JSONValue, std::string> parse_value_at(Offset index);
+  };
+
+  template<typename Builder>
+  std::string BasicParser<Builder>::parse() {
+    reset();
+    skip_whitespace();
+    if (at_end()) {
+      return error_at_eof("Unexpected EOF");
+    }
+
+    if (auto error = parse_value(); !error.empty()) {
+      return error;
+    }
+
+    // Only whitespace is allowed after the root value
+    skip_whitespace();
+    if (!at_end()) {
+      return error_at_token("Unexpected trailing token");
+    }
+    return "";
+  }
+
+  template<typename Builder>
+  std::string BasicParser<Builder>::parse_value_at(const Offset start) {
+    reset(start);
+    if (at_end()) {
+      return error_at_eof("Unexpected EOF");
+    }
+    return parse_value();
+  }
+
+  template<typename Builder>
+  std::string BasicParser<Builder>::parse_elements(const Offset start, const Offset end) {
+    reset(start);
+    builder.start_array();
+
+    size_t count = 0;
+    while (true) {
+      skip_whitespace();
+      if (at_end()) {
+        return error_at_eof("Unexpected EOF while parsing array");
+      }
+      if (auto error = parse_value(); !error.empty()) {
+        return error;
+      }
+      count++;
+
+      skip_whitespace();
+      if (index == end) {
+        break;
+      }
+      if (index > end || source[index] != ',') {
+        return error_at_token("Expected comma after element in array");
+      }
+      index++; // move past ','
+    }
+
+    builder.end_array(count);
+    return "";
+  }
+
+  template<typename Builder>
+  std::string BasicParser<Builder>::parse_value() {
+    switch (source[index]) {
+      case '[':
+        return parse_array();
+      case '{':
+        return parse_object();
+      case '"': {
+        auto [str, error] = parse_string();
+        if (error.empty())
+          builder.string(str);
+        return error;
+      }
+      case 't':
+        if (!match_keyword("true"))
+          return error_at_token("Failed to parse");
+        builder.boolean(true);
+        return "";
+      case 'f':
+        if (!match_keyword("false"))
+          return error_at_token("Failed to parse");
+        builder.boolean(false);
+        return "";
+      case 'n':
+        if (!match_keyword("null"))
+          return error_at_token("Failed to parse");
+        builder.null();
+        return "";
+      default:
+        break;
+    }
+
+    auto [number, error] = parse_number();
+    if (error.empty()) {
+      if (const auto *integer = std::get_if<std::int64_t>(&number))
+        builder.integer(*integer);
+      else
+        builder.number(std::get<double>(number));
+    }
+    return error;
+  }
+
+  // Same rules (and messages) as parse_array in parse_func.cpp, minus the tokens
+  template<typename Builder>
+  std::string BasicParser<Builder>::parse_array() {
+    index++; // move past '['
+    builder.start_array();
+
+    size_t count = 0;
+    skip_whitespace();
+    if (!at_end() && source[index] == ']') {
+      index++;
+      builder.end_array(count);
+      return "";
+    }
+
+    while (!at_end()) {
+      if (auto error = parse_value(); !error.empty()) {
+        return error;
+      }
+      count++;
+
+      skip_whitespace();
+      if (at_end()) {
+        break;
+      }
+
+      const auto c = source[index];
+      if (c == ']') {
+        index++;
+        builder.end_array(count);
+        return "";
+      }
+      if (c != ',') {
+        return error_at_token("Expected comma after element in array");
+      }
+      index++; // move past ','
+      skip_whitespace();
+    }
+
+    return error_at_eof("Unexpected EOF while parsing array");
+  }
+
+  template<typename Builder>
+  std::string BasicParser<Builder>::parse_object() {
+    index++; // move past '{'
+    builder.start_object();
+
+    size_t count = 0;
+    skip_whitespace();
+    if (!at_end() && source[index] == '}') {
+      index++;
+      builder.end_object(count);
+      return "";
+    }
+
+    while (!at_end()) {
+      // Parse the object key, which has to be a string
+      if (source[index] != '"') {
+        return error_at_token(count == 0 ? "Expected key-value pair or closing brace in object"
+                                         : "Expected string key in object");
+      }
+      auto [key, key_error] = parse_string();
+      if (!key_error.empty()) {
+        return key_error;
+      }
+      builder.key(key);
+
+      // Verify and consume the colon separator
+      skip_whitespace();
+      if (at_end()) {
+        break;
+      }
+      if (source[index] != ':') {
+        return error_at_token("Expected colon after key in object");
+      }
+      index++;
+
+      skip_whitespace();
+      if (at_end()) {
+        break;
+      }
+      if (auto error = parse_value(); !error.empty()) {
+        return error;
+      }
+      count++;
+
+      skip_whitespace();
+      if (at_end()) {
+        break;
+      }
+
+      const auto c = source[index];
+      if (c == '}') {
+        index++;
+        builder.end_object(count);
+        return "";
+      }
+      if (c != ',') {
+        return error_at_token("Expected comma after element in object");
+      }
+      index++; // move past ','
+      skip_whitespace();
+    }
+
+    return error_at_eof("Unexpected EOF while parsing object");
+  }
+} // namespace json
@@ -0,0 +1,33 @@
+#pragma once
+#include <memory_resource>
+#include <string_view>
+#include <vector>
+#include "json.hpp"
+
+namespace json {
+  // Open addressing set of object keys, every distinct key is stored once and handed out as a string_view
+  // The bytes and the slots come from the given resource, so a Document can keep its keys in its arena
+  // Not thread safe
+  class KeyTable {
+  private:
+    std::pmr::memory_resource *resource;
+    std::pmr::vector<std::string_view> slots; // a nullptr data() marks an empty slot
+    size_t count = 0;
+    size_t key_bytes = 0;
+
+    [[nodiscard]] size_t slot_for(std::string_view key) const;
+    void grow();
+    void insert(std::string_view interned);
+
+  public:
+    explicit KeyTable(std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+    // Returns the stored copy of key, copying it into the table the first time it's seen
+    std::string_view intern(std::string_view key);
+    // Stored copy of key, or a view with a nullptr data() if it was never interned
+    [[nodiscard]] std::string_view find(std::string_view key) const;
+
+    [[nodiscard]] size_t size() const { return count; }
+    [[nodiscard]] size_t bytes() const { return key_bytes; }
+  };
+} // namespace json
@@ -1,17 +1,51 @@
 #pragma once
+#include <cctype>
+#include <optional>
+#include <variant>
 #include "json.hpp"
+#include "simd_scan.hpp"
 
 namespace json {
-  std::tuple<JSONToken, int, std::string> lex_string(std::string_view raw_json, int original_index);
-  std::tuple<JSONToken, int, std::string> lex_number(std::string_view raw_json, int index);
+  std::tuple<JSONToken, Offset, std::string> lex_string(std::string_view raw_json, Offset original_index);
+  // Instantiated for std::string (tokens) and String (DOM values, so they land in the right allocator)
+  template<typename Str>
+  std::tuple<Offset, std::string> decode_string(std::string_view raw_json, Offset original_index, Str &out);
+  // Same as decode_string, but the error is just the message so the caller can place it
+  template<typename Str>
+  std::tuple<Offset, std::string_view> decode_string_raw(std::string_view raw_json, Offset original_index, Str &out);
+  std::tuple<JSONToken, Offset, std::string> lex_number(std::string_view raw_json, Offset index);
 
-  std::tuple<JSONToken, int, std::string> lex_syntax(std::string_view raw_json, int original_index);
+  // Numbers are converted straight from the source with from_chars, no copies and no locale
+  // Integers stay exact as long as they fit in 64 bits, anything else becomes a double
+  using Number = std::variant<std::int64_t, double>;
+  // Length of the number starting at index, 0 if there isn't one
+  Offset number_length(std::string_view raw_json, Offset index);
+  // nullopt when the text only looked like a number (ie ".e1") or is too big for a double (1e999)
+  std::optional<Number> to_number(std::string_view text);
 
-  std::tuple<JSONToken, int, std::string> lex_null(std::string_view raw_json, int original_index);
+  std::tuple<JSONToken, Offset, std::string> lex_syntax(std::string_view raw_json, Offset original_index);
 
-  std::tuple<JSONToken, int, std::string> lex_true(std::string_view raw_json, int original_index);
+  std::tuple<JSONToken, Offset, std::string> lex_null(std::string_view raw_json, Offset original_index);
 
-  std::tuple<JSONToken, int, std::string> lex_false(std::string_view raw_json, int original_index);
+  std::tuple<JSONToken, Offset, std::string> lex_true(std::string_view raw_json, Offset original_index);
 
-  std::tuple<JSONToken, int, std::string> lex_intrinsic(std::string_view raw_json, int original_index);
+  std::tuple<JSONToken, Offset, std::string> lex_false(std::string_view raw_json, Offset original_index);
+
+  // Returns the index of the first non whitespace character at or after index
+  Offset skip_whitespace(std::string_view raw_json, Offset index);
+
+  // Picks the lexer for a token starting with c, nullptr if nothing can start with it
+  using Lexer = std::tuple<JSONToken, Offset, std::string> (*)(std::string_view, Offset);
+  Lexer lexer_for(char c);
+
+  // Next token start at or after index, whitespace runs are skipped using the scanner
+  // The character at index only counts as whitespace if it is one, so a token that ends
+  // right before garbage (ie "truex") still stops at the garbage
+  inline Offset next_token_start(StructuralScanner &scanner, std::string_view raw_json, Offset index) {
+    if (index < std::ssize(raw_json) && !std::isspace(static_cast<unsigned char>(raw_json[index])))
+      return index;
+    return scanner.next(index);
+  }
+
+  std::tuple<JSONToken, Offset, std::string> lex_intrinsic(std::string_view raw_json, Offset original_index);
 } // namespace json
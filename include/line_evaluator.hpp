@@ -0,0 +1,41 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "expr.hpp"
+#include "program.hpp"
+#include "thread_pool.hpp"
+
+// Evaluates one expression against every record of an NDJSON (JSON Lines) source
+// The source is cut into chunks at line boundaries, the chunks are evaluated on the pool and the results
+// come back in input order. Blank lines aren't records and are skipped
+class LineEvaluator {
+private:
+  struct Chunk {
+    // One line per record, empty for records that failed
+    std::string output;
+    // Line within the chunk (0 based) and the error of every failed record
+    std::vector<std::pair<size_t, std::string>> errors;
+    // Lines in the chunk, blank ones included, so the next chunk knows where its numbering starts
+    size_t lines = 0;
+  };
+
+  // Compiled once and shared by every worker
+  Program program;
+  json::ThreadPool &pool;
+  size_t chunk_size;
+
+  [[nodiscard]] Chunk evaluateChunk(std::string_view chunk) const;
+
+public:
+  LineEvaluator(const Expr &expr, json::ThreadPool &pool, size_t chunk_size = 1 << 20);
+
+  // write gets the output a chunk at a time in input order, one line per record (the deparsed result, or an
+  // empty line when the record failed). error gets the 1 based line number and message of every failure
+  // Returns how many records failed
+  size_t run(std::string_view source, const std::function<void(std::string_view)> &write,
+             const std::function<void(size_t, const std::string &)> &error) const;
+};
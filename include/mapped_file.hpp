@@ -0,0 +1,35 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <tuple>
+
+namespace json {
+  // Read only memory mapping of a whole file, so it can be parsed without copying it into memory first
+  // Pages are only loaded as the parser gets to them, and the OS can drop them again under memory pressure
+  class MappedFile {
+  private:
+    const char *data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    // No mmap here, the file just gets read into memory (once)
+    std::string contents;
+#endif
+
+    void unmap();
+
+  public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+    ~MappedFile();
+
+    // The error is empty on success
+    static std::tuple<MappedFile, std::string> open(const std::string &path);
+
+    // Valid for as long as the MappedFile is alive
+    [[nodiscard]] std::string_view view() const { return {data, size}; }
+  };
+} // namespace json
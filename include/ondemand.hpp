@@ -0,0 +1,80 @@
+#pragma once
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include "json.hpp"
+
+namespace json {
+  class OnDemandDocument;
+
+  // A value that hasn't been parsed, just where it starts in the source. Navigating only scans the
+  // containers on the way, every value that isn't on the path is skipped by matching brackets
+  class RawValue {
+  private:
+    const OnDemandDocument *document = nullptr;
+    Offset index = 0;
+
+  public:
+    RawValue() = default;
+    RawValue(const OnDemandDocument *document, Offset index) : document(document), index(index) {}
+
+    [[nodiscard]] bool is_object() const;
+    [[nodiscard]] bool is_array() const;
+
+    // nullopt when the key/index doesn't exist, the error is set if the source is broken on the way there
+    [[nodiscard]] std::tuple<std::optional<RawValue>, std::string> find(std::string_view key) const;
+    [[nodiscard]] std::tuple<std::optional<RawValue>, std::string> at(size_t i) const;
+    // Value of the i-th member in key order (the order Object keeps them in)
+    [[nodiscard]] std::tuple<std::optional<RawValue>, std::string> member_at(size_t i) const;
+    // Number of elements or members, 0 for anything else. Indexes the whole container
+    [[nodiscard]] std::tuple<size_t, std::string> size() const;
+
+    // Fully parses (and validates) this value only, allocated from the default resource
+    [[nodiscard]] std::tuple<JSONValue, std::string> materialize() const;
+
+    [[nodiscard]] Offset position() const { return index; }
+  };
+
+  // On demand view of a JSON source, nothing is parsed up front. Only the parts a query walks through are
+  // looked at, so a broken document is only reported when a query runs into the broken part.
+  //
+  // Every object or array a lookup goes through is indexed once and the index is kept, so running several
+  // queries against the same document doesn't scan the shared parts again. That makes it unsafe to use
+  // from more than one thread at a time. The source has to outlive the document
+  class OnDemandDocument {
+  private:
+    struct ObjectIndex {
+      // Sorted by key, only the last of each duplicate is kept like in Object
+      std::vector<std::pair<std::string_view, Offset>> members;
+    };
+
+    struct ArrayIndex {
+      std::vector<Offset> elements;
+      // Where the next element starts, arrays are only scanned as far as they've been indexed
+      Offset resume = -1;
+      bool complete = false;
+    };
+
+    std::string_view source;
+    Offset root_index = 0;
+    mutable std::unordered_map<Offset, ObjectIndex> objects;
+    mutable std::unordered_map<Offset, ArrayIndex> arrays;
+    // Keys with escapes have to be decoded somewhere, deque so the views stay valid
+    mutable std::deque<std::string> decoded_keys;
+
+    friend class RawValue;
+
+    std::tuple<const ObjectIndex *, std::string> index_object(Offset start) const;
+    std::tuple<const ArrayIndex *, std::string> index_array(Offset start, size_t until) const;
+
+  public:
+    // Only checks there is a value at all
+    static std::tuple<OnDemandDocument, std::string> parse(std::string_view source);
+
+    [[nodiscard]] RawValue root() const { return {this, root_index}; }
+  };
+} // namespace json
@@ -0,0 +1,40 @@
+#pragma once
+#include <functional>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "json.hpp"
+#include "key_table.hpp"
+#include "thread_pool.hpp"
+
+namespace json {
+  // Where the values of one chunk go, each chunk gets its own since arenas and key tables aren't thread safe
+  struct ChunkArena {
+    std::pmr::memory_resource *resource;
+    KeyTable *keys; // nullptr for objects that keep their own keys
+  };
+
+  // Element runs of a top level array, about chunk_size bytes each. Every run is [first, last) where last
+  // is the top level ',' after it (or the closing ']' for the last one). Boundaries come from the structural
+  // scanner, so commas inside strings (escaped quotes and all) and nested values are never split on.
+  // Empty when the source isn't an array or never closes it
+  std::vector<std::pair<Offset, Offset>> split_array(std::string_view source, size_t chunk_size);
+
+  // Parses a document that's one big array on the pool, a chunk of elements per task, and splices the chunks
+  // back together in order. chunk_arena is called on the calling thread once per chunk with its size in bytes.
+  // The array itself, and anything that isn't a big enough array, is allocated from resource/keys.
+  //
+  // The chunks are parsed with the regular parser, so the values are identical. When any chunk fails (or the
+  // text after the array isn't just whitespace) the whole source goes through the single threaded parser, so
+  // errors and their locations are always the ones it reports
+  std::tuple<JSONValue, std::string> parse_parallel(std::string_view source, ThreadPool &pool,
+                                                    const std::function<ChunkArena(size_t)> &chunk_arena,
+                                                    std::pmr::memory_resource *resource = std::pmr::get_default_resource(),
+                                                    KeyTable *keys = nullptr, size_t chunk_size = 1 << 20);
+
+  // Same as json::parse, allocates from the default resource
+  std::tuple<JSONValue, std::string> parse(std::string_view source, ThreadPool &pool);
+} // namespace json
@@ -1,8 +1,7 @@
 #pragma once
 #include "json.hpp"
 namespace json {
-  std::tuple<std::vector<JSONValue>, int, std::string> parse_array(const std::vector<JSONToken> &tokens, int index);
+  std::tuple<Array, Offset, std::string> parse_array(const std::vector<JSONToken> &tokens, Offset index);
 
-  std::tuple<std::map<std::string, JSONValue>, int, std::string> parse_object(const std::vector<JSONToken> &tokens, int
-  index);
+  std::tuple<Object, Offset, std::string> parse_object(const std::vector<JSONToken> &tokens, Offset index);
 } // namespace json
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <variant>
+#include <vector>
+#include "expr.hpp"
+#include "json.hpp"
+#include "json_parser.hpp"
+#include "sax.hpp"
+
+// Resolves a PathExpr over SAX events, so the document never has to be in memory at once
+// Memory is bounded by the length of the path plus the matched value, which is the only thing that gets built
+class PathMatcher : public json::SaxHandler {
+private:
+  // There's no document to evaluate index expressions against, so they have to be number literals
+  std::vector<std::variant<std::string, size_t>> segments;
+
+  // One per container on the matched prefix, levels[i] is the value segments[0, i) resolved to
+  struct Level {
+    bool is_array;
+    size_t count = 0; // elements seen so far
+    bool found = false; // whether segments[i] showed up in it
+  };
+  std::vector<Level> levels;
+  // Set by a key that matches the next segment, the root always matches the empty path
+  bool next_matches = true;
+  // Depth inside a container that isn't on the path
+  int skip_depth = 0;
+  // Builds the matched value, with the child count of every container open in it
+  std::optional<json::DomBuilder> capture;
+  std::vector<size_t> capture_counts;
+
+  std::optional<json::JSONValue> match;
+  std::string failure;
+
+  enum class Kind { Scalar, Array, Object };
+  bool begin_value(Kind kind);
+  void end_value();
+  void end_container(bool is_array);
+
+public:
+  // Throws if an index isn't a number literal
+  explicit PathMatcher(const PathExpr &path);
+
+  void on_null() override;
+  void on_bool(bool b) override;
+  void on_number(double n) override;
+  void on_integer(std::int64_t n) override;
+  void on_string(std::string_view str) override;
+  void on_key(std::string_view key) override;
+  void on_start_object() override;
+  void on_end_object() override;
+  void on_start_array() override;
+  void on_end_array() override;
+
+  // Call once the whole document went through without errors
+  // Throws the same errors the Evaluator would when the path doesn't resolve
+  [[nodiscard]] json::JSONValue result() &&;
+};
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "expr.hpp"
+#include "json.hpp"
+
+// An expression compiled down to a flat list of instructions for a small stack machine
+// Functions are resolved to opcodes and literal indexes to constants when compiling, so running it is a
+// single loop over the instructions with no virtual calls, string compares or allocations per node.
+// Compile once and run it through Evaluator::evaluateRef as many times as needed, the expression isn't
+// needed afterwards.
+//
+// Subexpressions that show up more than once (a.b in a.b[size(a.b)], or the same function call twice) are
+// only computed the first time, the result is kept in a register and reused after that
+class Program {
+public:
+  enum class Op : uint8_t {
+    Literal, // pushes constants[operand]
+    Root, // starts a path at the document root
+    Member, // steps into member strings[operand]
+    Element, // steps into element constants[operand]
+    Index, // steps into the element the value on top says (computed indexes)
+    EndPath, // the path is done, its node becomes a value
+    Range, // ends the path with the rest of it from range_path(operand), takes count computed indexes
+    Min, // operand is the argument count for the functions
+    Max,
+    Size,
+    Unknown, // fails with the name in strings[operand], after the arguments like the Evaluator does
+    Store, // keeps the value on top in register operand, it stays on the stack too
+    Load, // pushes the value in register operand
+  };
+
+  struct Instruction {
+    Op op;
+    uint32_t operand = 0;
+    uint32_t count = 0; // arguments taken off the stack by functions
+  };
+
+  // What's left of a path from its first wildcard or slice on
+  struct RangeStep {
+    enum class Kind : uint8_t {
+      Member, // strings[operand]
+      Element, // constants[operand]
+      Index, // the next of the computed indexes
+      Range,
+    };
+    Kind kind;
+    uint32_t operand = 0;
+    RangeSegment range;
+  };
+
+private:
+  std::vector<Instruction> code;
+  std::vector<json::JSONValue> constants;
+  std::vector<std::string> strings;
+  std::vector<std::vector<RangeStep>> ranges;
+  // Deepest the two stacks get, so running it can reserve them up front
+  size_t max_nodes = 0;
+  size_t max_values = 0;
+  size_t nodes = 0;
+  size_t values = 0;
+  size_t registers = 0;
+
+  // Canonical text of every subexpression and how often it's needed, for finding the repeated ones
+  struct Subexpressions {
+    std::unordered_map<const Expr *, std::string> keys;
+    std::unordered_map<std::string, size_t> counts;
+    std::unordered_map<std::string, size_t> registers;
+  };
+  static const std::string &describe(const Expr &expr, Subexpressions &subexpressions);
+  static std::string describe(const RangeSegment &range);
+  static void countUses(const Expr &expr, Subexpressions &subexpressions);
+
+  void emit(const Expr &expr, Subexpressions &subexpressions);
+  void emitRange(std::span<const PathSegment> segments, Subexpressions &subexpressions);
+  void push(Op op, size_t operand = 0, size_t count = 0);
+
+public:
+  // Never throws, unknown functions only fail when the program runs (same as evaluating the expression)
+  static Program compile(const Expr &expr);
+
+  [[nodiscard]] const std::vector<Instruction> &instructions() const { return code; }
+  [[nodiscard]] const json::JSONValue &constant(const size_t i) const { return constants[i]; }
+  [[nodiscard]] const std::string &string(const size_t i) const { return strings[i]; }
+  [[nodiscard]] const std::vector<RangeStep> &range_path(const size_t i) const { return ranges[i]; }
+  [[nodiscard]] size_t node_depth() const { return max_nodes; }
+  [[nodiscard]] size_t value_depth() const { return max_values; }
+  [[nodiscard]] size_t register_count() const { return registers; }
+};
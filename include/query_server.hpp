@@ -0,0 +1,86 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "document.hpp"
+#include "expr_cache.hpp"
+
+// Keeps documents parsed in memory and answers queries against them, one request per line:
+//
+//   load <name> <json_file>     parses the file and keeps it as <name>, replacing what was there
+//   reload <name>               parses the file <name> was loaded from again
+//   unload <name>
+//   query <name> <expression>   evaluates the expression against <name>
+//   stats                       query count and latency percentiles in microseconds
+//   quit                        closes the connection
+//   shutdown                    stops the server
+//
+// Every request gets one line back, "ok" followed by the result (if there is one) or "error" followed by
+// the message. Newlines in either are escaped so a response is always exactly one line.
+//
+// Requests can come in from several connections at once. A reload parses the new version on the side,
+// queries that already started keep the old one until they're done
+class QueryServer {
+public:
+  struct Latency {
+    uint64_t queries = 0;
+    double p50 = 0;
+    double p90 = 0;
+    double p99 = 0;
+    double max = 0;
+  };
+
+private:
+  struct Loaded {
+    std::string path;
+    std::shared_ptr<const json::Document> document;
+  };
+
+  mutable std::shared_mutex documents_mutex;
+  std::unordered_map<std::string, Loaded> documents;
+  ExprCache cache;
+
+  // The last window query latencies (in microseconds), oldest get overwritten
+  mutable std::mutex latency_mutex;
+  std::vector<double> samples;
+  size_t window;
+  size_t next_sample = 0;
+  uint64_t queries = 0;
+
+  std::atomic<bool> stopping = false;
+  std::atomic<int> listener = -1;
+
+  std::string query(std::string_view name, std::string_view expression);
+  void record(double micros);
+
+public:
+  explicit QueryServer(size_t cache_capacity = 1024, size_t latency_window = 1 << 16);
+
+  // The error is empty on success
+  std::string load(const std::string &name, const std::string &path);
+
+  // The response line (without the newline), nullopt when the connection should be closed
+  [[nodiscard]] std::optional<std::string> handle(std::string_view request);
+
+  [[nodiscard]] Latency latency() const;
+  [[nodiscard]] bool stopped() const { return stopping; }
+
+  // Answers requests until the input ends, quit or shutdown
+  void serve(std::istream &in, std::ostream &out);
+  // Listens on a Unix domain socket, every connection gets its own thread. Returns once shutdown is
+  // requested, the error is empty unless the socket couldn't be set up. Whatever is at path already is only
+  // replaced if it's a socket
+  std::string serve_socket(const std::string &path);
+
+  // Longest request a socket connection can send, past it the client gets an error and is disconnected
+  static constexpr size_t max_line_length = 1 << 20;
+};
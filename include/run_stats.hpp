@@ -0,0 +1,72 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "alloc_stats.hpp"
+#include "json.hpp"
+
+namespace json {
+  // Wall time and heap allocations per phase of a run, plus whatever counters the caller adds
+  // (bytes read, node counts, ...). Turns allocation counting on for as long as it's alive, the counts stay at zero
+  // unless the program links alloc_hooks.cpp
+  class RunStats {
+  public:
+    struct Phase {
+      std::string name;
+      double seconds = 0;
+      AllocStats allocations;
+    };
+
+    // Times a phase from construction until destruction, allocations in between are counted as its own
+    class Scope {
+    private:
+      RunStats *stats;
+      std::string name;
+      std::chrono::steady_clock::time_point start;
+      AllocStats allocations;
+
+    public:
+      Scope(RunStats &stats, std::string name);
+      Scope(Scope &&other) noexcept;
+      Scope(const Scope &) = delete;
+      Scope &operator=(const Scope &) = delete;
+      Scope &operator=(Scope &&) = delete;
+      ~Scope();
+    };
+
+  private:
+    std::vector<Phase> phase_list;
+    std::vector<std::pair<std::string, uint64_t>> counter_list;
+    bool counting_before;
+    std::chrono::steady_clock::time_point start;
+    AllocStats allocations_before;
+
+  public:
+    RunStats();
+    RunStats(const RunStats &) = delete;
+    RunStats &operator=(const RunStats &) = delete;
+    ~RunStats();
+
+    [[nodiscard]] Scope phase(std::string name) { return {*this, std::move(name)}; }
+    // Replaces the counter if it's already there
+    void set(const std::string &counter, uint64_t value);
+
+    [[nodiscard]] const std::vector<Phase> &phases() const { return phase_list; }
+    [[nodiscard]] const std::vector<std::pair<std::string, uint64_t>> &counters() const { return counter_list; }
+
+    // {"total_seconds": ..., "allocations": ..., "alloc_bytes": ..., "phases": [{"name": ..., "seconds": ...,
+    // "allocations": ..., "alloc_bytes": ...}, ...], "counters": {...}} on one line. Totals run from construction.
+    // The allocation numbers are null when the program doesn't link the hooks, see alloc_stats.hpp
+    [[nodiscard]] std::string to_json() const;
+  };
+
+  struct DomStats {
+    uint64_t nodes = 0;
+    // Tokens the source had, punctuation included (what json::lex would produce)
+    uint64_t tokens = 0;
+  };
+
+  DomStats dom_stats(const JSONValue &value);
+} // namespace json
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <string_view>
+
+namespace json {
+  // Receives a document as a stream of events instead of a tree, override whatever is needed
+  // Views are only valid during the call
+  class SaxHandler {
+  public:
+    virtual ~SaxHandler() = default;
+
+    virtual void on_null() {}
+    virtual void on_bool(bool) {}
+    virtual void on_number(double) {}
+    // Integers that fit in 64 bits, handlers that don't care get them as a double
+    virtual void on_integer(const std::int64_t n) { on_number(static_cast<double>(n)); }
+    virtual void on_string(std::string_view) {}
+    virtual void on_key(std::string_view) {}
+    virtual void on_start_object() {}
+    virtual void on_end_object() {}
+    virtual void on_start_array() {}
+    virtual void on_end_array() {}
+  };
+
+  // Reports every value in source to handler, returns the error (same messages as json::parse)
+  // Events that were sent before an error aren't taken back
+  std::string parse_sax(std::string_view source, SaxHandler &handler);
+
+  // Same thing reading input chunk_size bytes at a time. Only the current chunk (and a token that straddles
+  // two of them) is kept in memory, so the input can be as big as it wants
+  std::string parse_sax(std::istream &input, SaxHandler &handler, size_t chunk_size = 64 * 1024);
+} // namespace json
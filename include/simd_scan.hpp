@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "json.hpp"
+
+namespace json {
+  // Instruction sets the stage 1 scanner can run on, picked at runtime from what the CPU supports
+  enum class SimdLevel { Scalar, SSE42, AVX2 };
+
+  // Best level the current CPU supports
+  SimdLevel detected_simd_level();
+  SimdLevel active_simd_level();
+  // Forces a specific backend (clamped to what the CPU supports), mainly for tests and benchmarks
+  void set_simd_level(SimdLevel level);
+  const char *simd_level_name(SimdLevel level);
+
+  // Stage 1 scanner: classifies the source 64 bytes at a time and marks every position a token can start at.
+  // That's structural characters ({}[]:,), opening quotes and the first character of a scalar (number, true,
+  // false, null or garbage) that sits outside a string. Quotes escaped with a backslash don't toggle strings.
+  //
+  // Blocks are classified lazily and in order, so the scanner only moves forwards and doesn't need an index
+  // the size of the input
+  class StructuralScanner {
+  private:
+    std::string_view source;
+    size_t block_start = 0;
+    uint64_t starts = 0; // token starts of the current block
+    bool loaded = false;
+
+    // carried over between blocks
+    uint64_t prev_in_string = 0; // all ones when the previous block ended inside a string
+    uint64_t prev_escaped = 0;   // 1 when the first character of the next block is escaped
+    uint64_t prev_boundary = 1;  // 1 when the last character was whitespace, structural or a quote
+
+    void load_next_block();
+
+  public:
+    explicit StructuralScanner(std::string_view source);
+    // Starts scanning at start instead of the beginning, which has to be a token start (so not inside a string)
+    StructuralScanner(std::string_view source, size_t start);
+
+    // Position of the first token start at or after index, or the source size if there's none left
+    // index must never go backwards between calls
+    Offset next(Offset index);
+  };
+
+  // Index of the first '"', '\\' or control character (below 0x20) in text, text.size() if there's none
+  // Strings are scanned with this, everything before what it finds can be copied over in one go
+  size_t find_string_special(std::string_view text);
+
+  // Every token start in the source, mostly useful for testing the scanner
+  std::vector<Offset> structural_index(std::string_view source);
+} // namespace json
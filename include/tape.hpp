@@ -0,0 +1,123 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "json.hpp"
+
+namespace json {
+  class Tape;
+
+  enum class TapeType : uint8_t {
+    Null = 'n',
+    True = 't',
+    False = 'f',
+    Number = 'd', // the double's bits are in the next word
+    Integer = 'l', // the int64's bits are in the next word
+    String = '"', // payload is the offset of the string in the string buffer
+    StartArray = '[', // payload is the index after the matching end, and the element count
+    EndArray = ']', // payload is the index of the matching start
+    StartObject = '{',
+    EndObject = '}',
+    ShadowedKey = 'x', // a key that a later duplicate in the same object overrides, skipped everywhere
+  };
+
+  // Read only handle to one value on a tape, cheap to copy around
+  // Object members are stored as a key string followed by the value, so an object with n members has 2n
+  // values between its start and end
+  class TapeCursor {
+  private:
+    const Tape *tape = nullptr;
+    size_t index = 0;
+
+    [[nodiscard]] uint64_t word() const;
+    [[nodiscard]] uint64_t payload() const;
+
+  public:
+    TapeCursor() = default;
+    TapeCursor(const Tape *tape, size_t index) : tape(tape), index(index) {}
+
+    [[nodiscard]] TapeType type() const;
+    [[nodiscard]] bool is_null() const { return type() == TapeType::Null; }
+    [[nodiscard]] bool is_bool() const { return type() == TapeType::True || type() == TapeType::False; }
+    // Integers count as numbers too, as_number converts them
+    [[nodiscard]] bool is_number() const { return type() == TapeType::Number || type() == TapeType::Integer; }
+    [[nodiscard]] bool is_integer() const { return type() == TapeType::Integer; }
+    [[nodiscard]] bool is_string() const { return type() == TapeType::String; }
+    [[nodiscard]] bool is_array() const { return type() == TapeType::StartArray; }
+    [[nodiscard]] bool is_object() const { return type() == TapeType::StartObject; }
+
+    [[nodiscard]] bool as_bool() const { return type() == TapeType::True; }
+    [[nodiscard]] double as_number() const;
+    [[nodiscard]] std::int64_t as_integer() const;
+    [[nodiscard]] std::string_view as_string() const;
+
+    // Number of elements or members, O(1) unless the container is huge
+    [[nodiscard]] size_t size() const;
+    // Member lookup on objects, element lookup on arrays, nullopt if missing or the wrong type
+    [[nodiscard]] std::optional<TapeCursor> find(std::string_view key) const;
+    [[nodiscard]] std::optional<TapeCursor> at(size_t i) const;
+    // The value right after this one, containers are skipped in O(1)
+    [[nodiscard]] TapeCursor next() const;
+
+    // Walks the children of an array (or the key, value pairs of an object) without materializing anything
+    template<typename F>
+    void for_each_element(F &&f) const;
+    template<typename F>
+    void for_each_member(F &&f) const;
+    // The members sorted by key, the order an Object keeps them in. for_each_member goes in document order
+    [[nodiscard]] std::vector<std::pair<std::string_view, TapeCursor>> members_by_key() const;
+
+    // Copies the value into a regular DOM, allocated from the default resource
+    [[nodiscard]] JSONValue materialize() const;
+
+    [[nodiscard]] size_t position() const { return index; }
+    bool operator==(const TapeCursor &other) const = default;
+  };
+
+  // Compact immutable document: one contiguous array of 64 bit words (type in the top byte, payload
+  // below) plus one buffer holding every string, length prefixed (32 bits, 64 for strings of 4 GiB and up).
+  // Containers store where they end, so stepping over a sibling is O(1) however big it is. Object keys
+  // are stored once per tape.
+  class Tape {
+  private:
+    std::vector<uint64_t> words;
+    std::vector<char> strings;
+
+    friend class TapeCursor;
+    friend class TapeBuilder;
+
+  public:
+    static std::tuple<Tape, std::string> parse(std::string_view source);
+
+    [[nodiscard]] TapeCursor root() const { return {this, 0}; }
+    // Memory used by the words and the strings
+    [[nodiscard]] size_t size_in_bytes() const { return words.size() * sizeof(uint64_t) + strings.size(); }
+  };
+
+  // Written straight off the tape, nothing gets materialized
+  std::string deparse(TapeCursor cursor);
+
+  template<typename F>
+  void TapeCursor::for_each_element(F &&f) const {
+    if (!is_array())
+      return;
+    for (TapeCursor child{tape, index + 1}; child.type() != TapeType::EndArray; child = child.next())
+      f(child);
+  }
+
+  template<typename F>
+  void TapeCursor::for_each_member(F &&f) const {
+    if (!is_object())
+      return;
+    for (TapeCursor key{tape, index + 1}; key.type() != TapeType::EndObject;) {
+      const TapeCursor value{tape, key.index + 1};
+      if (key.type() != TapeType::ShadowedKey)
+        f(key.as_string(), value);
+      key = value.next();
+    }
+  }
+} // namespace json
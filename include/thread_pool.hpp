@@ -0,0 +1,51 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace json {
+  // Fixed set of worker threads taking tasks off one queue, tasks run in the order they were submitted
+  class ThreadPool {
+  private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable available;
+    bool stopping = false;
+
+    void work();
+
+  public:
+    // 0 means one thread per core
+    explicit ThreadPool(size_t threads = 0);
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+    // Finishes the queued tasks before joining
+    ~ThreadPool();
+
+    [[nodiscard]] size_t size() const { return workers.size(); }
+
+    // Exceptions thrown by f come out of the future
+    template<typename F>
+    std::future<std::invoke_result_t<F>> submit(F &&f);
+  };
+
+  template<typename F>
+  std::future<std::invoke_result_t<F>> ThreadPool::submit(F &&f) {
+    // packaged_task is move only and std::function wants something copyable
+    auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::forward<F>(f));
+    auto result = task->get_future();
+    {
+      std::lock_guard lock(mutex);
+      tasks.emplace([task] { (*task)(); });
+    }
+    available.notify_one();
+    return result;
+  }
+} // namespace json
@@ -0,0 +1,66 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include "json.hpp"
+#include "tape.hpp"
+
+namespace json {
+  // Serializes values straight into an output, nothing gets built up per level
+  // Appending to a string writes into it directly. Streams and file descriptors go through a fixed size
+  // buffer that is handed over whenever it fills up, so however big the value is the extra memory isn't
+  //
+  // Compact keeps the separators deparse has always used ([1, 2] and {"a":1, "b":2}), Pretty puts every
+  // element and member on its own line indented by two spaces per level
+  class Writer {
+  public:
+    enum class Style { Compact, Pretty };
+
+  private:
+    std::string buffer;
+    // Where the text goes, either buffer or the string the writer was given
+    std::string *out;
+    // Takes the buffer when it fills up, not set when writing to a string
+    std::function<bool(std::string_view)> sink;
+    size_t limit;
+    Style style;
+    size_t depth = 0;
+    std::string failure;
+
+    void newline();
+    void maybe_flush() {
+      if (out->size() >= limit)
+        flush();
+    }
+
+    void write_string(std::string_view s);
+    void write_number(double number);
+    void write_integer(std::int64_t number);
+
+  public:
+    explicit Writer(std::string &out, Style style = Style::Compact);
+    explicit Writer(std::ostream &out, Style style = Style::Compact, size_t buffer_size = 1 << 16);
+    // Doesn't take ownership of fd
+    explicit Writer(int fd, Style style = Style::Compact, size_t buffer_size = 1 << 16);
+    Writer(const Writer &) = delete;
+    Writer &operator=(const Writer &) = delete;
+    ~Writer() { flush(); }
+
+    Writer &write(const JSONValue &value);
+    Writer &write(TapeCursor cursor);
+    // Raw text, for separators between values and the like
+    Writer &raw(std::string_view text);
+    Writer &raw(char c);
+
+    // Hands whatever is buffered to the stream or file descriptor, nothing to do for strings
+    void flush();
+    // Empty unless writing to the stream or file descriptor failed, everything after that is dropped
+    [[nodiscard]] const std::string &error() const { return failure; }
+  };
+
+  // Shortest text that reads back as exactly the same double, needs at most 32 bytes. Returns the end
+  // Infinity and NaN are written as null
+  char *format_number(char *first, double number);
+} // namespace json
@@ -1,25 +1,49 @@
 #include "json.hpp"
+#include "json_parser.hpp"
 #include "lex_func.hpp"
+#include "simd_scan.hpp"
 
-#include <cmath>
+#include <algorithm>
 #include <format>
-#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include "parse_func.hpp"
 
 namespace json {
-  int skip_whitespace(std::string_view raw_json, int index);
   std::string JSONTokenType_to_string(JSONTokenType jtt);
 
-  std::tuple<JSONValue, std::string> parse(const std::string_view source) {
-    auto [tokens, error] = json::lex(source);
-    if (!error.empty()) {
-      return std::make_tuple(JSONValue{}, error);
+  std::tuple<JSONValue, std::string> parse(const std::string_view source) { return JSONParser(source).parse(); }
+
+  namespace {
+    template<typename Column>
+    JSONValue pack(const std::span<JSONValue> elements, std::pmr::memory_resource *resource) {
+      Column column(resource);
+      column.reserve(elements.size());
+      for (const auto &element: elements)
+        column.push_back(std::get<typename Column::value_type>(element.value));
+      return JSONValue(std::move(column));
     }
 
-    auto [ast, _, error1] = json::parse(tokens);
-    return std::make_tuple(ast, error1);
+    template<typename T>
+    bool all_of_type(const std::span<JSONValue> elements) {
+      return std::all_of(elements.begin(), elements.end(),
+                         [](const JSONValue &element) { return std::holds_alternative<T>(element.value); });
+    }
+  } // anonymous namespace
+
+  JSONValue make_array(const std::span<JSONValue> elements, std::pmr::memory_resource *resource) {
+    if (elements.size() >= min_column_size) {
+      if (all_of_type<double>(elements))
+        return pack<DoubleColumn>(elements, resource);
+      if (all_of_type<std::int64_t>(elements))
+        return pack<IntegerColumn>(elements, resource);
+    }
+    Array children(resource);
+    children.reserve(elements.size());
+    for (auto &element: elements)
+      children.push_back(std::move(element));
+    return JSONValue(std::move(children));
   }
 
   std::tuple<std::vector<JSONToken>, std::string> lex(std::string_view raw_json) {
@@ -28,44 +52,38 @@ namespace json {
     // All tokens will store a pointer to the original source string for debugging purposes
     // Tokens include an index which is used to identify its offset from the start of the string
 
-    // function pointers that will attempt to parse
-    auto generic_lexers = {lex_syntax, lex_string, lex_number, lex_null, lex_true, lex_false};
-    for (int i{}; i < static_cast<int>(std::ssize(raw_json)); i++) {
-      // Skip past whitespace, this feels unnecessarily complicated
-      if (const auto new_index = skip_whitespace(raw_json, i); i != new_index) {
-        i = new_index - 1;
-        continue;
-      }
-
-      bool found{};
-      for (auto lexer: generic_lexers) {
-        if (auto [token, new_index, error] = lexer(raw_json, i); i != new_index) {
-          if (!error.empty())
-            return {{}, error};
-
-          tokens.push_back(token);
-          i = new_index - 1;
-          found = true;
-          break;
-        }
+    // The scanner finds where the next token starts (SIMD where available), so whitespace gets
+    // skipped in bulk and the first character tells us which lexer to run
+    StructuralScanner scanner(raw_json);
+    const Offset size = std::ssize(raw_json);
+    for (Offset i = next_token_start(scanner, raw_json, 0); i < size; i = next_token_start(scanner, raw_json, i)) {
+      const auto lexer = lexer_for(raw_json[i]);
+      if (lexer == nullptr) {
+        return std::make_tuple(std::vector<JSONToken>{}, format_error_json("Unable to lex", raw_json, i));
       }
 
+      auto [token, new_index, error] = lexer(raw_json, i);
+      if (!error.empty())
+        return std::make_tuple(std::vector<JSONToken>{}, error);
+      if (new_index == i)
+        return std::make_tuple(std::vector<JSONToken>{}, format_error_json("Unable to lex", raw_json, i));
 
-      if (found)
-        continue;
-
-      return std::make_tuple(std::vector<JSONToken>{}, format_error_json("Unable to lex", raw_json, i));
+      tokens.push_back(std::move(token));
+      i = new_index;
     }
 
     return std::make_tuple(tokens, "");
   }
 
-  std::tuple<JSONValue, int, std::string> parse(const std::vector<JSONToken> &tokens, int index) {
+  std::tuple<JSONValue, Offset, std::string> parse(const std::vector<JSONToken> &tokens, Offset index) {
     const auto &token = tokens[index];
     switch (token.type) {
       case JSONTokenType::Number: {
-        const auto n = std::stod(token.value);
-        return {JSONValue(n), index + 1, ""};
+        const auto number = to_number(token.value);
+        if (!number) {
+          return {JSONValue{}, index, format_parse_error("Failed to parse", token)};
+        }
+        return {std::visit([](const auto n) { return JSONValue(n); }, *number), index + 1, ""};
       }
       case JSONTokenType::Boolean:
         return {JSONValue(token.value == "true"), index + 1, ""};
@@ -88,80 +106,6 @@ namespace json {
     return {JSONValue{}, index, format_parse_error("Failed to parse", token)};
   }
 
-  static std::string doubleToString(const double num, const int maxPrecision = 10) {
-    constexpr double epsilon = 1e-10;
-
-
-    // Round to maxPrecision decimal places
-    double factor = std::pow(10, maxPrecision);
-    double rounded = std::round(num * factor) / factor;
-
-    // If the number is very close to an integer
-    if (std::fabs(rounded - std::round(rounded)) < epsilon) {
-      std::stringstream outputStream{};
-      outputStream << std::fixed << std::setprecision(0) << rounded;
-      return outputStream.str();
-    }
-
-    // Convert to string for analysis
-    std::ostringstream oss{};
-    oss << std::fixed << std::setprecision(maxPrecision) << rounded;
-    std::string str = oss.str();
-
-    // Remove trailing zeros
-    while (str.back() == '0') {
-      str.pop_back();
-    }
-
-    // Remove decimal point if it's the last character
-    if (str.back() == '.') {
-      str.pop_back();
-    }
-
-    return str;
-  }
-
-  std::string deparse(const JSONValue &v, std::string whitespace) {
-    return std::visit(
-        [&whitespace]<typename T0>(const T0 &value) -> std::string {
-          using T = std::decay_t<T0>;
-
-          if constexpr (std::is_same_v<T, std::monostate>) {
-            return "null";
-          } else if constexpr (std::is_same_v<T, std::string>) {
-            return "\"" + value + "\"";
-          } else if constexpr (std::is_same_v<T, double>) {
-            return doubleToString(value);
-          } else if constexpr (std::is_same_v<T, bool>) {
-            return value ? "true" : "false";
-          } else if constexpr (std::is_same_v<T, std::vector<JSONValue>>) {
-            std::string s = "[";
-            for (size_t i = 0; i < value.size(); i++) {
-              s += whitespace + json::deparse(value[i], whitespace);
-              if (i < value.size() - 1) {
-                s += ", ";
-              }
-              // s += "\n";
-            }
-            return s + whitespace + "]";
-          } else if constexpr (std::is_same_v<T, std::map<std::string, JSONValue>>) {
-            std::string s = "{";
-            size_t i = 0;
-            for (const auto &[key, val]: value) {
-              s.append(whitespace).append("\"").append(key).append("\":").append(json::deparse(val, whitespace));
-              if (i < value.size() - 1) {
-                s += ", ";
-              }
-              // s += "\n";
-              i++;
-            }
-            return s + whitespace + "}";
-          }
-          return "";
-        },
-        v.value);
-  }
-
   std::string JSONTokenType_to_string(const JSONTokenType jtt) {
     switch (jtt) {
       case JSONTokenType::String:
@@ -180,15 +124,17 @@ namespace json {
     return "ERROR: NEGLECTED";
   }
 
-  std::string format_parse_error(const std::string_view base, const JSONToken &token) {
+  std::string format_parse_error(const std::string_view base, const JSONToken &token, const Offset first_line,
+                                 const Offset first_column) {
     std::ostringstream s;
     s << "Unexpected token '" << token.value << "', type '" << JSONTokenType_to_string(token.type) << "', index ";
     s << std::endl << base;
-    return format_error_json(s.str(), token.full_source, token.location);
+    return format_error_json(s.str(), token.full_source, token.location, first_line, first_column);
   }
 
-  std::string format_error_json(std::string_view base, std::string_view source, int error_index) {
-    int counter{}, line{1}, column{};
+  std::string format_error_json(std::string_view base, std::string_view source, Offset error_index,
+                                const Offset first_line, const Offset first_column) {
+    Offset counter{}, line{first_line}, column{first_column};
     std::string last_line;
     std::string whitespace;
 
@@ -215,7 +161,7 @@ namespace json {
     }
 
     // Do the last line
-    while (counter < static_cast<int>(std::ssize(source))) {
+    while (counter < std::ssize(source)) {
       auto c{source[counter]};
       if (c == '\n')
         break;
@@ -228,8 +174,8 @@ namespace json {
   }
 
   // skips over whitespace
-  int skip_whitespace(std::string_view raw_json, int index) {
-    while (index < static_cast<int>(std::ssize(raw_json)) && std::isspace(raw_json[index]))
+  Offset skip_whitespace(std::string_view raw_json, Offset index) {
+    while (index < std::ssize(raw_json) && std::isspace(raw_json[index]))
       index++;
 
     return index;
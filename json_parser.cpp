@@ -0,0 +1,138 @@
+#include "json_parser.hpp"
+
+#include <string>
+#include "key_table.hpp"
+#include "lex_func.hpp"
+
+namespace json {
+  ParserBase::ParserBase(const std::string_view source) : source(source), scanner(source) {}
+
+  void ParserBase::reset(const Offset start) {
+    index = start;
+    scanner = StructuralScanner(source, start);
+  }
+
+  bool ParserBase::at_end() const { return index >= std::ssize(source); }
+
+  void ParserBase::skip_whitespace() { index = next_token_start(scanner, source, index); }
+
+  std::tuple<std::string_view, std::string> ParserBase::parse_string() {
+    // Most strings don't have any escapes, those can be handed out straight from the source
+    const auto end = index + 1 + static_cast<Offset>(find_string_special(source.substr(index + 1)));
+    if (end < std::ssize(source) && source[end] == '"') {
+      const auto str = source.substr(index + 1, end - index - 1);
+      index = end + 1;
+      return {str, ""};
+    }
+
+    string_buffer.clear();
+    auto [new_index, error] = decode_string(source, index, string_buffer);
+    if (!error.empty()) {
+      return {std::string_view{}, error};
+    }
+    index = new_index;
+    return {string_buffer, ""};
+  }
+
+  std::tuple<Number, std::string> ParserBase::parse_number() {
+    const auto length = number_length(source, index);
+    const auto number = length == 0 ? std::nullopt : to_number(source.substr(index, length));
+    if (!number) {
+      return {Number{}, error_at_token("Failed to parse")};
+    }
+    index += length;
+    return {*number, ""};
+  }
+
+  bool ParserBase::match_keyword(const std::string_view keyword) {
+    if (source.substr(index, keyword.size()) != keyword) {
+      return false;
+    }
+    index += std::ssize(keyword);
+    return true;
+  }
+
+  std::string error_at_token(const std::string_view base, const std::string_view source, const Offset index,
+                             const Offset first_line, const Offset first_column) {
+    // Same order json::lex tries them in
+    for (auto lexer: {lex_syntax, lex_string, lex_number}) {
+      if (auto [token, new_index, error] = lexer(source, index); new_index != index) {
+        if (!error.empty())
+          return error;
+        return format_parse_error(base, token, first_line, first_column);
+      }
+    }
+
+    // Keywords only count as a token when they match completely
+    for (auto lexer: {lex_null, lex_true, lex_false}) {
+      if (auto [token, new_index, error] = lexer(source, index); !token.value.empty()) {
+        return format_parse_error(base, token, first_line, first_column);
+      }
+    }
+
+    return format_error_json("Unable to lex", source, index, first_line, first_column);
+  }
+
+  std::string ParserBase::error_at_token(const std::string_view base) const {
+    return json::error_at_token(base, source, index);
+  }
+
+  std::string ParserBase::error_at_eof(const std::string_view base) const {
+    return format_error_json(base, source, std::ssize(source));
+  }
+
+  std::string_view DomBuilder::intern(const std::string_view key) {
+    // Without a document the objects copy their keys, they only have to last until end_object
+    return keys != nullptr ? keys->intern(key) : key_cache.intern(key);
+  }
+
+  DomBuilder::DomBuilder(std::pmr::memory_resource *resource, KeyTable *keys) : resource(resource), keys(keys) {}
+
+  void DomBuilder::string(const std::string_view str) { values.emplace_back(String(str, resource)); }
+
+  void DomBuilder::end_array(const size_t count) {
+    // Numeric arrays get packed into a column here
+    auto array = make_array(std::span<JSONValue>(values).last(count), resource);
+    values.erase(values.end() - static_cast<std::ptrdiff_t>(count), values.end());
+    values.push_back(std::move(array));
+  }
+
+  void DomBuilder::end_object(const size_t count) {
+    const auto first_value = values.end() - static_cast<std::ptrdiff_t>(count);
+    const auto first_key = pending_keys.end() - static_cast<std::ptrdiff_t>(count);
+    std::pmr::vector<ObjectMember> members(resource);
+    members.reserve(count);
+    for (size_t i = 0; i < count; i++)
+      members.push_back(ObjectMember{first_key[i], std::move(first_value[i])});
+    values.erase(first_value, values.end());
+    pending_keys.erase(first_key, pending_keys.end());
+    // Object sorts the members and resolves duplicate keys, later ones win same as the token based parser
+    values.emplace_back(Object(std::move(members), keys));
+  }
+
+  JSONValue DomBuilder::result() {
+    auto value = std::move(values.back());
+    values.pop_back();
+    return value;
+  }
+
+
+  JSONParser::JSONParser(const std::string_view source, std::pmr::memory_resource *resource, KeyTable *keys) :
+      source(source), resource(resource), keys(keys) {}
+
+  std::tuple<JSONValue, std::string> JSONParser::parse() {
+    DomBuilder builder(resource, keys);
+    if (auto error = BasicParser(source, builder).parse(); !error.empty()) {
+      return {JSONValue{}, error};
+    }
+    return {builder.result(), ""};
+  }
+
+  std::tuple<JSONValue, std::string> JSONParser::parse_value_at(const Offset index) {
+    DomBuilder builder(resource, keys);
+    if (auto error = BasicParser(source, builder).parse_value_at(index); !error.empty()) {
+      return {JSONValue{}, error};
+    }
+    return {builder.result(), ""};
+  }
+} // namespace json
@@ -0,0 +1,55 @@
+#include "key_table.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+namespace json {
+  namespace {
+    // Room for 32 keys before the first grow, enough for most documents. Has to stay a power of two, slot_for
+    // masks the hash with it
+    constexpr size_t initial_slots = 64;
+  } // anonymous namespace
+
+  KeyTable::KeyTable(std::pmr::memory_resource *resource) : resource(resource), slots(initial_slots, resource) {}
+
+  size_t KeyTable::slot_for(const std::string_view key) const {
+    const size_t mask = slots.size() - 1;
+    size_t slot = std::hash<std::string_view>{}(key) & mask;
+    while (slots[slot].data() != nullptr && slots[slot] != key)
+      slot = (slot + 1) & mask;
+    return slot;
+  }
+
+  void KeyTable::grow() {
+    std::pmr::vector<std::string_view> old(slots.size() * 2, resource);
+    old.swap(slots);
+    for (const auto &key: old) {
+      if (key.data() != nullptr)
+        slots[slot_for(key)] = key;
+    }
+  }
+
+  void KeyTable::insert(const std::string_view interned) {
+    // Grow once the table is half full, keeps the probe sequences short
+    if ((count + 1) * 2 > slots.size())
+      grow();
+    slots[slot_for(interned)] = interned;
+    count++;
+  }
+
+  std::string_view KeyTable::intern(const std::string_view key) {
+    if (const auto existing = slots[slot_for(key)]; existing.data() != nullptr)
+      return existing;
+
+    // At least one byte so the empty key still gets a non null pointer
+    auto *bytes = static_cast<char *>(resource->allocate(std::max<size_t>(key.size(), 1), 1));
+    std::memcpy(bytes, key.data(), key.size());
+    const std::string_view interned(bytes, key.size());
+    insert(interned);
+    key_bytes += key.size();
+    return interned;
+  }
+
+  std::string_view KeyTable::find(const std::string_view key) const { return slots[slot_for(key)]; }
+} // namespace json
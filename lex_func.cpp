@@ -4,103 +4,210 @@
 
 #include "lex_func.hpp"
 
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
 #include <sstream>
 
 namespace json {
-  static std::tuple<JSONToken, int, std::string> lex_keyword(std::string_view raw_json, std::string_view keyword,
-                                                             JSONTokenType type, int original_index) {
-    int index = original_index;
+  static std::tuple<JSONToken, Offset, std::string> lex_keyword(std::string_view raw_json, std::string_view keyword,
+                                                             JSONTokenType type, Offset original_index) {
+    Offset index = original_index;
     JSONToken token{"", type, index, raw_json};
-    int raw_json_length = static_cast<int>(std::ssize(raw_json));
+    Offset raw_json_length = std::ssize(raw_json);
     while (index != raw_json_length && keyword[index - original_index] == raw_json[index]) {
       index++;
     }
 
-    if (index - original_index == static_cast<int>(std::ssize(keyword))) {
+    if (index - original_index == std::ssize(keyword)) {
       token.value = keyword;
     }
     return std::make_tuple( token, index, "" );
   }
 
-  std::tuple<JSONToken, int, std::string> lex_string(std::string_view raw_json, int original_index) {
-    int index{original_index};
-    JSONToken token{"", JSONTokenType::String, index, raw_json};
-    auto c = raw_json[index];
+  namespace {
+    // Value of the 4 hex digits at index, nullopt if they aren't all hex
+    std::optional<uint32_t> hex4(const std::string_view raw_json, const Offset index) {
+      uint32_t value = 0;
+      const auto *first = raw_json.data() + index;
+      const auto [end, ec] = std::from_chars(first, first + 4, value, 16);
+      if (ec != std::errc{} || end != first + 4)
+        return std::nullopt;
+      return value;
+    }
 
-    if (c != '"') {
-      return std::make_tuple( token, original_index, "" );
+    template<typename Str>
+    void append_utf8(Str &out, const uint32_t code_point) {
+      char bytes[4];
+      size_t length;
+      if (code_point < 0x80) {
+        bytes[0] = static_cast<char>(code_point);
+        length = 1;
+      } else if (code_point < 0x800) {
+        bytes[0] = static_cast<char>(0xc0 | (code_point >> 6));
+        bytes[1] = static_cast<char>(0x80 | (code_point & 0x3f));
+        length = 2;
+      } else if (code_point < 0x10000) {
+        bytes[0] = static_cast<char>(0xe0 | (code_point >> 12));
+        bytes[1] = static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+        bytes[2] = static_cast<char>(0x80 | (code_point & 0x3f));
+        length = 3;
+      } else {
+        bytes[0] = static_cast<char>(0xf0 | (code_point >> 18));
+        bytes[1] = static_cast<char>(0x80 | ((code_point >> 12) & 0x3f));
+        bytes[2] = static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+        bytes[3] = static_cast<char>(0x80 | (code_point & 0x3f));
+        length = 4;
+      }
+      out.append(bytes, length);
+    }
+
+    // index is on the 'u', on success it's left on the last hex digit
+    // Characters outside the BMP come as a surrogate pair (ie \ud83d\ude00), both halves make one character
+    template<typename Str>
+    std::string_view decode_unicode_escape(const std::string_view raw_json, Offset &index, Str &out) {
+      const Offset size = std::ssize(raw_json);
+      if (index + 4 >= size)
+        return "Incomplete Unicode escape sequence";
+      const auto unit = hex4(raw_json, index + 1);
+      if (!unit)
+        return "Invalid Unicode escape sequence";
+
+      if (*unit >= 0xdc00 && *unit <= 0xdfff)
+        return "Unpaired surrogate in Unicode escape sequence";
+      if (*unit < 0xd800 || *unit > 0xdbff) {
+        append_utf8(out, *unit);
+        index += 4;
+        return "";
+      }
+
+      // High surrogate, the low one has to follow right away
+      if (index + 10 >= size) {
+        index += 5;
+        return "Incomplete Unicode escape sequence";
+      }
+      if (raw_json[index + 5] != '\\' || raw_json[index + 6] != 'u')
+        return "Unpaired surrogate in Unicode escape sequence";
+      const auto low = hex4(raw_json, index + 7);
+      if (!low) {
+        index += 6;
+        return "Invalid Unicode escape sequence";
+      }
+      if (*low < 0xdc00 || *low > 0xdfff)
+        return "Unpaired surrogate in Unicode escape sequence";
+
+      append_utf8(out, 0x10000 + ((*unit - 0xd800) << 10) + (*low - 0xdc00));
+      index += 10;
+      return "";
+    }
+  } // anonymous namespace
+
+  // Decodes the string starting at original_index into out, shared by lex_string and the parsers
+  // Returns the index after the closing quote (or original_index if there's no string there), on errors
+  // the index of the problem and what went wrong without a location
+  //
+  // Runs without escapes are found with find_string_special (SIMD where available) and copied in one go,
+  // so only the escapes themselves are handled a character at a time
+  template<typename Str>
+  std::tuple<Offset, std::string_view> decode_string_raw(std::string_view raw_json, Offset original_index, Str &out) {
+    Offset index{original_index};
+    if (raw_json[index] != '"') {
+      return {original_index, ""};
     }
 
     index++; // move past opening quote
 
-    while (index < static_cast<int>(std::ssize(raw_json))) {
-      c = raw_json[index];
+    const Offset size = std::ssize(raw_json);
+    while (index < size) {
+      const auto run = static_cast<Offset>(find_string_special(raw_json.substr(index)));
+      out.append(raw_json.data() + index, run);
+      index += run;
+      if (index >= size) {
+        break;
+      }
 
+      auto c = raw_json[index];
       if (c == '"') {
         // Found end of string
         index++; // move past closing quote
-        return std::make_tuple( token, index, "" );
+        return {index, ""};
+      }
+      if (c != '\\') {
+        return {index, "Unescaped control character in string"};
       }
 
-      if (c == '\\') {
-        // Handle escape sequences
-        if (index + 1 >= static_cast<int>(std::ssize(raw_json))) {
-          return {token, index, format_error_json("Unexpected EOF after backslash", raw_json, index)};
-        }
-
-        index++; // move to character after backslash
-        c = raw_json[index];
-
-        switch (c) {
-          case '"':
-            token.value += '"';
-            break;
-          case '\\':
-            token.value += '\\';
-            break;
-          case '/':
-            token.value += '/';
-            break;
-          case 'b':
-            token.value += '\b';
-            break;
-          case 'f':
-            token.value += '\f';
-            break;
-          case 'n':
-            token.value += '\n';
-            break;
-          case 'r':
-            token.value += '\r';
-            break;
-          case 't':
-            token.value += '\t';
-            break;
-          case 'u':
-            // Handle Unicode escape sequences
-            if (index + 4 >= static_cast<int>(std::ssize(raw_json))) {
-              return {token, index, format_error_json("Incomplete Unicode escape sequence", raw_json, index)};
-            }
-            // TODO: Implement Unicode escape sequence handling
-            // For now, just skip the next 4 characters
-            index += 4;
-            break;
-          default:
-            return {token, index, format_error_json("Invalid escape sequence", raw_json, index)};
-        }
-      } else {
-        token.value += c;
+      // Handle escape sequences
+      if (index + 1 >= size) {
+        return {index, "Unexpected EOF after backslash"};
+      }
+
+      index++; // move to character after backslash
+      c = raw_json[index];
+
+      switch (c) {
+        case '"':
+          out += '"';
+          break;
+        case '\\':
+          out += '\\';
+          break;
+        case '/':
+          out += '/';
+          break;
+        case 'b':
+          out += '\b';
+          break;
+        case 'f':
+          out += '\f';
+          break;
+        case 'n':
+          out += '\n';
+          break;
+        case 'r':
+          out += '\r';
+          break;
+        case 't':
+          out += '\t';
+          break;
+        case 'u':
+          if (const auto error = decode_unicode_escape(raw_json, index, out); !error.empty()) {
+            return {index, error};
+          }
+          break;
+        default:
+          return {index, "Invalid escape sequence"};
       }
 
       index++;
     }
 
-    return {token, index, format_error_json("Unterminated string", raw_json, index)};
+    return {index, "Unterminated string"};
   }
 
-  std::tuple<JSONToken, int, std::string> lex_number(std::string_view raw_json, int index) {
-    JSONToken token{"", JSONTokenType::Number, index, raw_json};
+  template std::tuple<Offset, std::string_view> decode_string_raw(std::string_view, Offset, std::string &);
+  template std::tuple<Offset, std::string_view> decode_string_raw(std::string_view, Offset, String &);
+
+  template<typename Str>
+  std::tuple<Offset, std::string> decode_string(std::string_view raw_json, Offset original_index, Str &out) {
+    auto [index, error] = decode_string_raw(raw_json, original_index, out);
+    if (!error.empty()) {
+      return {index, format_error_json(error, raw_json, index)};
+    }
+    return {index, ""};
+  }
+
+  template std::tuple<Offset, std::string> decode_string(std::string_view, Offset, std::string &);
+  template std::tuple<Offset, std::string> decode_string(std::string_view, Offset, String &);
+
+  std::tuple<JSONToken, Offset, std::string> lex_string(std::string_view raw_json, Offset original_index) {
+    JSONToken token{"", JSONTokenType::String, original_index, raw_json};
+    auto [index, error] = decode_string(raw_json, original_index, token.value);
+    return {std::move(token), index, std::move(error)};
+  }
+
+  Offset number_length(const std::string_view raw_json, const Offset index) {
     std::string_view slice = raw_json.substr(index);
 
     // Find the length of the number in the original string
@@ -139,16 +246,50 @@ namespace json {
       }
     }
 
-    if (!has_digit) {
+    return has_digit ? static_cast<Offset>(num_length) : 0;
+  }
+
+  std::optional<Number> to_number(const std::string_view text) {
+    const auto *first = text.data();
+    const auto *last = text.data() + text.size();
+
+    // Plain integers are the common case, -0 has to stay a double to keep its sign
+    if (text.find_first_of(".eE") == std::string_view::npos && text != "-0") {
+      std::int64_t integer;
+      if (const auto [end, ec] = std::from_chars(first, last, integer); ec == std::errc{} && end == last)
+        return integer;
+      // Too big, falls through to a double
+    }
+
+    double number;
+    const auto [end, ec] = std::from_chars(first, last, number);
+    if (ec == std::errc::result_out_of_range) {
+      // from_chars leaves the value alone when it's out of range (stod used to throw). Too small rounds to
+      // zero or a denormal like strtod does it, too big is an error since there's no JSON for infinity
+      const auto saturated = std::strtod(std::string(text).c_str(), nullptr);
+      if (std::isinf(saturated))
+        return std::nullopt;
+      return saturated;
+    }
+    if (ec != std::errc{})
+      return std::nullopt;
+    // A dangling exponent ("1e") just ends the number, same as stod
+    return number;
+  }
+
+  std::tuple<JSONToken, Offset, std::string> lex_number(std::string_view raw_json, Offset index) {
+    JSONToken token{"", JSONTokenType::Number, index, raw_json};
+    const auto length = number_length(raw_json, index);
+    if (length == 0) {
       return std::make_tuple( token, index, "" );
     }
 
-    token.value = std::string(slice.substr(0, num_length));
-    return {token, index + static_cast<int>(num_length), ""};
+    token.value = std::string(raw_json.substr(index, length));
+    return {token, index + length, ""};
   }
 
   // Syntax elements are ( ',' -> ':' -> '{' -> '}' -> '[' -> ']')
-  std::tuple<JSONToken, int, std::string> lex_syntax(std::string_view raw_json, int index) {
+  std::tuple<JSONToken, Offset, std::string> lex_syntax(std::string_view raw_json, Offset index) {
     JSONToken token{"", JSONTokenType::Syntax, index, raw_json};
     std::string value{};
     auto c = raw_json[index];
@@ -160,15 +301,39 @@ namespace json {
     return std::make_tuple( token, index, "" );
   }
 
-  std::tuple<JSONToken, int, std::string> lex_null(std::string_view raw_json, int index) {
+  Lexer lexer_for(const char c) {
+    switch (c) {
+      case '[':
+      case ']':
+      case '{':
+      case '}':
+      case ':':
+      case ',':
+        return lex_syntax;
+      case '"':
+        return lex_string;
+      case 'n':
+        return lex_null;
+      case 't':
+        return lex_true;
+      case 'f':
+        return lex_false;
+      default:
+        if (c == '-' || std::isdigit(static_cast<unsigned char>(c)) || c == '.')
+          return lex_number;
+        return nullptr;
+    }
+  }
+
+  std::tuple<JSONToken, Offset, std::string> lex_null(std::string_view raw_json, Offset index) {
     return lex_keyword(raw_json, "null", JSONTokenType::Null, index);
   }
 
-  std::tuple<JSONToken, int, std::string> lex_true(std::string_view raw_json, int index) {
+  std::tuple<JSONToken, Offset, std::string> lex_true(std::string_view raw_json, Offset index) {
     return lex_keyword(raw_json, "true", JSONTokenType::Boolean, index);
   }
 
-  std::tuple<JSONToken, int, std::string> lex_false(std::string_view raw_json, int index) {
+  std::tuple<JSONToken, Offset, std::string> lex_false(std::string_view raw_json, Offset index) {
     return lex_keyword(raw_json, "false", JSONTokenType::Boolean, index);
   }
 } // namespace json
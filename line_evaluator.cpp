@@ -0,0 +1,93 @@
+#include "line_evaluator.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <deque>
+#include <future>
+#include <memory_resource>
+#include "evaluator.hpp"
+#include "json_parser.hpp"
+#include "key_table.hpp"
+#include "writer.hpp"
+
+LineEvaluator::LineEvaluator(const Expr &expr, json::ThreadPool &pool, const size_t chunk_size) :
+    program(Program::compile(expr)), pool(pool), chunk_size(std::max<size_t>(chunk_size, 1)) {}
+
+LineEvaluator::Chunk LineEvaluator::evaluateChunk(const std::string_view chunk) const {
+  Chunk result;
+  // Records are small, one arena per chunk that gets reset after every record saves hitting the heap for each
+  // node. Keys are interned per record too, in the same arena
+  std::pmr::monotonic_buffer_resource arena(64 * 1024);
+
+  size_t start = 0;
+  while (start < chunk.size()) {
+    auto end = chunk.find('\n', start);
+    if (end == std::string_view::npos)
+      end = chunk.size();
+    auto line = chunk.substr(start, end - start);
+    const auto line_index = result.lines++;
+    start = end + 1;
+
+    if (!line.empty() && line.back() == '\r')
+      line.remove_suffix(1);
+    if (std::all_of(line.begin(), line.end(), [](const unsigned char c) { return std::isspace(c); }))
+      continue;
+
+    {
+      json::KeyTable keys(&arena);
+      auto [value, json_error] = json::JSONParser(line, &arena, &keys).parse();
+      if (!json_error.empty()) {
+        result.errors.emplace_back(line_index, "JSON parse error: " + json_error);
+      } else {
+        try {
+          Evaluator evaluator(value);
+          json::Writer writer(result.output);
+          evaluator.evaluateRef(program).write(writer);
+        } catch (const std::exception &e) {
+          result.errors.emplace_back(line_index, std::string("Expression evaluation error: ") + e.what());
+        }
+      }
+      result.output += '\n';
+    }
+    arena.release();
+  }
+  return result;
+}
+
+size_t LineEvaluator::run(const std::string_view source, const std::function<void(std::string_view)> &write,
+                          const std::function<void(size_t, const std::string &)> &error) const {
+  // A couple of chunks per worker in flight keeps everyone busy without holding on to every result
+  const auto max_pending = pool.size() * 2;
+  std::deque<std::future<Chunk>> pending;
+  size_t first_line = 0;
+  size_t failed = 0;
+
+  auto flush = [&] {
+    const auto chunk = pending.front().get();
+    pending.pop_front();
+    write(chunk.output);
+    for (const auto &[line, message]: chunk.errors)
+      error(first_line + line + 1, message);
+    failed += chunk.errors.size();
+    first_line += chunk.lines;
+  };
+
+  size_t start = 0;
+  while (start < source.size()) {
+    // Chunks end on a line boundary
+    auto end = std::min(start + chunk_size, source.size());
+    if (end < source.size()) {
+      const auto newline = source.find('\n', end - 1);
+      end = newline == std::string_view::npos ? source.size() : newline + 1;
+    }
+    const auto chunk = source.substr(start, end - start);
+    pending.push_back(pool.submit([this, chunk] { return evaluateChunk(chunk); }));
+    start = end;
+
+    if (pending.size() >= max_pending)
+      flush();
+  }
+  while (!pending.empty())
+    flush();
+  return failed;
+}
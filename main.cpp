@@ -1,46 +1,344 @@
 
 
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <optional>
 #include <ostream>
-#include <sstream>
+#include <vector>
+#include "document.hpp"
 #include "evaluator.hpp"
+#include "expr_batch.hpp"
 #include "expr_parser.hpp"
 #include "json.hpp"
+#include "line_evaluator.hpp"
+#include "mapped_file.hpp"
+#include "ondemand.hpp"
+#include "path_matcher.hpp"
+#include "program.hpp"
+#include "query_server.hpp"
+#include "run_stats.hpp"
+#include "sax.hpp"
+#include "thread_pool.hpp"
+#include "writer.hpp"
+
+namespace {
+  // Set by --pretty, --lines output stays one record per line either way
+  auto style = json::Writer::Style::Compact;
+
+  // Set by --stats, the report goes to stderr once we're done
+  std::optional<json::RunStats> stats;
+
+  // Times the rest of the scope when --stats is on
+  std::optional<json::RunStats::Scope> phase(const char *name) {
+    if (!stats)
+      return std::nullopt;
+    return stats->phase(name);
+  }
+
+  void count(const char *counter, const uint64_t value) {
+    if (stats)
+      stats->set(counter, value);
+  }
+
+  // Files this big are worth starting a thread per core for, a top level array gets parsed a chunk per core
+  constexpr size_t parallel_parse_size = 4 << 20;
+
+  std::tuple<json::Document, std::string> parseDocument(const std::string_view source) {
+    const auto timing = phase("parse");
+    if (source.size() < parallel_parse_size)
+      return json::Document::parse(source);
+    json::ThreadPool pool;
+    return json::Document::parse(source, pool);
+  }
+
+  // Only walks the tree when somebody's going to look at the numbers
+  void countDocument(const json::Document &document) {
+    if (!stats)
+      return;
+    const auto dom = json::dom_stats(document.root());
+    stats->set("tokens", dom.tokens);
+    stats->set("dom_nodes", dom.nodes);
+    stats->set("dom_bytes", document.memory_used());
+  }
+
+  std::unique_ptr<Expr> parseExpression(const char *expression) {
+    const auto timing = phase("expression_parse");
+    ExprParser parser;
+    return parser.parse(expression);
+  }
+
+  struct StatsReport {
+    StatsReport() = default;
+    StatsReport(const StatsReport &) = delete;
+    StatsReport &operator=(const StatsReport &) = delete;
+    ~StatsReport() {
+      if (!stats)
+        return;
+      std::cout.flush();
+      std::cerr << stats->to_json() << std::endl;
+    }
+  };
+
+  Program compile(const Expr &expr) {
+    const auto timing = phase("compile");
+    return Program::compile(expr);
+  }
+
+  // Results go out through the writer as they're serialized, so a huge one never exists as one string
+  void print(const EvalResult &result) {
+    const auto timing = phase("output");
+    json::Writer writer(std::cout, style);
+    result.write(writer);
+    writer.raw('\n');
+  }
+
+  // Only parses what the expression touches, parts of the file the expression doesn't go through
+  // aren't validated
+  int evaluateOnDemand(const std::string_view source, const char *expression) {
+    auto [document, json_error] = [source] {
+      const auto timing = phase("parse");
+      return json::OnDemandDocument::parse(source);
+    }();
+    if (!json_error.empty()) {
+      std::cerr << "JSON parse error: " << json_error << std::endl;
+      return 1;
+    }
+
+    try {
+      const auto program = compile(*parseExpression(expression));
+      Evaluator evaluator(document);
+      const auto result = [&] {
+        const auto timing = phase("evaluate");
+        return evaluator.evaluateRef(program);
+      }();
+      print(result);
+    } catch (const std::exception &e) {
+      std::cerr << "Expression evaluation error: " << e.what() << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  // Reads the file a chunk at a time and never keeps more than the matched value, only works for paths
+  int evaluateStreaming(const char *path, const char *expression) {
+    try {
+      const auto expr = parseExpression(expression);
+      const auto *path_expr = dynamic_cast<const PathExpr *>(expr.get());
+      if (path_expr == nullptr) {
+        throw std::runtime_error("--stream only supports path expressions");
+      }
+      PathMatcher matcher(*path_expr);
+
+      std::ifstream file(path, std::ios::binary);
+      if (!file.is_open()) {
+        std::cerr << "Failed to open file: " << path << std::endl;
+        return 1;
+      }
+      {
+        // Parsing and matching are one pass here
+        const auto timing = phase("evaluate");
+        if (const auto json_error = json::parse_sax(file, matcher); !json_error.empty()) {
+          std::cerr << "JSON parse error: " << json_error << std::endl;
+          return 1;
+        }
+        std::error_code size_error;
+        count("bytes_read", std::filesystem::file_size(path, size_error));
+      }
+      const auto timing = phase("output");
+      json::Writer writer(std::cout, style);
+      writer.write(std::move(matcher).result()).raw('\n');
+    } catch (const std::exception &e) {
+      std::cerr << "Expression evaluation error: " << e.what() << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  // One document per line, every record gets its own line of output (empty if it failed) in input order
+  int evaluateLines(const std::string_view source, const char *expression) {
+    std::unique_ptr<Expr> expr;
+    try {
+      expr = parseExpression(expression);
+    } catch (const std::exception &e) {
+      std::cerr << "Expression evaluation error: " << e.what() << std::endl;
+      return 1;
+    }
+
+    json::ThreadPool pool;
+    const LineEvaluator evaluator(*expr, pool);
+    // Records are parsed, evaluated and written out in one go
+    const auto timing = phase("evaluate");
+    const auto failed = evaluator.run(
+        source, [](const std::string_view output) { std::cout.write(output.data(), std::ssize(output)); },
+        [](const size_t line, const std::string &error) { std::cerr << "Line " << line << ": " << error << '\n'; });
+    std::cout.flush();
+    return failed == 0 ? 0 : 1;
+  }
+
+  // Every expression against one parse of the document, paths they have in common are only walked once
+  // Prints one line per expression in the order they were given, empty for the ones that failed
+  int evaluateBatch(const std::string_view source, const std::vector<const char *> &expressions) {
+    auto [document, json_error] = parseDocument(source);
+    if (!json_error.empty()) {
+      std::cerr << "JSON parse error: " << json_error << std::endl;
+      return 1;
+    }
+    countDocument(document);
+
+    std::vector<std::unique_ptr<Expr>> exprs;
+    try {
+      for (const auto *expression: expressions) {
+        exprs.push_back(parseExpression(expression));
+      }
+    } catch (const std::exception &e) {
+      std::cerr << "Expression evaluation error: " << e.what() << std::endl;
+      return 1;
+    }
+
+    const ExprBatch batch(std::move(exprs));
+    Evaluator evaluator(document.root());
+    int status = 0;
+    const auto results = [&] {
+      const auto timing = phase("evaluate");
+      return evaluator.evaluateAll(batch);
+    }();
+    const auto timing = phase("output");
+    json::Writer writer(std::cout, style);
+    for (size_t i = 0; i < results.size(); i++) {
+      const auto &[result, error] = results[i];
+      if (result) {
+        result->write(writer);
+      } else {
+        // Flushed first so the error lines up with where it would go in the output
+        writer.flush();
+        std::cout.flush();
+        std::cerr << "Expression " << i + 1 << ": Expression evaluation error: " << error << '\n';
+        status = 1;
+      }
+      writer.raw('\n');
+    }
+    writer.flush();
+    std::cout.flush();
+    return status;
+  }
+
+  // Keeps the documents loaded and answers queries from stdin, or a Unix socket, until told to stop
+  // arguments: [--socket <path>] [<name>=<json_file>]...
+  int serve(const std::vector<std::string_view> &arguments) {
+    QueryServer server;
+    std::string socket;
+    for (size_t i = 0; i < arguments.size(); i++) {
+      if (arguments[i] == "--socket" && i + 1 < arguments.size()) {
+        socket = arguments[++i];
+        continue;
+      }
+      const auto separator = arguments[i].find('=');
+      if (separator == std::string_view::npos) {
+        std::cerr << "Expected <name>=<json_file>, got " << arguments[i] << std::endl;
+        return 1;
+      }
+      const auto error = server.load(std::string(arguments[i].substr(0, separator)),
+                                     std::string(arguments[i].substr(separator + 1)));
+      if (!error.empty()) {
+        std::cerr << error << std::endl;
+        return 1;
+      }
+    }
+
+    if (socket.empty()) {
+      server.serve(std::cin, std::cout);
+      return 0;
+    }
+    if (const auto error = server.serve_socket(socket); !error.empty()) {
+      std::cerr << error << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+} // anonymous namespace
+
 int main(int argc, char *argv[]) {
-  if (argc != 3) {
-    std::cerr << "Usage: " << argv[0] << " <json_file> <expression>" << std::endl;
+  // Options that work with every mode come first
+  while (argc >= 2 && (std::string_view(argv[1]) == "--pretty" || std::string_view(argv[1]) == "--stats")) {
+    if (std::string_view(argv[1]) == "--pretty")
+      style = json::Writer::Style::Pretty;
+    else
+      stats.emplace();
+    argv[1] = argv[0];
+    argv++;
+    argc--;
+  }
+
+  // Prints the --stats report on the way out, whichever return that is
+  const StatsReport report;
+
+  if (argc >= 2 && std::string_view(argv[1]) == "--serve") {
+    return serve(std::vector<std::string_view>(argv + 2, argv + argc));
+  }
+
+  const std::string_view mode = argc >= 4 ? argv[1] : "";
+  const bool batch = mode == "--batch";
+  if (!batch && ((argc != 3 && argc != 4) ||
+                 (argc == 4 && mode != "--on-demand" && mode != "--stream" && mode != "--lines"))) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--pretty] [--stats] [--on-demand | --stream | --lines] <json_file> <expression>" << std::endl;
+    std::cerr << "       " << argv[0] << " [--pretty] [--stats] --batch <json_file> <expression>..." << std::endl;
+    std::cerr << "       " << argv[0] << " --serve [--socket <path>] [<name>=<json_file>]..." << std::endl;
     return 1;
   }
+  const char *path = batch ? argv[2] : argv[argc - 2];
+  const char *expression = argv[argc - 1];
 
-  // Open and read the JSON file
-  std::ifstream file(argv[1]);
-  if (!file.is_open()) {
-    std::cerr << "Failed to open file: " << argv[1] << std::endl;
+  if (mode == "--stream") {
+    return evaluateStreaming(path, expression);
+  }
+
+  // Map the JSON file instead of reading it, the parsers work straight off the mapping
+  // Pages are only read as the parser gets to them, so most of the reading shows up as parse time
+  auto [file, file_error] = [path] {
+    const auto timing = phase("read");
+    return json::MappedFile::open(path);
+  }();
+  if (!file_error.empty()) {
+    std::cerr << file_error << std::endl;
     return 1;
   }
+  count("bytes_read", file.view().size());
 
-  std::stringstream buffer;
-  buffer << file.rdbuf();
-  file.close();
+  if (mode == "--on-demand") {
+    return evaluateOnDemand(file.view(), expression);
+  }
+  if (mode == "--lines") {
+    return evaluateLines(file.view(), expression);
+  }
+  if (batch) {
+    return evaluateBatch(file.view(), std::vector<const char *>(argv + 3, argv + argc));
+  }
 
-  // Parse the JSON file
-  auto [json_ast, json_error] = json::parse(buffer.str());
+  // Parse the JSON file, the whole tree lives in the document's arena
+  auto [document, json_error] = parseDocument(file.view());
   if (!json_error.empty()) {
     std::cerr << "JSON parse error: " << json_error << std::endl;
     return 1;
   }
+  countDocument(document);
 
   // Parse the expression
-  ExprParser parser;
   try {
-    auto expr = parser.parse(argv[2]);
+    auto expr = parseExpression(expression);
+    // Compiling merges repeated subexpressions so each is only evaluated once
+    const auto program = compile(*expr);
 
-    // Evaluator uses the json_ast as the basis for querying,
-    // expr is the thing to evaluate (uses the json_ast as the tree to search)
-    Evaluator evaluator(json_ast);
-    auto result = evaluator.evaluate(expr);
-    std::cout << json::deparse(result) << std::endl;
+    // Evaluator uses the document root as the basis for querying,
+    // expr is the thing to evaluate (uses the document root as the tree to search)
+    Evaluator evaluator(document.root());
+    // Borrowed result, the document outlives it so there's no need to copy
+    const auto result = [&] {
+      const auto timing = phase("evaluate");
+      return evaluator.evaluateRef(program);
+    }();
+    print(result);
   } catch (const std::exception &e) {
     std::cerr << "Expression evaluation error: " << e.what() << std::endl;
     return 1;
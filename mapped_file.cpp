@@ -0,0 +1,97 @@
+#include "mapped_file.hpp"
+
+#include <utility>
+
+#ifdef _WIN32
+#include <fstream>
+#include <sstream>
+#else
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace json {
+  MappedFile::MappedFile(MappedFile &&other) noexcept { *this = std::move(other); }
+
+  MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+    if (this != &other) {
+      unmap();
+      data = std::exchange(other.data, nullptr);
+      size = std::exchange(other.size, 0);
+#ifdef _WIN32
+      contents = std::move(other.contents);
+      data = contents.data();
+#endif
+    }
+    return *this;
+  }
+
+  MappedFile::~MappedFile() { unmap(); }
+
+#ifdef _WIN32
+  void MappedFile::unmap() {
+    contents.clear();
+    data = nullptr;
+    size = 0;
+  }
+
+  std::tuple<MappedFile, std::string> MappedFile::open(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+      return {MappedFile{}, "Failed to open file: " + path};
+    }
+    std::ostringstream buffer;
+    buffer << file.rdbuf();
+
+    MappedFile mapped;
+    mapped.contents = std::move(buffer).str();
+    mapped.data = mapped.contents.data();
+    mapped.size = mapped.contents.size();
+    return {std::move(mapped), ""};
+  }
+#else
+  void MappedFile::unmap() {
+    if (data != nullptr && size > 0) {
+      munmap(const_cast<char *>(data), size);
+    }
+    data = nullptr;
+    size = 0;
+  }
+
+  std::tuple<MappedFile, std::string> MappedFile::open(const std::string &path) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return {MappedFile{}, "Failed to open file: " + path};
+    }
+
+    struct stat info{};
+    if (fstat(fd, &info) != 0) {
+      const std::string error = std::strerror(errno);
+      close(fd);
+      return {MappedFile{}, "Failed to stat file: " + path + ": " + error};
+    }
+
+    MappedFile mapped;
+    // mmap doesn't do empty mappings, an empty view is all we need anyway
+    if (info.st_size > 0) {
+      void *address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      if (address == MAP_FAILED) {
+        const std::string error = std::strerror(errno);
+        close(fd);
+        return {MappedFile{}, "Failed to map file: " + path + ": " + error};
+      }
+      // Every parser reads front to back, so let the kernel read ahead
+      madvise(address, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+      mapped.data = static_cast<const char *>(address);
+      mapped.size = static_cast<size_t>(info.st_size);
+    }
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    return {std::move(mapped), ""};
+  }
+#endif
+} // namespace json
@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "json.hpp"
+
+namespace json {
+  namespace {
+    // Below this a linear scan beats binary search, the members are right next to each other anyway
+    constexpr size_t linear_search_limit = 8;
+  } // anonymous namespace
+
+  // Header of the block, the key bytes follow right after it
+  struct Object::OwnedKeys {
+    std::atomic<size_t> references{1};
+
+    char *bytes() { return reinterpret_cast<char *>(this + 1); }
+  };
+
+  void Object::own_keys() {
+    if (members.empty()) {
+      release_keys();
+      return;
+    }
+    size_t size = 0;
+    for (const auto &member: members)
+      size += member.key.size();
+    auto *block = new (::operator new(sizeof(OwnedKeys) + size)) OwnedKeys();
+    char *out = block->bytes();
+    for (auto &member: members) {
+      std::memcpy(out, member.key.data(), member.key.size());
+      member.key = std::string_view(out, member.key.size());
+      out += member.key.size();
+    }
+    // Only now, the keys might have been in the old block
+    release_keys();
+    owned_keys = block;
+  }
+
+  void Object::release_keys() {
+    if (owned_keys != nullptr && owned_keys->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      owned_keys->~OwnedKeys();
+      ::operator delete(owned_keys);
+    }
+    owned_keys = nullptr;
+  }
+
+  Object::Object() = default;
+
+  Object::Object(const allocator_type allocator) : members(allocator) {}
+
+  Object::Object(std::pmr::vector<ObjectMember> &&unsorted, const KeyTable *keys) :
+      members(std::move(unsorted)) {
+    // Stable so that for duplicate keys the one that came last is still last
+    // Most objects are small, an insertion sort there saves stable_sort's temporary buffer
+    const auto less = [](const ObjectMember &a, const ObjectMember &b) { return a.key < b.key; };
+    if (members.size() <= linear_search_limit) {
+      for (auto it = members.begin(); it != members.end(); ++it) {
+        for (auto j = it; j != members.begin() && less(*j, *std::prev(j)); --j)
+          std::iter_swap(j, std::prev(j));
+      }
+    } else if (!std::is_sorted(members.begin(), members.end(), less)) {
+      std::stable_sort(members.begin(), members.end(), less);
+    }
+
+    // Keep the last member of every run of equal keys
+    auto out = members.begin();
+    for (auto it = members.begin(); it != members.end(); ++it) {
+      if (std::next(it) != members.end() && std::next(it)->key == it->key)
+        continue;
+      if (out != it)
+        *out = std::move(*it);
+      ++out;
+    }
+    members.erase(out, members.end());
+    if (keys == nullptr)
+      own_keys();
+  }
+
+  Object::Object(const Object &other) : members(other.members), owned_keys(other.owned_keys) {
+    // Keys of a KeyTable only live as long as the table, so they get copied. A block can just be shared
+    if (owned_keys != nullptr)
+      owned_keys->references.fetch_add(1, std::memory_order_relaxed);
+    else
+      own_keys();
+  }
+
+  Object::Object(Object &&other) noexcept :
+      members(std::move(other.members)), owned_keys(std::exchange(other.owned_keys, nullptr)) {}
+
+  Object &Object::operator=(const Object &other) {
+    if (this != &other)
+      *this = Object(other);
+    return *this;
+  }
+
+  Object &Object::operator=(Object &&other) {
+    if (this != &other) {
+      members = std::move(other.members);
+      release_keys();
+      owned_keys = std::exchange(other.owned_keys, nullptr);
+    }
+    return *this;
+  }
+
+  Object::~Object() { release_keys(); }
+
+  Object::const_iterator Object::find(const std::string_view key) const {
+    if (members.size() <= linear_search_limit) {
+      return std::find_if(begin(), end(), [key](const ObjectMember &member) { return member.key == key; });
+    }
+
+    const auto it = std::lower_bound(begin(), end(), key,
+                                     [](const ObjectMember &member, std::string_view k) { return member.key < k; });
+    return it != end() && it->key == key ? it : end();
+  }
+
+  const JSONValue &Object::at(const std::string_view key) const {
+    const auto it = find(key);
+    if (it == end())
+      throw std::out_of_range("Object has no key: " + std::string(key));
+    return it->value;
+  }
+
+  bool Object::contains(const std::string_view key) const { return find(key) != end(); }
+
+  void Object::insert_or_assign(const std::string_view key, JSONValue value) {
+    const auto it = std::lower_bound(members.begin(), members.end(), key,
+                                     [](const ObjectMember &member, std::string_view k) { return member.key < k; });
+    if (it != members.end() && it->key == key) {
+      it->value = std::move(value);
+      return;
+    }
+    // The block is shared and never changes, so a new key means a new block with all of them
+    members.insert(it, ObjectMember{key, std::move(value)});
+    own_keys();
+  }
+
+  Object::const_iterator Object::begin() const { return members.data(); }
+
+  Object::const_iterator Object::end() const { return members.data() + members.size(); }
+
+  size_t Object::size() const { return members.size(); }
+
+  bool Object::empty() const { return members.empty(); }
+
+  Object::allocator_type Object::get_allocator() const { return members.get_allocator(); }
+} // namespace json
@@ -0,0 +1,279 @@
+#include "ondemand.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include "json_parser.hpp"
+#include "lex_func.hpp"
+
+namespace json {
+  namespace {
+    // Scans containers without building anything, the errors read the same as the DOM parser's
+    class RawWalker : protected ParserBase {
+    private:
+      // Moves past the value at index, containers are skipped by counting brackets on the token starts the
+      // scanner finds, so strings inside them are never looked at. Only strings are checked on the way,
+      // anything else is validated when it gets materialized
+      std::string skip_value() {
+        const auto c = source[index];
+        if (c == '"') {
+          auto [_, error] = parse_string();
+          return error;
+        }
+        if (c == ']' || c == '}' || c == ':' || c == ',') {
+          return error_at_token("Failed to parse");
+        }
+        if (c != '[' && c != '{') {
+          index = scanner.next(index + 1);
+          return "";
+        }
+
+        const Offset size = std::ssize(source);
+        int depth = 0;
+        for (Offset i = index; i < size; i = scanner.next(i + 1)) {
+          switch (source[i]) {
+            case '[':
+            case '{':
+              depth++;
+              break;
+            case ']':
+            case '}':
+              if (--depth == 0) {
+                index = i + 1;
+                return "";
+              }
+              break;
+            default:
+              break;
+          }
+        }
+        return error_at_eof(c == '[' ? "Unexpected EOF while parsing array" : "Unexpected EOF while parsing object");
+      }
+
+    public:
+      explicit RawWalker(const std::string_view source) : ParserBase(source) {}
+
+      std::string index_object(const Offset start, std::vector<std::pair<std::string_view, Offset>> &members,
+                               std::deque<std::string> &decoded_keys) {
+        reset(start);
+        index++; // move past '{'
+        skip_whitespace();
+        if (!at_end() && source[index] == '}') {
+          return "";
+        }
+
+        while (!at_end()) {
+          if (source[index] != '"') {
+            return error_at_token(members.empty() ? "Expected key-value pair or closing brace in object"
+                                                  : "Expected string key in object");
+          }
+          auto [key, key_error] = parse_string();
+          if (!key_error.empty()) {
+            return key_error;
+          }
+          // Escaped keys are decoded into the string buffer, which the next string overwrites
+          if (key.data() == string_buffer.data()) {
+            key = decoded_keys.emplace_back(key);
+          }
+
+          skip_whitespace();
+          if (at_end()) {
+            break;
+          }
+          if (source[index] != ':') {
+            return error_at_token("Expected colon after key in object");
+          }
+          index++;
+
+          skip_whitespace();
+          if (at_end()) {
+            break;
+          }
+          members.emplace_back(key, index);
+          if (auto error = skip_value(); !error.empty()) {
+            return error;
+          }
+
+          skip_whitespace();
+          if (at_end()) {
+            break;
+          }
+          const auto c = source[index];
+          if (c == '}') {
+            return "";
+          }
+          if (c != ',') {
+            return error_at_token("Expected comma after element in object");
+          }
+          index++; // move past ','
+          skip_whitespace();
+        }
+
+        return error_at_eof("Unexpected EOF while parsing object");
+      }
+
+      // Indexes elements until there are more than until of them (or the array ends)
+      // resume is where the next element starts, -1 before the first call
+      std::string index_array(const Offset start, std::vector<Offset> &elements, Offset &resume, bool &complete,
+                              const size_t until) {
+        if (resume < 0) {
+          reset(start);
+          index++; // move past '['
+          skip_whitespace();
+          if (!at_end() && source[index] == ']') {
+            complete = true;
+            return "";
+          }
+        } else {
+          reset(resume);
+        }
+
+        while (!at_end()) {
+          elements.push_back(index);
+          if (auto error = skip_value(); !error.empty()) {
+            return error;
+          }
+
+          skip_whitespace();
+          if (at_end()) {
+            break;
+          }
+          const auto c = source[index];
+          if (c == ']') {
+            complete = true;
+            return "";
+          }
+          if (c != ',') {
+            return error_at_token("Expected comma after element in array");
+          }
+          index++; // move past ','
+          skip_whitespace();
+
+          if (elements.size() > until) {
+            resume = index;
+            return "";
+          }
+        }
+
+        return error_at_eof("Unexpected EOF while parsing array");
+      }
+    };
+  } // anonymous namespace
+
+  std::tuple<OnDemandDocument, std::string> OnDemandDocument::parse(const std::string_view source) {
+    OnDemandDocument document;
+    document.source = source;
+    document.root_index = skip_whitespace(source, 0);
+    if (document.root_index >= std::ssize(source)) {
+      return {OnDemandDocument{}, format_error_json("Unexpected EOF", source, std::ssize(source))};
+    }
+    return {std::move(document), ""};
+  }
+
+  std::tuple<const OnDemandDocument::ObjectIndex *, std::string> OnDemandDocument::index_object(const Offset start) const {
+    if (const auto it = objects.find(start); it != objects.end()) {
+      return {&it->second, ""};
+    }
+
+    ObjectIndex entry;
+    if (auto error = RawWalker(source).index_object(start, entry.members, decoded_keys); !error.empty()) {
+      return {nullptr, error};
+    }
+
+    // Same rules as Object, sorted by key and the last duplicate wins
+    auto &members = entry.members;
+    std::stable_sort(members.begin(), members.end(),
+                     [](const auto &a, const auto &b) { return a.first < b.first; });
+    auto last = members.begin();
+    for (auto it = members.begin(); it != members.end(); ++it) {
+      if (it + 1 != members.end() && (it + 1)->first == it->first)
+        continue;
+      *last++ = *it;
+    }
+    members.erase(last, members.end());
+
+    return {&objects.emplace(start, std::move(entry)).first->second, ""};
+  }
+
+  std::tuple<const OnDemandDocument::ArrayIndex *, std::string> OnDemandDocument::index_array(const Offset start,
+                                                                                              const size_t until) const {
+    auto &entry = arrays[start];
+    if (entry.complete || entry.elements.size() > until) {
+      return {&entry, ""};
+    }
+
+    if (auto error = RawWalker(source).index_array(start, entry.elements, entry.resume, entry.complete, until);
+        !error.empty()) {
+      arrays.erase(start);
+      return {nullptr, error};
+    }
+    return {&entry, ""};
+  }
+
+  bool RawValue::is_object() const { return document->source[index] == '{'; }
+
+  bool RawValue::is_array() const { return document->source[index] == '['; }
+
+  std::tuple<std::optional<RawValue>, std::string> RawValue::find(const std::string_view key) const {
+    if (!is_object()) {
+      return {std::nullopt, ""};
+    }
+
+    auto [entry, error] = document->index_object(index);
+    if (!error.empty()) {
+      return {std::nullopt, error};
+    }
+    const auto &members = entry->members;
+    const auto it = std::lower_bound(members.begin(), members.end(), key,
+                                     [](const auto &member, const std::string_view k) { return member.first < k; });
+    if (it == members.end() || it->first != key) {
+      return {std::nullopt, ""};
+    }
+    return {RawValue(document, it->second), ""};
+  }
+
+  std::tuple<std::optional<RawValue>, std::string> RawValue::at(const size_t i) const {
+    if (!is_array()) {
+      return {std::nullopt, ""};
+    }
+
+    auto [entry, error] = document->index_array(index, i);
+    if (!error.empty()) {
+      return {std::nullopt, error};
+    }
+    if (i >= entry->elements.size()) {
+      return {std::nullopt, ""};
+    }
+    return {RawValue(document, entry->elements[i]), ""};
+  }
+
+  std::tuple<std::optional<RawValue>, std::string> RawValue::member_at(const size_t i) const {
+    if (!is_object()) {
+      return {std::nullopt, ""};
+    }
+
+    auto [entry, error] = document->index_object(index);
+    if (!error.empty()) {
+      return {std::nullopt, error};
+    }
+    if (i >= entry->members.size()) {
+      return {std::nullopt, ""};
+    }
+    return {RawValue(document, entry->members[i].second), ""};
+  }
+
+  std::tuple<size_t, std::string> RawValue::size() const {
+    if (is_object()) {
+      auto [entry, error] = document->index_object(index);
+      return {entry == nullptr ? 0 : entry->members.size(), error};
+    }
+    if (is_array()) {
+      auto [entry, error] = document->index_array(index, SIZE_MAX);
+      return {entry == nullptr ? 0 : entry->elements.size(), error};
+    }
+    return {0, ""};
+  }
+
+  std::tuple<JSONValue, std::string> RawValue::materialize() const {
+    return JSONParser(document->source).parse_value_at(index);
+  }
+} // namespace json
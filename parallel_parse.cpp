@@ -0,0 +1,163 @@
+#include "parallel_parse.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <future>
+#include "json_parser.hpp"
+#include "simd_scan.hpp"
+
+namespace json {
+  std::vector<std::pair<Offset, Offset>> split_array(const std::string_view source, const size_t chunk_size) {
+    StructuralScanner scanner(source);
+    const Offset size = std::ssize(source);
+    Offset i = scanner.next(0);
+    if (i >= size || source[i] != '[')
+      return {};
+
+    // Only brackets and top level commas matter, the scanner has already skipped the string contents
+    std::vector<std::pair<Offset, Offset>> chunks;
+    Offset first = i + 1;
+    Offset depth = 0;
+    for (; i < size; i = scanner.next(i + 1)) {
+      switch (source[i]) {
+        case '[':
+        case '{':
+          depth++;
+          break;
+        case ']':
+        case '}':
+          if (--depth == 0) {
+            chunks.emplace_back(first, i);
+            return chunks;
+          }
+          break;
+        case ',':
+          if (depth == 1 && static_cast<size_t>(i - first) >= chunk_size) {
+            chunks.emplace_back(first, i);
+            first = i + 1;
+          }
+          break;
+        default:
+          break;
+      }
+    }
+    return {};
+  }
+
+  namespace {
+    size_t size_of(const JSONValue &piece) {
+      return std::visit(
+          []<typename T>(const T &v) -> size_t {
+            if constexpr (std::is_same_v<T, Array> || std::is_same_v<T, DoubleColumn> ||
+                          std::is_same_v<T, IntegerColumn>)
+              return v.size();
+            return 0;
+          },
+          piece.value);
+    }
+
+    // Whether every element of the piece is a T, however the piece ended up stored
+    template<typename Column>
+    bool all_of_type(const JSONValue &piece) {
+      if (std::holds_alternative<Column>(piece.value))
+        return true;
+      const auto *array = std::get_if<Array>(&piece.value);
+      return array != nullptr && std::all_of(array->begin(), array->end(), [](const JSONValue &element) {
+        return std::holds_alternative<typename Column::value_type>(element.value);
+      });
+    }
+
+    template<typename Column>
+    JSONValue concatenate(std::vector<JSONValue> &pieces, const size_t count, std::pmr::memory_resource *resource) {
+      Column column(resource);
+      column.reserve(count);
+      for (const auto &piece: pieces) {
+        if (const auto *numbers = std::get_if<Column>(&piece.value)) {
+          column.insert(column.end(), numbers->begin(), numbers->end());
+        } else {
+          for (const auto &element: std::get<Array>(piece.value))
+            column.push_back(std::get<typename Column::value_type>(element.value));
+        }
+      }
+      return JSONValue(std::move(column));
+    }
+
+    // Puts the chunks back into one array. Each chunk picked its own representation, the whole array has to end
+    // up as the one make_array would have picked for all the elements at once
+    JSONValue splice(std::vector<JSONValue> &pieces, std::pmr::memory_resource *resource) {
+      size_t count = 0;
+      for (const auto &piece: pieces)
+        count += size_of(piece);
+      if (count >= min_column_size) {
+        if (std::all_of(pieces.begin(), pieces.end(), all_of_type<DoubleColumn>))
+          return concatenate<DoubleColumn>(pieces, count, resource);
+        if (std::all_of(pieces.begin(), pieces.end(), all_of_type<IntegerColumn>))
+          return concatenate<IntegerColumn>(pieces, count, resource);
+      }
+
+      // The elements keep the allocator of their chunk when they're moved over, only the array itself is new
+      Array elements(resource);
+      elements.reserve(count);
+      for (auto &piece: pieces) {
+        std::visit(
+            [&elements]<typename T>(T &v) {
+              if constexpr (std::is_same_v<T, Array>) {
+                for (auto &element: v)
+                  elements.push_back(std::move(element));
+              } else if constexpr (std::is_same_v<T, DoubleColumn> || std::is_same_v<T, IntegerColumn>) {
+                for (const auto number: v)
+                  elements.emplace_back(number);
+              }
+            },
+            piece.value);
+      }
+      return JSONValue(std::move(elements));
+    }
+  } // anonymous namespace
+
+  std::tuple<JSONValue, std::string> parse_parallel(const std::string_view source, ThreadPool &pool,
+                                                    const std::function<ChunkArena(size_t)> &chunk_arena,
+                                                    std::pmr::memory_resource *resource, KeyTable *keys,
+                                                    const size_t chunk_size) {
+    const auto sequential = [&] { return JSONParser(source, resource, keys).parse(); };
+    if (pool.size() < 2 || source.size() < 2 * chunk_size)
+      return sequential();
+
+    const auto chunks = split_array(source, chunk_size);
+    // The last chunk has to be closed by an actual ']' with nothing but whitespace after it
+    if (chunks.size() < 2 || source[chunks.back().second] != ']' ||
+        !std::all_of(source.begin() + chunks.back().second + 1, source.end(),
+                     [](const unsigned char c) { return std::isspace(c); }))
+      return sequential();
+
+    std::vector<std::future<std::tuple<JSONValue, std::string>>> parsed;
+    parsed.reserve(chunks.size());
+    for (const auto &[first, last]: chunks) {
+      const auto arena = chunk_arena(static_cast<size_t>(last - first));
+      parsed.push_back(pool.submit([source, first, last, arena]() -> std::tuple<JSONValue, std::string> {
+        DomBuilder builder(arena.resource, arena.keys);
+        if (auto error = BasicParser(source, builder).parse_elements(first, last); !error.empty())
+          return {JSONValue{}, std::move(error)};
+        return {builder.result(), ""};
+      }));
+    }
+
+    // Every future has to be waited on either way, the tasks reference the source
+    std::vector<JSONValue> pieces;
+    pieces.reserve(parsed.size());
+    bool failed = false;
+    for (auto &future: parsed) {
+      auto [piece, error] = future.get();
+      failed = failed || !error.empty();
+      pieces.push_back(std::move(piece));
+    }
+    if (failed)
+      return sequential();
+
+    return {splice(pieces, resource), ""};
+  }
+
+  std::tuple<JSONValue, std::string> parse(const std::string_view source, ThreadPool &pool) {
+    return parse_parallel(source, pool, [](size_t) { return ChunkArena{std::pmr::get_default_resource(), nullptr}; });
+  }
+} // namespace json
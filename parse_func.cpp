@@ -2,16 +2,17 @@
 
 #include "parse_func.hpp"
 #include "json.hpp"
+#include "key_table.hpp"
 
 namespace json {
   // Parses a JSON array and returns a tuple containing:
   // - Vector of parsed JSON values
   // - Next token index to process
   // - Error message (empty string if successful)
-  std::tuple<std::vector<JSONValue>, int, std::string> parse_array(const std::vector<JSONToken> &tokens, int index) {
-    std::vector<JSONValue> children{};
+  std::tuple<Array, Offset, std::string> parse_array(const std::vector<JSONToken> &tokens, Offset index) {
+    Array children{};
 
-    const int tokens_size = static_cast<int>(std::ssize(tokens));
+    const Offset tokens_size = std::ssize(tokens);
 
     // Process tokens until we reach the end
     while (index < tokens_size) {
@@ -31,8 +32,8 @@ namespace json {
         }
         // If we find a non-comma syntax token after elements exist,
         // return an error
-        else if (static_cast<int>(children.size()) > 0) {
-          return std::make_tuple(std::vector<JSONValue>{}, index, format_parse_error("Expected comma after element in array",
+        else if (!children.empty()) {
+          return std::make_tuple(Array{}, index, format_parse_error("Expected comma after element in array",
           currentToken));
         }
       }
@@ -42,7 +43,7 @@ namespace json {
 
       // If parsing produced an error, propagate it upward
       if (!error.empty()) {
-        return std::make_tuple(std::vector<JSONValue>{}, index, error);
+        return std::make_tuple(Array{}, index, error);
       }
 
       // Add successfully parsed child to array
@@ -51,7 +52,7 @@ namespace json {
     }
 
     // If we reach here, we hit EOF before finding closing bracket
-    return std::make_tuple(std::vector<JSONValue>{}, index, format_parse_error("Unexpected EOF while parsing array",
+    return std::make_tuple(Array{}, index, format_parse_error("Unexpected EOF while parsing array",
     tokens[index]) );
   }
 
@@ -60,13 +61,15 @@ namespace json {
   // - Next token index to process
   // - Error message (empty string if successful)
 
-  using JSONMap = std::map<std::string, JSONValue>;
-  std::tuple<std::map<std::string, JSONValue>, int, std::string> parse_object(const std::vector<JSONToken> &tokens,
-                                                                              int index) {
-    // Initialize empty map to store object key-value pairs
-    JSONMap values{};
+  using JSONMap = Object;
+  std::tuple<Object, Offset, std::string> parse_object(const std::vector<JSONToken> &tokens, Offset index) {
+    // Members are collected unsorted, Object sorts them (and drops duplicates) at the end
+    std::pmr::vector<ObjectMember> values{};
+    // The key tokens go away before that, so the keys are kept here until the Object copies them
+    std::pmr::monotonic_buffer_resource key_arena;
+    KeyTable keys(&key_arena);
 
-    const int tokens_size = static_cast<int>(std::ssize(tokens));
+    const Offset tokens_size = std::ssize(tokens);
 
     while (index < tokens_size) {
       auto currentToken = tokens[index];
@@ -75,7 +78,7 @@ namespace json {
       if (currentToken.type == JSONTokenType::Syntax) {
         // Check for closing brace - end of object
         if (currentToken.value == "}") {
-          return std::make_tuple(values, index + 1, "");
+          return std::make_tuple(Object(std::move(values), nullptr), index + 1, "");
         }
 
         // Handle comma separators
@@ -84,7 +87,7 @@ namespace json {
           currentToken = tokens[index];
         }
         // If we find a non-comma syntax token after elements exist
-        else if (static_cast<int>(values.size()) > 0) {
+        else if (!values.empty()) {
           return {{}, index, format_parse_error("Expected comma after element in object", currentToken)};
         }
         // Invalid syntax at start of object
@@ -100,7 +103,7 @@ namespace json {
       }
 
       // Verify the key is a string
-      if (!std::holds_alternative<std::string>(key.value)) {
+      if (!std::holds_alternative<String>(key.value)) {
         return std::make_tuple(JSONMap{}, index, format_parse_error("Expected string key in object", currentToken));
       }
       index = new_index;
@@ -121,11 +124,11 @@ namespace json {
 
       // Add the key-value pair to the map
       // key should be a string due to previous assertion
-      values[std::get<std::string>(key.value)] = value;
+      values.push_back(ObjectMember{keys.intern(std::get<String>(key.value)), value});
       index = new_index1;
     }
 
     // Return successfully parsed object
-    return std::make_tuple(values, index + 1, "");
+    return std::make_tuple(Object(std::move(values), nullptr), index + 1, "");
   }
 } // namespace json
@@ -0,0 +1,189 @@
+#include "path_matcher.hpp"
+
+#include <cstdint>
+#include <stdexcept>
+
+PathMatcher::PathMatcher(const PathExpr &path) {
+  segments.reserve(path.segments.size());
+  for (const auto &segment: path.segments) {
+    if (const auto *key = std::get_if<std::string>(&segment)) {
+      segments.emplace_back(*key);
+      continue;
+    }
+    if (std::holds_alternative<RangeSegment>(segment)) {
+      throw std::runtime_error("Streaming paths don't support wildcards or slices");
+    }
+
+    const auto *literal = dynamic_cast<const LiteralExpr *>(std::get<std::unique_ptr<Expr>>(segment).get());
+    if (literal == nullptr) {
+      throw std::runtime_error("Streaming paths only support literal array indices");
+    }
+    if (const auto *integer = std::get_if<std::int64_t>(&literal->value.value)) {
+      // Negative ones can't match anything, same as the evaluator
+      segments.emplace_back(*integer < 0 ? SIZE_MAX : static_cast<size_t>(*integer));
+    } else if (const auto *number = std::get_if<double>(&literal->value.value)) {
+      segments.emplace_back(static_cast<size_t>(*number));
+    } else {
+      throw std::runtime_error("Invalid array index type");
+    }
+  }
+}
+
+// Every value goes through here first to figure out where it is relative to the path
+// Returns true when it's part of the value the whole path resolves to
+bool PathMatcher::begin_value(const Kind kind) {
+  if (skip_depth > 0) {
+    if (kind != Kind::Scalar)
+      skip_depth++;
+    return false;
+  }
+  if (capture) {
+    return true;
+  }
+
+  // Directly inside the last matched level (or the root)
+  bool matches = next_matches;
+  next_matches = false;
+  if (!levels.empty() && levels.back().is_array) {
+    matches = levels.back().count++ == std::get<size_t>(segments[levels.size() - 1]);
+  }
+  if (!matches) {
+    if (kind != Kind::Scalar)
+      skip_depth = 1;
+    return false;
+  }
+
+  if (!levels.empty()) {
+    levels.back().found = true;
+  }
+  // Only a later duplicate key gets here twice, and like in the DOM the later one wins
+  match.reset();
+  failure.clear();
+
+  const auto depth = levels.size();
+  if (depth == segments.size()) {
+    capture.emplace();
+    capture_counts.clear();
+    return true;
+  }
+
+  const bool wants_object = std::holds_alternative<std::string>(segments[depth]);
+  if (kind != (wants_object ? Kind::Object : Kind::Array)) {
+    failure = wants_object ? "Invalid path: expected object" : "Invalid path: expected array";
+    if (kind != Kind::Scalar)
+      skip_depth = 1;
+    return false;
+  }
+  levels.push_back(Level{kind == Kind::Array});
+  return false;
+}
+
+// A value inside the capture is done
+void PathMatcher::end_value() {
+  if (!capture_counts.empty()) {
+    capture_counts.back()++;
+    return;
+  }
+  match = capture->result();
+  capture.reset();
+}
+
+void PathMatcher::end_container(const bool is_array) {
+  if (skip_depth > 0) {
+    skip_depth--;
+    return;
+  }
+
+  if (capture) {
+    const auto count = capture_counts.back();
+    capture_counts.pop_back();
+    if (is_array)
+      capture->end_array(count);
+    else
+      capture->end_object(count);
+    end_value();
+    return;
+  }
+
+  // Closing the last level on the path, if the next segment never showed up this is where the Evaluator
+  // would have stopped
+  const auto level = levels.back();
+  levels.pop_back();
+  if (!level.found) {
+    const auto &segment = segments[levels.size()];
+    failure = level.is_array ? "Array index out of bounds" : "Key not found: " + std::get<std::string>(segment);
+  }
+}
+
+void PathMatcher::on_null() {
+  if (begin_value(Kind::Scalar)) {
+    capture->null();
+    end_value();
+  }
+}
+
+void PathMatcher::on_bool(const bool b) {
+  if (begin_value(Kind::Scalar)) {
+    capture->boolean(b);
+    end_value();
+  }
+}
+
+void PathMatcher::on_number(const double n) {
+  if (begin_value(Kind::Scalar)) {
+    capture->number(n);
+    end_value();
+  }
+}
+
+void PathMatcher::on_integer(const std::int64_t n) {
+  if (begin_value(Kind::Scalar)) {
+    capture->integer(n);
+    end_value();
+  }
+}
+
+void PathMatcher::on_string(const std::string_view str) {
+  if (begin_value(Kind::Scalar)) {
+    capture->string(str);
+    end_value();
+  }
+}
+
+void PathMatcher::on_key(const std::string_view key) {
+  if (skip_depth > 0)
+    return;
+  if (capture) {
+    capture->key(key);
+    return;
+  }
+  next_matches = key == std::get<std::string>(segments[levels.size() - 1]);
+}
+
+void PathMatcher::on_start_object() {
+  if (begin_value(Kind::Object)) {
+    capture->start_object();
+    capture_counts.push_back(0);
+  }
+}
+
+void PathMatcher::on_end_object() { end_container(false); }
+
+void PathMatcher::on_start_array() {
+  if (begin_value(Kind::Array)) {
+    capture->start_array();
+    capture_counts.push_back(0);
+  }
+}
+
+void PathMatcher::on_end_array() { end_container(true); }
+
+json::JSONValue PathMatcher::result() && {
+  if (match) {
+    return std::move(*match);
+  }
+  if (!failure.empty()) {
+    throw std::runtime_error(failure);
+  }
+  throw std::runtime_error("Path didn't match anything");
+}
@@ -0,0 +1,203 @@
+#include "program.hpp"
+
+#include <algorithm>
+
+Program Program::compile(const Expr &expr) {
+  Program program;
+  Subexpressions subexpressions;
+  describe(expr, subexpressions);
+  countUses(expr, subexpressions);
+  program.emit(expr, subexpressions);
+  return program;
+}
+
+// Two subexpressions get the same text exactly when they're structurally the same, so they evaluate to the
+// same thing against the same document
+const std::string &Program::describe(const Expr &expr, Subexpressions &subexpressions) {
+  std::string key;
+  if (const auto *literal = dynamic_cast<const LiteralExpr *>(&expr)) {
+    key = json::deparse(literal->value);
+  } else if (const auto *path = dynamic_cast<const PathExpr *>(&expr)) {
+    for (const auto &segment: path->segments) {
+      if (const auto *name = std::get_if<std::string>(&segment)) {
+        key += '.' + *name;
+      } else if (const auto *index = std::get_if<std::unique_ptr<Expr>>(&segment)) {
+        key += '[' + describe(**index, subexpressions) + ']';
+      } else {
+        key += describe(std::get<RangeSegment>(segment));
+      }
+    }
+  } else {
+    const auto &function = dynamic_cast<const FunctionExpr &>(expr);
+    key = function.name + '(';
+    for (const auto &arg: function.arguments)
+      key += describe(*arg, subexpressions) + ',';
+    key += ')';
+  }
+  return subexpressions.keys[&expr] = std::move(key);
+}
+
+std::string Program::describe(const RangeSegment &range) {
+  if (range.kind == RangeSegment::Kind::Members)
+    return ".*";
+  if (!range.start && !range.end && range.step == 1)
+    return "[*]";
+  const auto bound = [](const std::optional<std::int64_t> value) { return value ? std::to_string(*value) : ""; };
+  return '[' + bound(range.start) + ':' + bound(range.end) + ':' + std::to_string(range.step) + ']';
+}
+
+// Counts how often each subexpression will actually be needed, nothing inside a repeat is looked at again
+// after the first one. Has to go through the expression in the same order emit does
+void Program::countUses(const Expr &expr, Subexpressions &subexpressions) {
+  if (dynamic_cast<const LiteralExpr *>(&expr) != nullptr)
+    return;
+  if (subexpressions.counts[subexpressions.keys.at(&expr)]++ > 0)
+    return;
+
+  if (const auto *path = dynamic_cast<const PathExpr *>(&expr)) {
+    for (const auto &segment: path->segments) {
+      if (const auto *index = std::get_if<std::unique_ptr<Expr>>(&segment))
+        countUses(**index, subexpressions);
+    }
+  } else {
+    for (const auto &arg: dynamic_cast<const FunctionExpr &>(expr).arguments)
+      countUses(*arg, subexpressions);
+  }
+}
+
+void Program::push(const Op op, const size_t operand, const size_t count) {
+  code.push_back({op, static_cast<uint32_t>(operand), static_cast<uint32_t>(count)});
+
+  // Keep track of how deep the stacks get
+  switch (op) {
+    case Op::Literal:
+      values++;
+      break;
+    case Op::Root:
+      nodes++;
+      break;
+    case Op::Member:
+    case Op::Element:
+    case Op::Store:
+      break;
+    case Op::Load:
+      values++;
+      break;
+    case Op::Index:
+      values--;
+      break;
+    case Op::EndPath:
+      nodes--;
+      values++;
+      break;
+    case Op::Range:
+      nodes--;
+      values = values - count + 1;
+      break;
+    case Op::Min:
+    case Op::Max:
+    case Op::Size:
+    case Op::Unknown:
+      values = values - count + 1;
+      break;
+  }
+  max_nodes = std::max(max_nodes, nodes);
+  max_values = std::max(max_values, values);
+}
+
+void Program::emit(const Expr &expr, Subexpressions &subexpressions) {
+  if (const auto *literal = dynamic_cast<const LiteralExpr *>(&expr)) {
+    constants.push_back(literal->value);
+    push(Op::Literal, constants.size() - 1);
+    return;
+  }
+
+  // Repeats only need to be computed the first time, there's no branching so that one always runs first
+  const auto &key = subexpressions.keys.at(&expr);
+  const auto repeated = subexpressions.counts.at(key) > 1;
+  if (repeated) {
+    if (const auto it = subexpressions.registers.find(key); it != subexpressions.registers.end()) {
+      push(Op::Load, it->second);
+      return;
+    }
+  }
+
+  if (const auto *path = dynamic_cast<const PathExpr *>(&expr)) {
+    // Everything from the first range on is left to the range, see Op::Range
+    const auto first_range = std::find_if(path->segments.begin(), path->segments.end(), [](const auto &segment) {
+      return std::holds_alternative<RangeSegment>(segment);
+    });
+    push(Op::Root);
+    for (auto it = path->segments.begin(); it != first_range; ++it) {
+      const auto &segment = *it;
+      if (const auto *member = std::get_if<std::string>(&segment)) {
+        strings.push_back(*member);
+        push(Op::Member, strings.size() - 1);
+        continue;
+      }
+      const auto &index = *std::get<std::unique_ptr<Expr>>(segment);
+      // Literal numbers are by far the most common index, they don't need to go through the stack
+      const auto *literal = dynamic_cast<const LiteralExpr *>(&index);
+      if (literal != nullptr && literal->value.as_number()) {
+        constants.push_back(literal->value);
+        push(Op::Element, constants.size() - 1);
+      } else {
+        emit(index, subexpressions);
+        push(Op::Index);
+      }
+    }
+    if (first_range == path->segments.end()) {
+      push(Op::EndPath);
+    } else {
+      emitRange(std::span(first_range, path->segments.end()), subexpressions);
+    }
+  } else {
+    const auto &function = dynamic_cast<const FunctionExpr &>(expr);
+    for (const auto &arg: function.arguments)
+      emit(*arg, subexpressions);
+    const auto count = function.arguments.size();
+    if (function.name == "min") {
+      push(Op::Min, 0, count);
+    } else if (function.name == "max") {
+      push(Op::Max, 0, count);
+    } else if (function.name == "size") {
+      push(Op::Size, 0, count);
+    } else {
+      strings.push_back(function.name);
+      push(Op::Unknown, strings.size() - 1, count);
+    }
+  }
+
+  if (repeated) {
+    subexpressions.registers.emplace(key, registers);
+    push(Op::Store, registers++);
+  }
+}
+
+// Ranges walk the rest of the path themselves, once per value they select. Computed indexes still go through
+// the stack, they're computed once up front in path order and handed to the range with it
+void Program::emitRange(const std::span<const PathSegment> segments, Subexpressions &subexpressions) {
+  std::vector<RangeStep> steps;
+  size_t computed = 0;
+  for (const auto &segment: segments) {
+    if (const auto *member = std::get_if<std::string>(&segment)) {
+      strings.push_back(*member);
+      steps.push_back({RangeStep::Kind::Member, static_cast<uint32_t>(strings.size() - 1), {}});
+    } else if (const auto *range = std::get_if<RangeSegment>(&segment)) {
+      steps.push_back({RangeStep::Kind::Range, 0, *range});
+    } else {
+      const auto &index = *std::get<std::unique_ptr<Expr>>(segment);
+      const auto *literal = dynamic_cast<const LiteralExpr *>(&index);
+      if (literal != nullptr && literal->value.as_number()) {
+        constants.push_back(literal->value);
+        steps.push_back({RangeStep::Kind::Element, static_cast<uint32_t>(constants.size() - 1), {}});
+      } else {
+        emit(index, subexpressions);
+        steps.push_back({RangeStep::Kind::Index, 0, {}});
+        computed++;
+      }
+    }
+  }
+  ranges.push_back(std::move(steps));
+  push(Op::Range, ranges.size() - 1, computed);
+}
@@ -0,0 +1,340 @@
+#include "query_server.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <list>
+#include <stdexcept>
+#include <thread>
+#include "evaluator.hpp"
+#include "mapped_file.hpp"
+#include "writer.hpp"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+  // Splits off the first space separated word, the rest is what comes after the spaces following it
+  std::pair<std::string_view, std::string_view> word(std::string_view text) {
+    const auto start = text.find_first_not_of(' ');
+    if (start == std::string_view::npos)
+      return {{}, {}};
+    text.remove_prefix(start);
+    const auto end = std::min(text.find(' '), text.size());
+    auto rest = text.substr(end);
+    rest.remove_prefix(std::min(rest.find_first_not_of(' '), rest.size()));
+    return {text.substr(0, end), rest};
+  }
+
+  // Responses have to fit on one line, parse errors point at the source over several
+  std::string respond(const std::string_view status, const std::string_view payload) {
+    std::string response(status);
+    if (!payload.empty())
+      response += ' ';
+    for (const char c: payload) {
+      if (c == '\n')
+        response += "\\n";
+      else if (c == '\r')
+        response += "\\r";
+      else
+        response += c;
+    }
+    return response;
+  }
+} // anonymous namespace
+
+QueryServer::QueryServer(const size_t cache_capacity, const size_t latency_window) :
+    cache(cache_capacity), window(std::max<size_t>(latency_window, 1)) {}
+
+std::string QueryServer::load(const std::string &name, const std::string &path) {
+  // Parsed without holding the lock, queries keep going against the old version in the meantime
+  auto [file, file_error] = json::MappedFile::open(path);
+  if (!file_error.empty())
+    return file_error;
+  auto [document, json_error] = json::Document::parse(file.view());
+  if (!json_error.empty())
+    return "JSON parse error: " + json_error;
+
+  auto loaded = std::make_shared<const json::Document>(std::move(document));
+  std::unique_lock lock(documents_mutex);
+  documents[name] = Loaded{path, std::move(loaded)};
+  return "";
+}
+
+std::string QueryServer::query(const std::string_view name, const std::string_view expression) {
+  const auto start = std::chrono::steady_clock::now();
+
+  std::shared_ptr<const json::Document> document;
+  {
+    std::shared_lock lock(documents_mutex);
+    const auto it = documents.find(std::string(name));
+    if (it == documents.end())
+      return respond("error", "No document named " + std::string(name));
+    document = it->second.document;
+  }
+
+  std::string response;
+  try {
+    const auto entry = cache.get(expression);
+    const Evaluator evaluator(document->root());
+    const auto result = evaluator.evaluateRef(entry->program);
+    // Compact output escapes control characters in strings, so it's already one line
+    response = "ok ";
+    json::Writer writer(response);
+    result.write(writer);
+  } catch (const std::exception &e) {
+    response = respond("error", e.what());
+  }
+
+  record(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+  return response;
+}
+
+void QueryServer::record(const double micros) {
+  std::lock_guard lock(latency_mutex);
+  queries++;
+  if (samples.size() < window) {
+    samples.push_back(micros);
+  } else {
+    samples[next_sample] = micros;
+    next_sample = (next_sample + 1) % window;
+  }
+}
+
+QueryServer::Latency QueryServer::latency() const {
+  std::vector<double> sorted;
+  Latency latency;
+  {
+    std::lock_guard lock(latency_mutex);
+    sorted = samples;
+    latency.queries = queries;
+  }
+  if (sorted.empty())
+    return latency;
+
+  std::sort(sorted.begin(), sorted.end());
+  // Nearest rank
+  const auto percentile = [&sorted](const double p) {
+    const auto rank = static_cast<size_t>(std::ceil(p * static_cast<double>(sorted.size())));
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+  };
+  latency.p50 = percentile(0.50);
+  latency.p90 = percentile(0.90);
+  latency.p99 = percentile(0.99);
+  latency.max = sorted.back();
+  return latency;
+}
+
+std::optional<std::string> QueryServer::handle(const std::string_view request) {
+  const auto [command, arguments] = word(request);
+
+  if (command == "query") {
+    const auto [name, expression] = word(arguments);
+    if (name.empty() || expression.empty())
+      return respond("error", "Usage: query <name> <expression>");
+    return query(name, expression);
+  }
+
+  if (command == "load") {
+    const auto [name, path] = word(arguments);
+    if (name.empty() || path.empty())
+      return respond("error", "Usage: load <name> <json_file>");
+    const auto error = load(std::string(name), std::string(path));
+    return error.empty() ? respond("ok", "") : respond("error", error);
+  }
+
+  if (command == "reload" || command == "unload") {
+    const auto [name, rest] = word(arguments);
+    if (name.empty() || !rest.empty())
+      return respond("error", "Usage: " + std::string(command) + " <name>");
+
+    std::string path;
+    {
+      std::unique_lock lock(documents_mutex);
+      const auto it = documents.find(std::string(name));
+      if (it == documents.end())
+        return respond("error", "No document named " + std::string(name));
+      if (command == "unload") {
+        documents.erase(it);
+        return respond("ok", "");
+      }
+      path = it->second.path;
+    }
+    const auto error = load(std::string(name), path);
+    return error.empty() ? respond("ok", "") : respond("error", error);
+  }
+
+  if (command == "stats") {
+    const auto stats = latency();
+    char buffer[256];
+    std::snprintf(buffer, sizeof(buffer),
+                  R"({"queries": %llu, "p50_us": %.1f, "p90_us": %.1f, "p99_us": %.1f, "max_us": %.1f})",
+                  static_cast<unsigned long long>(stats.queries), stats.p50, stats.p90, stats.p99, stats.max);
+    return respond("ok", buffer);
+  }
+
+  if (command == "quit")
+    return std::nullopt;
+
+  if (command == "shutdown") {
+    stopping = true;
+#ifndef _WIN32
+    // Wakes up the accept in serve_socket
+    if (const int fd = listener; fd >= 0)
+      ::shutdown(fd, SHUT_RDWR);
+#endif
+    return std::nullopt;
+  }
+
+  return respond("error", "Unknown command: " + std::string(command));
+}
+
+void QueryServer::serve(std::istream &in, std::ostream &out) {
+  std::string line;
+  while (!stopping && std::getline(in, line)) {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if (line.find_first_not_of(' ') == std::string::npos)
+      continue;
+    const auto response = handle(line);
+    if (!response)
+      break;
+    out << *response << std::endl;
+  }
+}
+
+#ifdef _WIN32
+std::string QueryServer::serve_socket(const std::string &path) {
+  return "Unix domain sockets aren't supported on this platform: " + path;
+}
+#else
+namespace {
+  bool send_all(const int fd, std::string_view data) {
+    while (!data.empty()) {
+      const auto sent = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+      if (sent < 0) {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+      data.remove_prefix(static_cast<size_t>(sent));
+    }
+    return true;
+  }
+} // anonymous namespace
+
+std::string QueryServer::serve_socket(const std::string &path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path))
+    return "Socket path too long: " + path;
+  std::copy(path.begin(), path.end(), address.sun_path);
+
+  // A socket there is left over from a previous run that didn't get to clean up, anything else isn't ours to delete
+  struct stat existing{};
+  if (::lstat(path.c_str(), &existing) == 0) {
+    if (!S_ISSOCK(existing.st_mode))
+      return "Not a socket, refusing to replace it: " + path;
+    ::unlink(path.c_str());
+  }
+
+  const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return std::string("Failed to create socket: ") + std::strerror(errno);
+  if (::bind(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 || ::listen(fd, 64) != 0) {
+    const std::string error = std::strerror(errno);
+    ::close(fd);
+    return "Failed to listen on " + path + ": " + error;
+  }
+  listener = fd;
+
+  // Every connection and its thread, so shutting down can unblock the ones still waiting on their clients
+  // A list so the threads can hold on to their own entry while others come and go
+  struct Client {
+    int fd;
+    bool done = false; // the thread is finished and fd is closed
+    std::thread thread;
+  };
+  std::mutex clients_mutex;
+  std::list<Client> clients;
+
+  while (!stopping) {
+    const int client = ::accept(fd, nullptr, nullptr);
+    if (client < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    std::lock_guard lock(clients_mutex);
+    // Threads of connections that are already closed are joined here, otherwise a long running server would
+    // keep one around for every connection it ever had. Done is set last thing, so these join right away
+    std::erase_if(clients, [](Client &entry) {
+      if (entry.done)
+        entry.thread.join();
+      return entry.done;
+    });
+    auto &entry = clients.emplace_back(Client{client, false, {}});
+    entry.thread = std::thread([this, client, &entry, &clients_mutex] {
+      std::string buffer;
+      size_t scanned = 0; // what's left in buffer has been searched for a newline already
+      char chunk[4096];
+      bool open = true;
+      while (open) {
+        const auto received = ::recv(client, chunk, sizeof(chunk), 0);
+        if (received < 0 && errno == EINTR)
+          continue;
+        if (received <= 0)
+          break;
+        buffer.append(chunk, static_cast<size_t>(received));
+
+        size_t start = 0;
+        for (auto end = buffer.find('\n', scanned); end != std::string::npos; end = buffer.find('\n', start)) {
+          std::string_view line(buffer.data() + start, end - start);
+          start = end + 1;
+          if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+          if (line.find_first_not_of(' ') == std::string_view::npos)
+            continue;
+          const auto response = handle(line);
+          if (!response || !send_all(client, *response + '\n')) {
+            open = false;
+            break;
+          }
+        }
+        buffer.erase(0, start);
+        scanned = buffer.size();
+        // No telling where the next request starts once part of one is dropped, so the connection goes
+        if (open && buffer.size() > max_line_length) {
+          send_all(client, respond("error", "Line too long") + '\n');
+          open = false;
+        }
+      }
+
+      std::lock_guard lock(clients_mutex);
+      ::close(client);
+      entry.done = true;
+    });
+  }
+
+  listener = -1;
+  ::close(fd);
+  {
+    std::lock_guard lock(clients_mutex);
+    for (const auto &entry: clients) {
+      if (!entry.done)
+        ::shutdown(entry.fd, SHUT_RDWR);
+    }
+  }
+  for (auto &entry: clients)
+    entry.thread.join();
+  ::unlink(path.c_str());
+  return "";
+}
+#endif
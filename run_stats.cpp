@@ -0,0 +1,103 @@
+#include "run_stats.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace json {
+  RunStats::Scope::Scope(RunStats &stats, std::string name) :
+      stats(&stats), name(std::move(name)), start(std::chrono::steady_clock::now()), allocations(alloc_stats()) {}
+
+  RunStats::Scope::Scope(Scope &&other) noexcept :
+      stats(std::exchange(other.stats, nullptr)), name(std::move(other.name)), start(other.start),
+      allocations(other.allocations) {}
+
+  RunStats::Scope::~Scope() {
+    if (stats == nullptr)
+      return;
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stats->phase_list.push_back(Phase{std::move(name), elapsed, alloc_stats() - allocations});
+  }
+
+  RunStats::RunStats() :
+      counting_before(alloc_counting()), start(std::chrono::steady_clock::now()), allocations_before(alloc_stats()) {
+    set_alloc_counting(true);
+  }
+
+  RunStats::~RunStats() { set_alloc_counting(counting_before); }
+
+  void RunStats::set(const std::string &counter, const uint64_t value) {
+    const auto it = std::find_if(counter_list.begin(), counter_list.end(),
+                                 [&counter](const auto &entry) { return entry.first == counter; });
+    if (it != counter_list.end())
+      it->second = value;
+    else
+      counter_list.emplace_back(counter, value);
+  }
+
+  namespace {
+    // null for both when nothing was counting them
+    std::string allocations_json(const AllocStats &allocations) {
+      if (!alloc_counting_available())
+        return R"("allocations": null, "alloc_bytes": null)";
+      char buffer[96];
+      std::snprintf(buffer, sizeof(buffer), R"("allocations": %llu, "alloc_bytes": %llu)",
+                    static_cast<unsigned long long>(allocations.allocations),
+                    static_cast<unsigned long long>(allocations.bytes));
+      return buffer;
+    }
+  } // anonymous namespace
+
+  std::string RunStats::to_json() const {
+    char buffer[128];
+    std::snprintf(buffer, sizeof(buffer), R"({"total_seconds": %.6f, )",
+                  std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    std::string json = buffer + allocations_json(alloc_stats() - allocations_before);
+
+    json += R"(, "phases": [)";
+    for (size_t i = 0; i < phase_list.size(); i++) {
+      const auto &phase = phase_list[i];
+      json += i == 0 ? "" : ", ";
+      json += R"({"name": )" + deparse(JSONValue(phase.name));
+      std::snprintf(buffer, sizeof(buffer), R"(, "seconds": %.6f, )", phase.seconds);
+      json += buffer + allocations_json(phase.allocations) + "}";
+    }
+
+    json += R"(], "counters": {)";
+    for (size_t i = 0; i < counter_list.size(); i++) {
+      json += i == 0 ? "" : ", ";
+      json += deparse(JSONValue(counter_list[i].first)) + ": " + std::to_string(counter_list[i].second);
+    }
+    return json + "}}";
+  }
+
+  namespace {
+    // Columns count the same as the Array of numbers they stand for
+    DomStats column_stats(const size_t size) { return {1 + size, 2 + (size == 0 ? 0 : size - 1) + size}; }
+  } // anonymous namespace
+
+  DomStats dom_stats(const JSONValue &value) {
+    DomStats stats{1, 1};
+    if (const auto *array = std::get_if<Array>(&value.value)) {
+      // Brackets and commas
+      stats.tokens = 2 + (array->empty() ? 0 : array->size() - 1);
+      for (const auto &element: *array) {
+        const auto child = dom_stats(element);
+        stats.nodes += child.nodes;
+        stats.tokens += child.tokens;
+      }
+    } else if (const auto *doubles = std::get_if<DoubleColumn>(&value.value)) {
+      stats = column_stats(doubles->size());
+    } else if (const auto *integers = std::get_if<IntegerColumn>(&value.value)) {
+      stats = column_stats(integers->size());
+    } else if (const auto *object = std::get_if<Object>(&value.value)) {
+      // Braces, commas, and a key and a colon per member
+      stats.tokens = 2 + (object->empty() ? 0 : object->size() - 1) + 2 * object->size();
+      for (const auto &[_, member]: *object) {
+        const auto child = dom_stats(member);
+        stats.nodes += child.nodes;
+        stats.tokens += child.tokens;
+      }
+    }
+    return stats;
+  }
+} // namespace json
@@ -0,0 +1,315 @@
+#include "sax.hpp"
+
+#include <algorithm>
+#include <vector>
+#include "json_parser.hpp"
+#include "lex_func.hpp"
+#include "simd_scan.hpp"
+
+namespace json {
+  namespace {
+    // Forwards BasicParser's builder calls to a handler
+    class SaxBuilder {
+    private:
+      SaxHandler &handler;
+
+    public:
+      explicit SaxBuilder(SaxHandler &handler) : handler(handler) {}
+
+      void null() { handler.on_null(); }
+      void boolean(const bool b) { handler.on_bool(b); }
+      void number(const double n) { handler.on_number(n); }
+      void integer(const std::int64_t n) { handler.on_integer(n); }
+      void string(const std::string_view str) { handler.on_string(str); }
+      void key(const std::string_view key) { handler.on_key(key); }
+      void start_array() { handler.on_start_array(); }
+      void end_array(size_t) { handler.on_end_array(); }
+      void start_object() { handler.on_start_object(); }
+      void end_object(size_t) { handler.on_end_object(); }
+    };
+
+    // Incremental version of BasicParser's grammar that works on a window of the input. The window gets
+    // refilled whenever a token runs into its end, and everything before that token is dropped at that point.
+    // Nesting is kept on an explicit stack, so deep documents don't grow the call stack either
+    class StreamParser {
+    private:
+      enum class State { Value, FirstElement, FirstKey, Key, Colon, AfterValue };
+      static constexpr size_t max_kept_line = 4096;
+
+      std::istream &input;
+      SaxHandler &handler;
+      size_t chunk_size;
+      std::string window;
+      Offset pos = 0;
+      bool eof = false;
+      // Where the window starts in the input, so errors still point at the right line
+      Offset line = 1;
+      Offset column = 0;
+      std::string string_buffer;
+      // '[' or '{' for every container we're inside of
+      std::vector<char> open;
+
+      [[nodiscard]] Offset size() const { return std::ssize(window); }
+
+      // Drops what's been parsed and appends the next chunk, false when the input is done
+      // The start of the current line is kept (unless the line is huge) so errors can still show it
+      bool refill() {
+        if (eof)
+          return false;
+
+        // Either keep from the start of the line pos is on, or (when the window already starts on that line)
+        // keep the whole window
+        auto drop = static_cast<size_t>(pos);
+        const auto line_start = std::string_view(window).substr(0, drop).rfind('\n');
+        if (line_start != std::string_view::npos && drop - line_start <= max_kept_line) {
+          drop = line_start + 1;
+        } else if (line_start == std::string_view::npos && column == 0 && drop <= max_kept_line) {
+          drop = 0;
+        }
+
+        const auto dropped = std::string_view(window).substr(0, drop);
+        if (const auto newline = dropped.rfind('\n'); newline != std::string_view::npos) {
+          line += static_cast<Offset>(std::count(dropped.begin(), dropped.end(), '\n'));
+          column = static_cast<Offset>(dropped.size() - newline - 1);
+        } else {
+          column += static_cast<Offset>(dropped.size());
+        }
+        window.erase(0, drop);
+        pos -= static_cast<Offset>(drop);
+
+        const auto kept = window.size();
+        window.resize(kept + chunk_size);
+        input.read(window.data() + kept, static_cast<std::streamsize>(chunk_size));
+        const auto read = static_cast<size_t>(input.gcount());
+        window.resize(kept + read);
+        if (read == 0) {
+          eof = true;
+          return false;
+        }
+        return true;
+      }
+
+      // Moves to the next token, false when the input ends first
+      bool next_token() {
+        while (true) {
+          pos = skip_whitespace(window, pos);
+          if (pos < size())
+            return true;
+          if (!refill())
+            return false;
+        }
+      }
+
+      // Numbers and keywords run until the next delimiter, this makes sure it's in the window so
+      // they never get cut in half
+      void load_scalar() {
+        while (window.find_first_of(" \t\n\r,:[]{}\"", pos) == std::string::npos && refill()) {
+        }
+      }
+
+      // Errors show the whole line, so read up to its end first
+      void load_line() {
+        while (window.find('\n', pos) == std::string::npos && window.size() - pos <= max_kept_line && refill()) {
+        }
+      }
+
+      std::string error_at_token(const std::string_view base) {
+        load_line();
+        return json::error_at_token(base, window, pos, line, column);
+      }
+
+      [[nodiscard]] std::string error_at_eof(const std::string_view base) const {
+        return format_error_json(base, window, size(), line, column);
+      }
+
+      // The view points into string_buffer, valid until the next string
+      // Finds where the string ends first, refilling as often as that takes, and only then decodes it. Decoding
+      // again after every refill would go over long strings once per chunk
+      std::string read_string(std::string_view &out) {
+        // Past the opening quote, relative to pos since refill moves that along with the window
+        Offset scanned = 1;
+        while (true) {
+          scanned += static_cast<Offset>(find_string_special(std::string_view(window).substr(pos + scanned)));
+          if (pos + scanned < size()) {
+            const char c = window[pos + scanned];
+            // Control characters are an error either way, decoding reports them
+            if (c != '\\')
+              break;
+            if (pos + scanned + 1 < size()) {
+              scanned += 2;
+              continue;
+            }
+          }
+          // Ran into the end of the window, or a backslash right at it
+          if (!refill())
+            break;
+        }
+
+        string_buffer.clear();
+        auto [end, error] = decode_string_raw(window, pos, string_buffer);
+        if (error.empty()) {
+          pos = end;
+          out = string_buffer;
+          return "";
+        }
+        const auto offset = end - pos;
+        load_line();
+        return format_error_json(error, window, pos + offset, line, column);
+      }
+
+      std::string read_value(const char c) {
+        switch (c) {
+          case '[':
+            pos++;
+            open.push_back('[');
+            handler.on_start_array();
+            return "";
+          case '{':
+            pos++;
+            open.push_back('{');
+            handler.on_start_object();
+            return "";
+          case '"': {
+            std::string_view str;
+            if (auto error = read_string(str); !error.empty())
+              return error;
+            handler.on_string(str);
+            return "";
+          }
+          default:
+            break;
+        }
+
+        load_scalar();
+        if (c == 't' || c == 'f' || c == 'n') {
+          auto [token, end, error] = lexer_for(c)(window, pos);
+          if (token.value.empty())
+            return error_at_token("Failed to parse");
+          pos = end;
+          if (c == 'n')
+            handler.on_null();
+          else
+            handler.on_bool(c == 't');
+          return "";
+        }
+
+        const auto length = number_length(window, pos);
+        const auto number = length == 0 ? std::nullopt : to_number(std::string_view(window).substr(pos, length));
+        if (!number)
+          return error_at_token("Failed to parse");
+        pos += length;
+        if (const auto *integer = std::get_if<std::int64_t>(&*number))
+          handler.on_integer(*integer);
+        else
+          handler.on_number(std::get<double>(*number));
+        return "";
+      }
+
+      void close() {
+        const auto kind = open.back();
+        open.pop_back();
+        if (kind == '[')
+          handler.on_end_array();
+        else
+          handler.on_end_object();
+      }
+
+    public:
+      StreamParser(std::istream &input, SaxHandler &handler, const size_t chunk_size) :
+          input(input), handler(handler), chunk_size(std::max<size_t>(chunk_size, 1)) {}
+
+      // Same rules and messages as BasicParser
+      std::string parse() {
+        if (!next_token())
+          return error_at_eof("Unexpected EOF");
+
+        auto state = State::Value;
+        while (true) {
+          if (!next_token()) {
+            if (open.empty() && state == State::AfterValue)
+              return "";
+            if (open.empty())
+              return error_at_eof("Unexpected EOF");
+            return error_at_eof(open.back() == '[' ? "Unexpected EOF while parsing array"
+                                                   : "Unexpected EOF while parsing object");
+          }
+
+          const auto c = window[pos];
+          switch (state) {
+            case State::Value: {
+              if (auto error = read_value(c); !error.empty())
+                return error;
+              if (c == '[')
+                state = State::FirstElement;
+              else if (c == '{')
+                state = State::FirstKey;
+              else
+                state = State::AfterValue;
+              break;
+            }
+            case State::FirstElement:
+              if (c == ']') {
+                pos++;
+                close();
+                state = State::AfterValue;
+              } else {
+                state = State::Value;
+              }
+              break;
+            case State::FirstKey:
+              if (c == '}') {
+                pos++;
+                close();
+                state = State::AfterValue;
+                break;
+              }
+              if (c != '"')
+                return error_at_token("Expected key-value pair or closing brace in object");
+              state = State::Key;
+              break;
+            case State::Key: {
+              if (c != '"')
+                return error_at_token("Expected string key in object");
+              std::string_view key;
+              if (auto error = read_string(key); !error.empty())
+                return error;
+              handler.on_key(key);
+              state = State::Colon;
+              break;
+            }
+            case State::Colon:
+              if (c != ':')
+                return error_at_token("Expected colon after key in object");
+              pos++;
+              state = State::Value;
+              break;
+            case State::AfterValue:
+              // Only whitespace is allowed after the root value
+              if (open.empty())
+                return error_at_token("Unexpected trailing token");
+              if (c == (open.back() == '[' ? ']' : '}')) {
+                pos++;
+                close();
+                break;
+              }
+              if (c != ',')
+                return error_at_token(open.back() == '[' ? "Expected comma after element in array"
+                                                         : "Expected comma after element in object");
+              pos++; // move past ','
+              state = open.back() == '[' ? State::Value : State::Key;
+              break;
+          }
+        }
+      }
+    };
+  } // anonymous namespace
+
+  std::string parse_sax(const std::string_view source, SaxHandler &handler) {
+    SaxBuilder builder(handler);
+    return BasicParser(source, builder).parse();
+  }
+
+  std::string parse_sax(std::istream &input, SaxHandler &handler, const size_t chunk_size) {
+    return StreamParser(input, handler, chunk_size).parse();
+  }
+} // namespace json
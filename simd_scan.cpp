@@ -0,0 +1,332 @@
+#include "simd_scan.hpp"
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JSON_SIMD_X86 1
+#endif
+
+namespace json {
+  namespace {
+    // One bit per byte of a 64 byte block
+    struct BlockMasks {
+      uint64_t quote;
+      uint64_t backslash;
+      uint64_t op; // {}[]:,
+      uint64_t whitespace; // same set as std::isspace in the C locale
+    };
+
+    constexpr uint8_t QUOTE = 1, BACKSLASH = 2, OP = 4, WHITESPACE = 8;
+
+    constexpr std::array<uint8_t, 256> make_class_table() {
+      std::array<uint8_t, 256> table{};
+      table['"'] = QUOTE;
+      table['\\'] = BACKSLASH;
+      for (const unsigned char c: {'{', '}', '[', ']', ':', ','})
+        table[c] = OP;
+      for (const unsigned char c: {' ', '\t', '\n', '\v', '\f', '\r'})
+        table[c] = WHITESPACE;
+      return table;
+    }
+
+    constexpr auto class_table = make_class_table();
+
+    BlockMasks classify_scalar(const char *block) {
+      BlockMasks masks{};
+      for (int i = 0; i < 64; i++) {
+        const auto c = class_table[static_cast<unsigned char>(block[i])];
+        const uint64_t bit = uint64_t{1} << i;
+        if (c & QUOTE)
+          masks.quote |= bit;
+        if (c & BACKSLASH)
+          masks.backslash |= bit;
+        if (c & OP)
+          masks.op |= bit;
+        if (c & WHITESPACE)
+          masks.whitespace |= bit;
+      }
+      return masks;
+    }
+
+#ifdef JSON_SIMD_X86
+    // The helpers need the same target attribute as their callers, otherwise they can't be inlined
+    __attribute__((target("sse4.2"))) inline uint64_t movemask_sse(__m128i v) {
+      return static_cast<uint32_t>(_mm_movemask_epi8(v));
+    }
+
+    __attribute__((target("sse4.2"))) inline __m128i eq_sse(__m128i v, char c) {
+      return _mm_cmpeq_epi8(v, _mm_set1_epi8(c));
+    }
+
+    __attribute__((target("sse4.2"))) BlockMasks classify_sse42(const char *block) {
+      BlockMasks masks{};
+      for (int i = 0; i < 4; i++) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 16 * i));
+        const __m128i op = _mm_or_si128(
+            _mm_or_si128(_mm_or_si128(eq_sse(v, '{'), eq_sse(v, '}')), _mm_or_si128(eq_sse(v, '['), eq_sse(v, ']'))),
+            _mm_or_si128(eq_sse(v, ':'), eq_sse(v, ',')));
+        // '\t' to '\r' are contiguous, v is in range when clamping it to [9, 13] doesn't change it
+        const __m128i in_range = _mm_cmpeq_epi8(_mm_min_epu8(_mm_max_epu8(v, _mm_set1_epi8(9)), _mm_set1_epi8(13)), v);
+        const __m128i ws = _mm_or_si128(eq_sse(v, ' '), in_range);
+
+        const int shift = 16 * i;
+        masks.quote |= movemask_sse(eq_sse(v, '"')) << shift;
+        masks.backslash |= movemask_sse(eq_sse(v, '\\')) << shift;
+        masks.op |= movemask_sse(op) << shift;
+        masks.whitespace |= movemask_sse(ws) << shift;
+      }
+      return masks;
+    }
+
+    __attribute__((target("avx2"))) inline uint64_t movemask_avx(__m256i v) {
+      return static_cast<uint32_t>(_mm256_movemask_epi8(v));
+    }
+
+    __attribute__((target("avx2"))) inline __m256i eq_avx(__m256i v, char c) {
+      return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c));
+    }
+
+    __attribute__((target("avx2"))) BlockMasks classify_avx2(const char *block) {
+      BlockMasks masks{};
+      for (int i = 0; i < 2; i++) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + 32 * i));
+        const __m256i op = _mm256_or_si256(_mm256_or_si256(_mm256_or_si256(eq_avx(v, '{'), eq_avx(v, '}')),
+                                                           _mm256_or_si256(eq_avx(v, '['), eq_avx(v, ']'))),
+                                           _mm256_or_si256(eq_avx(v, ':'), eq_avx(v, ',')));
+        const __m256i in_range = _mm256_cmpeq_epi8(
+            _mm256_min_epu8(_mm256_max_epu8(v, _mm256_set1_epi8(9)), _mm256_set1_epi8(13)), v);
+        const __m256i ws = _mm256_or_si256(eq_avx(v, ' '), in_range);
+
+        const int shift = 32 * i;
+        masks.quote |= movemask_avx(eq_avx(v, '"')) << shift;
+        masks.backslash |= movemask_avx(eq_avx(v, '\\')) << shift;
+        masks.op |= movemask_avx(op) << shift;
+        masks.whitespace |= movemask_avx(ws) << shift;
+      }
+      return masks;
+    }
+#endif
+
+    // String scanning: the first '"', '\\' or control character, everything before it is copied as is
+    constexpr bool is_string_special(const unsigned char c) { return c == '"' || c == '\\' || c < 0x20; }
+
+    size_t find_string_special_scalar(const char *data, const size_t size, size_t i) {
+      while (i < size && !is_string_special(static_cast<unsigned char>(data[i])))
+        i++;
+      return i;
+    }
+
+#ifdef JSON_SIMD_X86
+    __attribute__((target("sse4.2"))) size_t find_string_special_sse42(const char *data, const size_t size) {
+      size_t i = 0;
+      for (; i + 16 <= size; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        // Below 0x20 is the same as clamping to at most 0x1f not changing it
+        const __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1f)), v);
+        const auto mask = movemask_sse(_mm_or_si128(_mm_or_si128(eq_sse(v, '"'), eq_sse(v, '\\')), control));
+        if (mask != 0)
+          return i + std::countr_zero(mask);
+      }
+      return find_string_special_scalar(data, size, i);
+    }
+
+    __attribute__((target("avx2"))) size_t find_string_special_avx2(const char *data, const size_t size) {
+      size_t i = 0;
+      for (; i + 32 <= size; i += 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        const __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(0x1f)), v);
+        const auto mask =
+            movemask_avx(_mm256_or_si256(_mm256_or_si256(eq_avx(v, '"'), eq_avx(v, '\\')), control));
+        if (mask != 0)
+          return i + std::countr_zero(mask);
+      }
+      return find_string_special_scalar(data, size, i);
+    }
+#endif
+
+    size_t find_string_special_fallback(const char *data, const size_t size) {
+      return find_string_special_scalar(data, size, 0);
+    }
+
+    using StringScanFn = size_t (*)(const char *, size_t);
+
+    StringScanFn string_scanner_for(const SimdLevel level) {
+#ifdef JSON_SIMD_X86
+      switch (level) {
+        case SimdLevel::AVX2:
+          return find_string_special_avx2;
+        case SimdLevel::SSE42:
+          return find_string_special_sse42;
+        case SimdLevel::Scalar:
+          break;
+      }
+#endif
+      (void) level;
+      return find_string_special_fallback;
+    }
+
+    using ClassifyFn = BlockMasks (*)(const char *);
+
+    ClassifyFn classifier_for(const SimdLevel level) {
+#ifdef JSON_SIMD_X86
+      switch (level) {
+        case SimdLevel::AVX2:
+          return classify_avx2;
+        case SimdLevel::SSE42:
+          return classify_sse42;
+        case SimdLevel::Scalar:
+          break;
+      }
+#endif
+      (void) level;
+      return classify_scalar;
+    }
+
+    SimdLevel detect() {
+#ifdef JSON_SIMD_X86
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2"))
+        return SimdLevel::AVX2;
+      if (__builtin_cpu_supports("sse4.2"))
+        return SimdLevel::SSE42;
+#endif
+      return SimdLevel::Scalar;
+    }
+
+    const SimdLevel detected_level = detect();
+    std::atomic<SimdLevel> active_level{detected_level};
+    std::atomic<ClassifyFn> active_classifier{classifier_for(detected_level)};
+    std::atomic<StringScanFn> active_string_scanner{string_scanner_for(detected_level)};
+
+    // Bit i is the xor of bits 0..i, turns quote positions into "inside a string" ranges
+    uint64_t prefix_xor(uint64_t bits) {
+      bits ^= bits << 1;
+      bits ^= bits << 2;
+      bits ^= bits << 4;
+      bits ^= bits << 8;
+      bits ^= bits << 16;
+      bits ^= bits << 32;
+      return bits;
+    }
+
+    // Marks the characters that follow an unescaped backslash
+    // Backslashes are rare enough in most documents that walking them one at a time is fine
+    uint64_t find_escaped(uint64_t backslash, uint64_t &carry) {
+      uint64_t escaped = 0;
+      if (carry) {
+        // First character is escaped, if it's a backslash it doesn't start a new escape
+        escaped = 1;
+        backslash &= ~uint64_t{1};
+      }
+      carry = 0;
+
+      while (backslash) {
+        const int i = std::countr_zero(backslash);
+        if (i == 63) {
+          carry = 1;
+          break;
+        }
+        escaped |= uint64_t{1} << (i + 1);
+        // the escaped character can't start an escape of its own
+        backslash &= ~(uint64_t{3} << i);
+      }
+      return escaped;
+    }
+  } // anonymous namespace
+
+  SimdLevel detected_simd_level() { return detected_level; }
+
+  SimdLevel active_simd_level() { return active_level.load(std::memory_order_relaxed); }
+
+  void set_simd_level(SimdLevel level) {
+    if (static_cast<int>(level) > static_cast<int>(detected_level))
+      level = detected_level;
+    active_level.store(level, std::memory_order_relaxed);
+    active_classifier.store(classifier_for(level), std::memory_order_relaxed);
+    active_string_scanner.store(string_scanner_for(level), std::memory_order_relaxed);
+  }
+
+  const char *simd_level_name(const SimdLevel level) {
+    switch (level) {
+      case SimdLevel::Scalar:
+        return "scalar";
+      case SimdLevel::SSE42:
+        return "sse4.2";
+      case SimdLevel::AVX2:
+        return "avx2";
+    }
+    return "unknown";
+  }
+
+  StructuralScanner::StructuralScanner(const std::string_view source) : source(source) {}
+
+  // Blocks don't have to be aligned, so we can just pretend the source begins at start
+  StructuralScanner::StructuralScanner(const std::string_view source, const size_t start) :
+      source(source), block_start(start) {}
+
+  void StructuralScanner::load_next_block() {
+    if (loaded)
+      block_start += 64;
+    loaded = true;
+
+    const auto classify = active_classifier.load(std::memory_order_relaxed);
+    BlockMasks masks{};
+    if (block_start + 64 <= source.size()) {
+      masks = classify(source.data() + block_start);
+    } else {
+      // Pad the tail with whitespace so it never produces token starts
+      char tail[64];
+      std::memset(tail, ' ', sizeof(tail));
+      std::memcpy(tail, source.data() + block_start, source.size() - block_start);
+      masks = classify(tail);
+    }
+
+    const uint64_t quote = masks.quote & ~find_escaped(masks.backslash, prev_escaped);
+    // Includes the opening quote but not the closing one
+    const uint64_t in_string = prefix_xor(quote) ^ prev_in_string;
+    prev_in_string = static_cast<uint64_t>(static_cast<int64_t>(in_string) >> 63);
+
+    const uint64_t boundary = masks.op | masks.whitespace | masks.quote;
+    const uint64_t follows_boundary = (boundary << 1) | prev_boundary;
+    prev_boundary = boundary >> 63;
+
+    const uint64_t scalar_starts = ~boundary & follows_boundary;
+    starts = ((masks.op | scalar_starts) & ~in_string) | (quote & in_string);
+  }
+
+  Offset StructuralScanner::next(const Offset index) {
+    const auto size = source.size();
+    const auto target = static_cast<size_t>(index);
+    if (target >= size)
+      return static_cast<Offset>(size);
+
+    while (!loaded || block_start + 64 <= target)
+      load_next_block();
+
+    uint64_t remaining = starts & (~uint64_t{0} << (target - block_start));
+    while (remaining == 0) {
+      if (block_start + 64 >= size)
+        return static_cast<Offset>(size);
+      load_next_block();
+      remaining = starts;
+    }
+    return static_cast<Offset>(block_start + std::countr_zero(remaining));
+  }
+
+  size_t find_string_special(const std::string_view text) {
+    return active_string_scanner.load(std::memory_order_relaxed)(text.data(), text.size());
+  }
+
+  std::vector<Offset> structural_index(const std::string_view source) {
+    std::vector<Offset> index;
+    StructuralScanner scanner(source);
+    const Offset size = std::ssize(source);
+    for (Offset i = scanner.next(0); i < size; i = scanner.next(i + 1))
+      index.push_back(i);
+    return index;
+  }
+} // namespace json
@@ -0,0 +1,292 @@
+#include "tape.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <memory_resource>
+#include <unordered_map>
+#include "json_parser.hpp"
+#include "key_table.hpp"
+
+namespace json {
+  namespace {
+    constexpr int type_shift = 56;
+    constexpr uint64_t payload_mask = (uint64_t{1} << type_shift) - 1;
+
+    // Container starts pack where they end and how many children they have into the payload
+    constexpr int count_shift = 36;
+    constexpr uint64_t end_mask = (uint64_t{1} << count_shift) - 1;
+    constexpr uint64_t max_count = (uint64_t{1} << (type_shift - count_shift)) - 1;
+
+    // Keys that a later duplicate in the same object overrides are skipped by lookups and iteration,
+    // so the tape agrees with the DOM where the last duplicate wins
+    constexpr auto shadowed_key = static_cast<uint8_t>(TapeType::ShadowedKey);
+
+    constexpr uint64_t make_word(const uint8_t type, const uint64_t payload) {
+      return (static_cast<uint64_t>(type) << type_shift) | payload;
+    }
+
+    constexpr uint8_t type_of(const uint64_t word) { return static_cast<uint8_t>(word >> type_shift); }
+
+    // Strings are prefixed with a 32 bit length, this one means a 64 bit length follows instead
+    constexpr uint32_t long_string_length = UINT32_MAX;
+  } // anonymous namespace
+
+  // Builder for BasicParser that writes the tape while parsing
+  class TapeBuilder {
+  private:
+    Tape &tape;
+    // Indices of the container starts that haven't been closed yet
+    std::vector<size_t> open;
+    // Indices of the key words of the objects that haven't been closed yet
+    std::vector<size_t> member_keys;
+    // Every key is written to the string buffer once, interning gives us a stable pointer to look it up by
+    // The table only lives as long as the builder, its arena frees the keys with it
+    std::pmr::monotonic_buffer_resource key_arena;
+    KeyTable keys{&key_arena};
+    std::unordered_map<const char *, uint64_t> key_offsets;
+
+    void emit(const TapeType type, const uint64_t payload = 0) {
+      tape.words.push_back(make_word(static_cast<uint8_t>(type), payload));
+    }
+
+    uint64_t append_string(const std::string_view str) {
+      const uint64_t offset = tape.strings.size();
+      // 4 GiB and up gets the long_string marker and the real length after it
+      const bool long_string = str.size() >= long_string_length;
+      const auto length = long_string ? long_string_length : static_cast<uint32_t>(str.size());
+      const size_t prefix = sizeof(length) + (long_string ? sizeof(uint64_t) : 0);
+      tape.strings.resize(offset + prefix + str.size());
+      std::memcpy(tape.strings.data() + offset, &length, sizeof(length));
+      if (long_string) {
+        const uint64_t full_length = str.size();
+        std::memcpy(tape.strings.data() + offset + sizeof(length), &full_length, sizeof(full_length));
+      }
+      std::memcpy(tape.strings.data() + offset + prefix, str.data(), str.size());
+      return offset;
+    }
+
+    void close(const TapeType end, uint64_t count) {
+      const auto start = open.back();
+      open.pop_back();
+      emit(end, start);
+      count = std::min(count, max_count);
+      tape.words[start] |= (count << count_shift) | tape.words.size();
+    }
+
+    // Shadows every key but the last of each duplicate, returns how many members are left
+    size_t shadow_duplicates(const size_t first_key, const size_t count) {
+      auto offset_of = [&](const size_t i) { return tape.words[member_keys[first_key + i]] & payload_mask; };
+
+      size_t shadowed = 0;
+      if (count <= 16) {
+        for (size_t i = 0; i < count; i++) {
+          for (size_t j = i + 1; j < count; j++) {
+            if (offset_of(i) == offset_of(j)) {
+              auto &word = tape.words[member_keys[first_key + i]];
+              word = make_word(shadowed_key, word & payload_mask);
+              shadowed++;
+              break;
+            }
+          }
+        }
+        return count - shadowed;
+      }
+
+      std::unordered_map<uint64_t, size_t> last_seen;
+      last_seen.reserve(count);
+      for (size_t i = 0; i < count; i++) {
+        if (auto [it, inserted] = last_seen.try_emplace(offset_of(i), i); !inserted) {
+          auto &word = tape.words[member_keys[first_key + it->second]];
+          word = make_word(shadowed_key, word & payload_mask);
+          it->second = i;
+          shadowed++;
+        }
+      }
+      return count - shadowed;
+    }
+
+  public:
+    explicit TapeBuilder(Tape &tape) : tape(tape) {}
+
+    void null() { emit(TapeType::Null); }
+    void boolean(const bool b) { emit(b ? TapeType::True : TapeType::False); }
+
+    void number(const double n) {
+      emit(TapeType::Number);
+      tape.words.push_back(std::bit_cast<uint64_t>(n));
+    }
+
+    void integer(const std::int64_t n) {
+      emit(TapeType::Integer);
+      tape.words.push_back(std::bit_cast<uint64_t>(n));
+    }
+
+    void string(const std::string_view str) { emit(TapeType::String, append_string(str)); }
+
+    void key(const std::string_view key) {
+      const auto interned = keys.intern(key);
+      auto [it, inserted] = key_offsets.try_emplace(interned.data(), 0);
+      if (inserted)
+        it->second = append_string(key);
+      member_keys.push_back(tape.words.size());
+      emit(TapeType::String, it->second);
+    }
+
+    void start_array() {
+      open.push_back(tape.words.size());
+      emit(TapeType::StartArray);
+    }
+
+    void end_array(const size_t count) { close(TapeType::EndArray, count); }
+
+    void start_object() {
+      open.push_back(tape.words.size());
+      emit(TapeType::StartObject);
+    }
+
+    void end_object(const size_t count) {
+      const auto first_key = member_keys.size() - count;
+      const auto members = shadow_duplicates(first_key, count);
+      member_keys.resize(first_key);
+      close(TapeType::EndObject, members);
+    }
+  };
+
+  std::tuple<Tape, std::string> Tape::parse(const std::string_view source) {
+    Tape tape;
+    // Roughly one word per token, reserving a fraction of the source saves most of the regrowing
+    tape.words.reserve(source.size() / 8);
+
+    TapeBuilder builder(tape);
+    if (auto error = BasicParser(source, builder).parse(); !error.empty()) {
+      return {Tape{}, error};
+    }
+
+    tape.words.shrink_to_fit();
+    tape.strings.shrink_to_fit();
+    return {std::move(tape), ""};
+  }
+
+  uint64_t TapeCursor::word() const { return tape->words[index]; }
+
+  uint64_t TapeCursor::payload() const { return word() & payload_mask; }
+
+  TapeType TapeCursor::type() const { return static_cast<TapeType>(type_of(word())); }
+
+  double TapeCursor::as_number() const {
+    if (is_integer())
+      return static_cast<double>(as_integer());
+    return std::bit_cast<double>(tape->words[index + 1]);
+  }
+
+  std::int64_t TapeCursor::as_integer() const { return std::bit_cast<std::int64_t>(tape->words[index + 1]); }
+
+  std::string_view TapeCursor::as_string() const {
+    const auto *entry = tape->strings.data() + payload();
+    uint32_t length;
+    std::memcpy(&length, entry, sizeof(length));
+    if (length == long_string_length) {
+      uint64_t full_length;
+      std::memcpy(&full_length, entry + sizeof(length), sizeof(full_length));
+      return {entry + sizeof(length) + sizeof(full_length), full_length};
+    }
+    return {entry + sizeof(length), length};
+  }
+
+  size_t TapeCursor::size() const {
+    if (!is_array() && !is_object())
+      return 0;
+
+    if (const auto count = payload() >> count_shift; count < max_count)
+      return count;
+
+    // Too many children to fit in the payload, count them the slow way
+    size_t count = 0;
+    if (is_array())
+      for_each_element([&count](TapeCursor) { count++; });
+    else
+      for_each_member([&count](std::string_view, TapeCursor) { count++; });
+    return count;
+  }
+
+  std::optional<TapeCursor> TapeCursor::find(const std::string_view key) const {
+    if (!is_object())
+      return std::nullopt;
+
+    for (TapeCursor member_key{tape, index + 1}; member_key.type() != TapeType::EndObject;) {
+      const TapeCursor value{tape, member_key.index + 1};
+      if (member_key.type() == TapeType::String && member_key.as_string() == key)
+        return value;
+      member_key = value.next();
+    }
+    return std::nullopt;
+  }
+
+  std::vector<std::pair<std::string_view, TapeCursor>> TapeCursor::members_by_key() const {
+    std::vector<std::pair<std::string_view, TapeCursor>> members;
+    members.reserve(size());
+    for_each_member([&members](const std::string_view key, const TapeCursor value) { members.emplace_back(key, value); });
+    // Shadowed duplicates are already skipped, so keys are unique
+    std::sort(members.begin(), members.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+    return members;
+  }
+
+  std::optional<TapeCursor> TapeCursor::at(size_t i) const {
+    if (!is_array() || i >= size())
+      return std::nullopt;
+
+    TapeCursor child{tape, index + 1};
+    for (; i > 0; i--)
+      child = child.next();
+    return child;
+  }
+
+  TapeCursor TapeCursor::next() const {
+    switch (type()) {
+      case TapeType::StartArray:
+      case TapeType::StartObject:
+        return {tape, static_cast<size_t>(payload() & end_mask)};
+      case TapeType::Number:
+      case TapeType::Integer:
+        return {tape, index + 2};
+      default:
+        return {tape, index + 1};
+    }
+  }
+
+  JSONValue TapeCursor::materialize() const {
+    switch (type()) {
+      case TapeType::Null:
+        return JSONValue{};
+      case TapeType::True:
+        return JSONValue(true);
+      case TapeType::False:
+        return JSONValue(false);
+      case TapeType::Number:
+        return JSONValue(as_number());
+      case TapeType::Integer:
+        return JSONValue(as_integer());
+      case TapeType::String:
+        return JSONValue(as_string());
+      case TapeType::StartArray: {
+        std::vector<JSONValue> children;
+        children.reserve(size());
+        for_each_element([&children](const TapeCursor child) { children.push_back(child.materialize()); });
+        // Same representation the parser would have picked
+        return make_array(children, std::pmr::get_default_resource());
+      }
+      case TapeType::StartObject: {
+        std::pmr::vector<ObjectMember> members;
+        members.reserve(size());
+        for_each_member([&members](const std::string_view key, const TapeCursor value) {
+          members.push_back(ObjectMember{key, value.materialize()});
+        });
+        // The keys still point into the tape, the object makes its own copy
+        return JSONValue(Object(std::move(members), nullptr));
+      }
+      default:
+        return JSONValue{};
+    }
+  }
+} // namespace json
@@ -0,0 +1,39 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+namespace json {
+  ThreadPool::ThreadPool(size_t threads) {
+    if (threads == 0)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+
+    workers.reserve(threads);
+    for (size_t i = 0; i < threads; i++)
+      workers.emplace_back([this] { work(); });
+  }
+
+  ThreadPool::~ThreadPool() {
+    {
+      std::lock_guard lock(mutex);
+      stopping = true;
+    }
+    available.notify_all();
+    for (auto &worker: workers)
+      worker.join();
+  }
+
+  void ThreadPool::work() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock lock(mutex);
+        available.wait(lock, [this] { return stopping || !tasks.empty(); });
+        if (tasks.empty())
+          return;
+        task = std::move(tasks.front());
+        tasks.pop();
+      }
+      task();
+    }
+  }
+} // namespace json
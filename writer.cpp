@@ -0,0 +1,282 @@
+#include "writer.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+namespace json {
+  // Whole numbers are kept in plain notation so counts and the like don't come out as 1e+06
+  char *format_number(char *first, const double number) {
+    // JSON has nothing for infinity and NaN, the parser never makes them but values built in code can hold them
+    if (!std::isfinite(number))
+      return std::copy_n("null", 4, first);
+    char *last = first + 32;
+    const auto whole = std::isfinite(number) && std::trunc(number) == number && std::fabs(number) < 1e17;
+    return (whole ? std::to_chars(first, last, number, std::chars_format::fixed) : std::to_chars(first, last, number))
+        .ptr;
+  }
+
+  Writer::Writer(std::string &out, const Style style) :
+      out(&out), limit(std::string::npos), style(style) {}
+
+  Writer::Writer(std::ostream &out, const Style style, const size_t buffer_size) :
+      out(&buffer), sink([&out](const std::string_view data) {
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        return !out.fail();
+      }),
+      limit(buffer_size), style(style) {
+    buffer.reserve(buffer_size);
+  }
+
+  Writer::Writer(const int fd, const Style style, const size_t buffer_size) :
+      out(&buffer), sink([fd](std::string_view data) {
+        while (!data.empty()) {
+#ifdef _WIN32
+          const auto written = ::_write(fd, data.data(), static_cast<unsigned>(data.size()));
+#else
+          const auto written = ::write(fd, data.data(), data.size());
+          if (written < 0 && errno == EINTR)
+            continue;
+#endif
+          if (written <= 0)
+            return false;
+          data.remove_prefix(static_cast<size_t>(written));
+        }
+        return true;
+      }),
+      limit(buffer_size), style(style) {
+    buffer.reserve(buffer_size);
+  }
+
+  void Writer::flush() {
+    if (!sink || buffer.empty())
+      return;
+    if (failure.empty() && !sink(buffer))
+      failure = std::string("Failed to write output: ") + std::strerror(errno);
+    buffer.clear();
+  }
+
+  void Writer::newline() {
+    if (style == Style::Compact)
+      return;
+    out->push_back('\n');
+    out->append(depth * 2, ' ');
+  }
+
+  Writer &Writer::raw(const std::string_view text) {
+    out->append(text);
+    maybe_flush();
+    return *this;
+  }
+
+  Writer &Writer::raw(const char c) {
+    out->push_back(c);
+    maybe_flush();
+    return *this;
+  }
+
+  void Writer::write_string(const std::string_view s) {
+    static constexpr char hex[] = "0123456789abcdef";
+    out->push_back('"');
+    // Most strings have nothing to escape, copy the clean runs in one go
+    size_t run = 0;
+    for (size_t i = 0; i < s.size(); i++) {
+      const auto c = static_cast<unsigned char>(s[i]);
+      if (c >= 0x20 && c != '"' && c != '\\')
+        continue;
+
+      out->append(s.data() + run, i - run);
+      run = i + 1;
+      switch (c) {
+        case '"':
+          out->append("\\\"");
+          break;
+        case '\\':
+          out->append("\\\\");
+          break;
+        case '\b':
+          out->append("\\b");
+          break;
+        case '\f':
+          out->append("\\f");
+          break;
+        case '\n':
+          out->append("\\n");
+          break;
+        case '\r':
+          out->append("\\r");
+          break;
+        case '\t':
+          out->append("\\t");
+          break;
+        default:
+          out->append("\\u00");
+          out->push_back(hex[c >> 4]);
+          out->push_back(hex[c & 0xf]);
+      }
+    }
+    out->append(s.data() + run, s.size() - run);
+    out->push_back('"');
+  }
+
+  void Writer::write_number(const double number) {
+    char text[32];
+    out->append(text, format_number(text, number));
+  }
+
+  void Writer::write_integer(const std::int64_t number) {
+    char text[24];
+    out->append(text, std::to_chars(text, text + sizeof(text), number).ptr);
+  }
+
+  Writer &Writer::write(const JSONValue &value) {
+    std::visit(
+        [this]<typename T0>(const T0 &v) {
+          using T = std::decay_t<T0>;
+
+          if constexpr (std::is_same_v<T, std::monostate>) {
+            out->append("null");
+          } else if constexpr (std::is_same_v<T, String>) {
+            write_string(v);
+          } else if constexpr (std::is_same_v<T, double>) {
+            write_number(v);
+          } else if constexpr (std::is_same_v<T, std::int64_t>) {
+            write_integer(v);
+          } else if constexpr (std::is_same_v<T, bool>) {
+            out->append(v ? "true" : "false");
+          } else if constexpr (std::is_same_v<T, Array> || std::is_same_v<T, DoubleColumn> ||
+                               std::is_same_v<T, IntegerColumn>) {
+            out->push_back('[');
+            if (!v.empty()) {
+              depth++;
+              for (size_t i = 0; i < v.size(); i++) {
+                if (i > 0)
+                  out->append(style == Style::Compact ? ", " : ",");
+                newline();
+                // Columns come out exactly like the Array of the same numbers would
+                if constexpr (std::is_same_v<T, Array>) {
+                  write(v[i]);
+                } else {
+                  if constexpr (std::is_same_v<T, DoubleColumn>)
+                    write_number(v[i]);
+                  else
+                    write_integer(v[i]);
+                  maybe_flush();
+                }
+              }
+              depth--;
+              newline();
+            }
+            out->push_back(']');
+          } else if constexpr (std::is_same_v<T, Object>) {
+            out->push_back('{');
+            if (!v.empty()) {
+              depth++;
+              bool first = true;
+              for (const auto &[key, member]: v) {
+                if (!first)
+                  out->append(style == Style::Compact ? ", " : ",");
+                first = false;
+                newline();
+                write_string(key);
+                out->append(style == Style::Compact ? ":" : ": ");
+                write(member);
+              }
+              depth--;
+              newline();
+            }
+            out->push_back('}');
+          }
+        },
+        value.value);
+    maybe_flush();
+    return *this;
+  }
+
+  Writer &Writer::write(const TapeCursor cursor) {
+    switch (cursor.type()) {
+      case TapeType::True:
+        out->append("true");
+        break;
+      case TapeType::False:
+        out->append("false");
+        break;
+      case TapeType::Number:
+        write_number(cursor.as_number());
+        break;
+      case TapeType::Integer:
+        write_integer(cursor.as_integer());
+        break;
+      case TapeType::String:
+        write_string(cursor.as_string());
+        break;
+      case TapeType::StartArray: {
+        out->push_back('[');
+        if (cursor.size() == 0) {
+          out->push_back(']');
+          break;
+        }
+        depth++;
+        bool first = true;
+        cursor.for_each_element([this, &first](const TapeCursor element) {
+          if (!first)
+            out->append(style == Style::Compact ? ", " : ",");
+          first = false;
+          newline();
+          write(element);
+        });
+        depth--;
+        newline();
+        out->push_back(']');
+        break;
+      }
+      case TapeType::StartObject: {
+        out->push_back('{');
+        if (cursor.size() == 0) {
+          out->push_back('}');
+          break;
+        }
+        depth++;
+        // Key order, so the text is the same as for the materialized Object
+        bool first = true;
+        for (const auto &[key, member]: cursor.members_by_key()) {
+          if (!first)
+            out->append(style == Style::Compact ? ", " : ",");
+          first = false;
+          newline();
+          write_string(key);
+          out->append(style == Style::Compact ? ":" : ": ");
+          write(member);
+        }
+        depth--;
+        newline();
+        out->push_back('}');
+        break;
+      }
+      default:
+        out->append("null");
+    }
+    maybe_flush();
+    return *this;
+  }
+
+  std::string deparse(const JSONValue &value) {
+    std::string text;
+    Writer(text).write(value);
+    return text;
+  }
+
+  std::string deparse(const TapeCursor cursor) {
+    std::string text;
+    Writer(text).write(cursor);
+    return text;
+  }
+} // namespace json